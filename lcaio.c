@@ -0,0 +1,493 @@
+/*
+  This file is part of the LCONFIG laboratory configuration system.
+
+    LCONFIG is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    LCONFIG is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with LCONFIG.  If not, see <https://www.gnu.org/licenses/>.
+
+    Authored by C.Martin crm28@psu.edu
+*/
+
+#define _GNU_SOURCE         // for O_DIRECT
+#include "lcaio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+
+// There is no libc wrapper for the io_uring system calls
+int uring_setup(unsigned int entries, struct io_uring_params *params){
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+int uring_enter(int ring, unsigned int submit, unsigned int wait, unsigned int flags){
+    return (int) syscall(__NR_io_uring_enter, ring, submit, wait, flags, NULL, 0);
+}
+
+int uring_register(int ring, unsigned int opcode, void *arg, unsigned int nargs){
+    return (int) syscall(__NR_io_uring_register, ring, opcode, arg, nargs);
+}
+
+
+// IORING_OP_WRITE arrived in Linux 5.6, after io_uring itself (5.1).  An
+// older kernel accepts the ring and then fails every write, so ask the 
+// ring which operations it supports.  Kernels without the probe (before
+// 5.6) don't have the write either.  Returns 1 if writes are supported.
+int uring_can_write(int ring){
+    struct io_uring_probe *probe;
+    unsigned int nops = 256;
+    int result = 0;
+    probe = calloc(1, sizeof(struct io_uring_probe) + nops*sizeof(struct io_uring_probe_op));
+    if(!probe)
+        return 0;
+    if(uring_register(ring, IORING_REGISTER_PROBE, probe, nops) >= 0
+            && probe->last_op >= IORING_OP_WRITE
+            && (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED))
+        result = 1;
+    free(probe);
+    return result;
+}
+
+
+// Map the submission and completion rings.  Returns LC_ERROR on failure.
+int uring_map(lcaio_t *aio, struct io_uring_params *params){
+    aio->sq_bytes = params->sq_off.array + params->sq_entries * sizeof(unsigned int);
+    aio->cq_bytes = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+    // Newer kernels put both rings in one mapping
+    if(params->features & IORING_FEAT_SINGLE_MMAP){
+        if(aio->cq_bytes > aio->sq_bytes)
+            aio->sq_bytes = aio->cq_bytes;
+        aio->cq_bytes = 0;
+    }
+    aio->sq_ring = mmap(NULL, aio->sq_bytes, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, aio->ring, IORING_OFF_SQ_RING);
+    if(aio->sq_ring == MAP_FAILED){
+        aio->sq_ring = NULL;
+        return LC_ERROR;
+    }
+    if(aio->cq_bytes){
+        aio->cq_ring = mmap(NULL, aio->cq_bytes, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, aio->ring, IORING_OFF_CQ_RING);
+        if(aio->cq_ring == MAP_FAILED){
+            aio->cq_ring = NULL;
+            return LC_ERROR;
+        }
+    }else
+        aio->cq_ring = aio->sq_ring;
+    aio->sqe_bytes = params->sq_entries * sizeof(struct io_uring_sqe);
+    aio->sqes = mmap(NULL, aio->sqe_bytes, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, aio->ring, IORING_OFF_SQES);
+    if(aio->sqes == MAP_FAILED){
+        aio->sqes = NULL;
+        return LC_ERROR;
+    }
+    aio->sq_tail = (unsigned int*)((char*) aio->sq_ring + params->sq_off.tail);
+    aio->sq_mask = (unsigned int*)((char*) aio->sq_ring + params->sq_off.ring_mask);
+    aio->sq_array = (unsigned int*)((char*) aio->sq_ring + params->sq_off.array);
+    aio->cq_head = (unsigned int*)((char*) aio->cq_ring + params->cq_off.head);
+    aio->cq_tail = (unsigned int*)((char*) aio->cq_ring + params->cq_off.tail);
+    aio->cq_mask = (unsigned int*)((char*) aio->cq_ring + params->cq_off.ring_mask);
+    aio->cqes = (struct io_uring_cqe*)((char*) aio->cq_ring + params->cq_off.cqes);
+    return LC_NOERR;
+}
+
+
+void uring_unmap(lcaio_t *aio){
+    if(aio->sqes)
+        munmap(aio->sqes, aio->sqe_bytes);
+    if(aio->cq_ring && aio->cq_ring != aio->sq_ring)
+        munmap(aio->cq_ring, aio->cq_bytes);
+    if(aio->sq_ring)
+        munmap(aio->sq_ring, aio->sq_bytes);
+    aio->sqes = NULL;
+    aio->cq_ring = NULL;
+    aio->sq_ring = NULL;
+}
+
+
+// Start (or continue) the write of buffer INDEX.  Without a ring, the write
+// is done right away with pwrite().
+int submit_buffer(lcaio_t *aio, unsigned int index){
+    lcaio_buf_t *buf = &aio->buf[index];
+    struct io_uring_sqe *sqe;
+    unsigned int tail, slot;
+    struct iovec iov;
+    ssize_t sent;
+
+    if(aio->ring < 0){
+        while(buf->done < buf->len){
+            iov.iov_base = buf->data + buf->done;
+            iov.iov_len = buf->len - buf->done;
+            if(aio->stream == LCAIO_SPLICE){
+                sent = vmsplice(aio->fd, &iov, 1, 0);
+                // Fall back to copying if the kernel won't splice
+                if(sent < 0 && (errno == EINVAL || errno == ENOSYS)){
+                    aio->stream = LCAIO_STREAM;
+                    continue;
+                }
+            }else if(aio->stream == LCAIO_STREAM)
+                sent = write(aio->fd, iov.iov_base, iov.iov_len);
+            else
+                sent = pwrite(aio->fd, iov.iov_base, iov.iov_len,
+                        buf->offset + buf->done);
+            if(sent < 0 && errno == EINTR)
+                continue;
+            if(sent <= 0){
+                aio->error = sent < 0 ? errno : EIO;
+                fprintf(stderr, "LCAIO: Write failed: %s\n", strerror(aio->error));
+                return LC_ERROR;
+            }
+            buf->done += sent;
+        }
+        return LC_NOERR;
+    }
+    // There is never more than one entry per buffer, so the ring has room
+    tail = *aio->sq_tail;
+    slot = tail & *aio->sq_mask;
+    sqe = &aio->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = aio->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(buf->data + buf->done);
+    sqe->len = buf->len - buf->done;
+    sqe->off = buf->offset + buf->done;
+    sqe->user_data = index;
+    aio->sq_array[slot] = slot;
+    __atomic_store_n(aio->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    buf->busy = 1;
+    while(uring_enter(aio->ring, 1, 0, 0) < 0){
+        if(errno == EINTR || errno == EAGAIN)
+            continue;
+        aio->error = errno;
+        fprintf(stderr, "LCAIO: Failed to submit a write: %s\n", strerror(errno));
+        return LC_ERROR;
+    }
+    return LC_NOERR;
+}
+
+
+// Collect finished writes.  If WAIT is nonzero, block until at least one
+// write finishes.
+int reap(lcaio_t *aio, int wait){
+    struct io_uring_cqe *cqe;
+    lcaio_buf_t *buf;
+    unsigned int head;
+    int err = LC_NOERR;
+
+    if(aio->ring < 0)
+        return aio->error ? LC_ERROR : LC_NOERR;
+    if(wait){
+        while(uring_enter(aio->ring, 0, 1, IORING_ENTER_GETEVENTS) < 0)
+            if(errno != EINTR){
+                aio->error = errno;
+                return LC_ERROR;
+            }
+    }
+    head = *aio->cq_head;
+    while(head != __atomic_load_n(aio->cq_tail, __ATOMIC_ACQUIRE)){
+        cqe = &aio->cqes[head & *aio->cq_mask];
+        buf = &aio->buf[cqe->user_data];
+        buf->busy = 0;
+        if(cqe->res < 0){
+            aio->error = -cqe->res;
+            fprintf(stderr, "LCAIO: Write failed: %s\n", strerror(aio->error));
+            err = LC_ERROR;
+        }else if(cqe->res == 0){
+            aio->error = EIO;
+            err = LC_ERROR;
+        }else{
+            buf->done += cqe->res;
+            // Short writes are rare, but the rest still has to go out
+            if(buf->done < buf->len && submit_buffer(aio, cqe->user_data))
+                err = LC_ERROR;
+        }
+        head++;
+    }
+    __atomic_store_n(aio->cq_head, head, __ATOMIC_RELEASE);
+    return err;
+}
+
+
+// Hand the current buffer to the kernel and move on to the next one
+int flush_buffer(lcaio_t *aio){
+    lcaio_buf_t *buf = &aio->buf[aio->current];
+
+    if(aio->fill == 0)
+        return LC_NOERR;
+    buf->offset = aio->offset;
+    buf->len = aio->fill;
+    buf->done = 0;
+    // O_DIRECT writes must be a whole number of blocks.  Only the last
+    // buffer is ever partly full, and the file is trimmed on close.
+    if(aio->direct && buf->len % LCAIO_ALIGN){
+        memset(buf->data + buf->len, 0, LCAIO_ALIGN - buf->len % LCAIO_ALIGN);
+        buf->len += LCAIO_ALIGN - buf->len % LCAIO_ALIGN;
+    }
+    if(submit_buffer(aio, aio->current))
+        return LC_ERROR;
+    aio->offset += aio->fill;
+    aio->fill = 0;
+    aio->current = (aio->current + 1) % LCAIO_BUFFERS;
+    // Wait for the next buffer only if the disk is that far behind
+    if(aio->buf[aio->current].busy){
+        aio->stalls ++;
+        while(aio->buf[aio->current].busy)
+            if(reap(aio, 1))
+                return LC_ERROR;
+    }
+    return LC_NOERR;
+}
+
+
+// Allocate the buffer pool
+int alloc_buffers(lcaio_t *aio){
+    int ii;
+
+    if(posix_memalign((void**) &aio->mem, LCAIO_ALIGN,
+            (size_t) LCAIO_BUFFERS * LCAIO_BUFFER_BYTES)){
+        aio->mem = NULL;
+        fprintf(stderr, "LCAIO: Failed to allocate the write buffers.\n");
+        return LC_ERROR;
+    }
+    for(ii=0; ii<LCAIO_BUFFERS; ii++)
+        aio->buf[ii].data = aio->mem + (size_t) ii * LCAIO_BUFFER_BYTES;
+    return LC_NOERR;
+}
+
+
+int lcaio_open(lcaio_t *aio, const char *filename, int options){
+    struct io_uring_params params;
+
+    memset(aio, 0, sizeof(lcaio_t));
+    aio->fd = -1;
+    aio->ring = -1;
+    if(alloc_buffers(aio))
+        return LC_ERROR;
+
+    if(options & LCAIO_DIRECT){
+        aio->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT | O_CLOEXEC, 0644);
+        if(aio->fd >= 0)
+            aio->direct = 1;
+        else if(errno == EINVAL)
+            fprintf(stderr, "LCAIO: O_DIRECT is not supported for %s; using cached writes.\n", filename);
+    }
+    if(aio->fd < 0)
+        aio->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(aio->fd < 0){
+        fprintf(stderr, "LCAIO: Failed to open %s: %s\n", filename, strerror(errno));
+        lcaio_close(aio);
+        return LC_ERROR;
+    }
+
+    memset(&params, 0, sizeof(params));
+    aio->ring = uring_setup(LCAIO_BUFFERS, &params);
+    if(aio->ring < 0){
+        fprintf(stderr, "LCAIO: io_uring is not available (%s); writes will block.\n", strerror(errno));
+        aio->ring = -1;
+    }else if(!uring_can_write(aio->ring)){
+        fprintf(stderr, "LCAIO: This kernel's io_uring can't write files; writes will block.\n");
+        close(aio->ring);
+        aio->ring = -1;
+    }else if(uring_map(aio, &params)){
+        fprintf(stderr, "LCAIO: Failed to map the io_uring; writes will block.\n");
+        uring_unmap(aio);
+        close(aio->ring);
+        aio->ring = -1;
+    }
+    return LC_NOERR;
+}
+
+
+int lcaio_open_fd(lcaio_t *aio, int fd){
+    struct stat st;
+    int size;
+
+    memset(aio, 0, sizeof(lcaio_t));
+    aio->fd = -1;
+    aio->ring = -1;
+    if(alloc_buffers(aio))
+        return LC_ERROR;
+    aio->fd = fd;
+    aio->stream = LCAIO_STREAM;
+    if(fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)){
+        // vmsplice() leaves the pages in the pipe until the reader gets to
+        // them, so a buffer may only be refilled once more than a pipe's
+        // worth of data has been written after it.  The other buffers in
+        // the pool are always written first, so they must outweigh the pipe.
+        fcntl(fd, F_SETPIPE_SZ, LCAIO_BUFFER_BYTES);
+        size = fcntl(fd, F_GETPIPE_SZ);
+        if(size > 0 && size <= (LCAIO_BUFFERS - 1) * LCAIO_BUFFER_BYTES)
+            aio->stream = LCAIO_SPLICE;
+    }
+    return LC_NOERR;
+}
+
+
+int lcaio_write(lcaio_t *aio, const void *data, size_t bytes){
+    size_t count;
+
+    if(aio->fd < 0 || aio->error)
+        return LC_ERROR;
+    while(bytes){
+        count = LCAIO_BUFFER_BYTES - aio->fill;
+        count = bytes < count ? bytes : count;
+        memcpy(aio->buf[aio->current].data + aio->fill, data, count);
+        aio->fill += count;
+        data = (const char*) data + count;
+        bytes -= count;
+        if(aio->fill == LCAIO_BUFFER_BYTES && flush_buffer(aio))
+            return LC_ERROR;
+    }
+    return reap(aio, 0);
+}
+
+
+int lcaio_service(lcaio_t *aio){
+    if(aio->fd < 0)
+        return LC_ERROR;
+    return reap(aio, 0);
+}
+
+
+uint64_t lcaio_tell(lcaio_t *aio){
+    return aio->offset + aio->fill;
+}
+
+
+int lcaio_close(lcaio_t *aio){
+    uint64_t size;
+    int ii, err = LC_NOERR;
+
+    if(aio->fd >= 0){
+        size = lcaio_tell(aio);
+        if(!aio->error)
+            flush_buffer(aio);
+        // Wait for everything in flight
+        for(ii=0; ii<LCAIO_BUFFERS; ii++)
+            while(aio->buf[ii].busy)
+                if(reap(aio, 1))
+                    break;
+        if(aio->direct && ftruncate(aio->fd, size))
+            aio->error = errno;
+        if(aio->error){
+            fprintf(stderr, "LCAIO: The data file is incomplete: %s\n", strerror(aio->error));
+            err = LC_ERROR;
+        }
+        close(aio->fd);
+        aio->fd = -1;
+    }
+    if(aio->ring >= 0){
+        uring_unmap(aio);
+        close(aio->ring);
+        aio->ring = -1;
+    }
+    if(aio->mem)
+        free(aio->mem);
+    aio->mem = NULL;
+    return err;
+}
+
+
+// Render a header with the stdio functions in lconfig.c and queue it
+int write_header(lc_devconf_t *dconf, lcaio_t *aio, int segment, uint64_t scan){
+    char *text = NULL;
+    size_t bytes = 0;
+    FILE *ff;
+    int err;
+
+    ff = open_memstream(&text, &bytes);
+    if(ff == NULL){
+        fprintf(stderr, "LCAIO: Failed to render the data file header.\n");
+        return LC_ERROR;
+    }
+    if(segment < 0)
+        lc_datafile_init(dconf, ff);
+    else
+        lc_datafile_segment(dconf, ff, segment, scan);
+    fclose(ff);
+    err = lcaio_write(aio, text, bytes);
+    free(text);
+    // Frames are indexed by their true position in the file
+    dconf->framer.offset = lcaio_tell(aio);
+    return err;
+}
+
+
+int lcaio_datafile_init(lc_devconf_t *dconf, lcaio_t *aio){
+    return write_header(dconf, aio, -1, 0);
+}
+
+
+int lcaio_datafile_segment(lc_devconf_t *dconf, lcaio_t *aio,
+        unsigned int segment, uint64_t scan){
+    return write_header(dconf, aio, segment, scan);
+}
+
+
+// The LC_EMIT_T for framed data files
+int emit_aio(void *arg, const void *bytes, size_t count){
+    return lcaio_write((lcaio_t*) arg, bytes, count);
+}
+
+
+int lcaio_datafile_checkpoint(lc_devconf_t *dconf, lcaio_t *aio){
+    if(dconf->dataformat != LC_DF_FRAMED && dconf->dataformat != LC_DF_COLUMNAR)
+        return LC_NOERR;
+    return lc_frame_checkpoint(dconf, emit_aio, aio);
+}
+
+
+int lcaio_datafile_write(lc_devconf_t *dconf, lcaio_t *aio, const double *data,
+        unsigned int channels, unsigned int samples_per_read){
+    float fbuffer[LC_WRITE_CHUNK];
+    char text[LC_WRITE_CHUNK * 16];
+    unsigned int index, total, count, ii, col;
+    int length;
+
+    if(!data)
+        return LC_ERROR;
+    total = channels * samples_per_read;
+    if(dconf->dataformat == LC_DF_FRAMED || dconf->dataformat == LC_DF_COLUMNAR)
+        return lc_frame_write(dconf, data, channels, samples_per_read, emit_aio, aio);
+    // Binary data are converted to single precision a chunk at a time
+    if(dconf->dataformat == LC_DF_BIN){
+        for(index=0; index<total; index+=count){
+            count = total - index < LC_WRITE_CHUNK ? total - index : LC_WRITE_CHUNK;
+            for(ii=0; ii<count; ii++)
+                fbuffer[ii] = (float) data[index + ii];
+            if(lcaio_write(aio, fbuffer, count * sizeof(float)))
+                return LC_ERROR;
+        }
+        return LC_NOERR;
+    }
+    // ASCII rows are formatted into a local buffer until it is nearly full
+    length = 0;
+    col = 0;
+    for(index=0; index<total; index++){
+        length += sprintf(&text[length], ++col < channels ? "%.6e\t" : "%.6e\n", data[index]);
+        if(col == channels)
+            col = 0;
+        if(length > sizeof(text) - 32){
+            if(lcaio_write(aio, text, length))
+                return LC_ERROR;
+            length = 0;
+        }
+    }
+    return lcaio_write(aio, text, length);
+}
@@ -0,0 +1,183 @@
+/*
+  This file is part of the LCONFIG laboratory configuration system.
+
+    LCONFIG is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    LCONFIG is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with LCONFIG.  If not, see <https://www.gnu.org/licenses/>.
+
+    Authored by C.Martin crm28@psu.edu
+*/
+
+/*  The LCAIO header is an asynchronous alternative to writing data files
+through a stdio FILE*.  With LC_DATAFILE_WRITE(), a slow disk stalls the
+thread that also has to keep up with LJM_eStreamRead().  Here, formatted
+data are gathered into a small pool of large buffers, and each full buffer
+is handed to the kernel with io_uring.  The application goes straight back
+to the stream while the write happens, and the buffer is reused once the
+kernel reports that the write is complete.  The application only waits
+on the disk when every buffer in the pool is still being written.
+
+With the LCAIO_DIRECT option, the file is opened with O_DIRECT, so the data
+bypass the page cache altogether.  The buffers are always aligned for this,
+and the file is trimmed to its true length when it is closed.  File systems
+that do not support O_DIRECT fall back to normal (cached) writes.
+
+If the kernel does not allow io_uring, or its io_uring is too old to write
+files (before Linux 5.6), the buffers are written with pwrite() instead.  The files are identical either way.
+
+LCAIO_OPEN_FD() writes to a descriptor that is already open, like stdout.
+When that is a pipe, each full buffer is mapped into the pipe with 
+vmsplice() instead of being copied, and the reader gets the pages 
+themselves.  The pool is always much larger than the pipe, so a buffer is 
+only refilled long after the reader has consumed it.  Other streams (a 
+terminal or a redirected file) are written with write().
+
+The LCAIO_DATAFILE_XXX functions write exactly the same files as their
+LC_DATAFILE_XXX counterparts in lconfig.h.
+
+CHANGELOG
+
+v1.2    10/2026
+- LCAIO_OPEN_FD() writes to pipes (with vmsplice) and other streams
+
+v1.1    10/2026
+- Framed data files and LCAIO_DATAFILE_CHECKPOINT()
+
+v1.0    10/2026     ORIGINAL RELEASE
+*/
+
+#ifndef __LCAIO
+#define __LCAIO
+
+#include "lconfig.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+#define LCAIO_BUFFERS       8           // Buffers in the pool
+#define LCAIO_BUFFER_BYTES  (1<<20)     // Bytes in each buffer
+#define LCAIO_ALIGN         4096        // Buffer and O_DIRECT alignment
+
+// Options for LCAIO_OPEN()
+#define LCAIO_DIRECT        0x01        // Open the file with O_DIRECT
+
+// How the buffers are written (LCAIO_T.STREAM)
+#define LCAIO_FILE          0           // io_uring or pwrite() at an offset
+#define LCAIO_STREAM        1           // write() to a pipe, terminal, etc.
+#define LCAIO_SPLICE        2           // vmsplice() into a pipe
+
+
+/* LCAIO_BUF_T
+One buffer in the pool.  A buffer is BUSY from the time it is submitted
+until the kernel has written all LEN bytes to the file at OFFSET.
+*/
+typedef struct __lcaio_buf_t__ {
+    char *data;             // Aligned buffer memory
+    uint64_t offset;        // File offset of the write
+    size_t len;             // Bytes to write
+    size_t done;            // Bytes written so far
+    int busy;               // 1 while the write is in flight
+} lcaio_buf_t;
+
+
+/* LCAIO_T
+The asynchronous writer.  CURRENT is the buffer being filled, and FILL is
+the number of bytes in it.  OFFSET is the file offset where the current
+buffer will be written.  STALLS counts the times the application had to
+wait because every buffer was busy.
+*/
+typedef struct __lcaio_t__ {
+    int fd;                         // Data file or -1
+    int ring;                       // io_uring descriptor or -1 to use pwrite()
+    int direct;                     // 1 if the file was opened with O_DIRECT
+    int stream;                     // LCAIO_FILE, LCAIO_STREAM, or LCAIO_SPLICE
+    lcaio_buf_t buf[LCAIO_BUFFERS]; // The buffer pool
+    char *mem;                      // Memory behind all of the buffers
+    unsigned int current;           // Buffer being filled
+    size_t fill;                    // Bytes in the current buffer
+    uint64_t offset;                // File offset of the current buffer
+    uint64_t stalls;                // Times every buffer was busy
+    int error;                      // First error reported by a write (errno)
+    // The io_uring mappings
+    void *sq_ring, *cq_ring;
+    size_t sq_bytes, cq_bytes, sqe_bytes;
+    struct io_uring_sqe *sqes;
+    unsigned int *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+} lcaio_t;
+
+
+/* LCAIO_OPEN
+Create (or truncate) FILENAME and prepare the buffer pool and io_uring.
+OPTIONS is zero or LCAIO_DIRECT.  It is safe to call LCAIO_CLOSE() on a
+struct whose FD was set to -1, even if LCAIO_OPEN() was never called.
+
+Returns LC_NOERR on success and LC_ERROR on failure.
+*/
+int lcaio_open(lcaio_t *aio, const char *filename, int options);
+
+/* LCAIO_OPEN_FD
+Prepare the buffer pool to write to FD, which is already open.  Pipes are
+written with vmsplice() and anything else with write(), so FD does not 
+need to be seekable.  LCAIO_CLOSE() closes FD.
+
+Returns LC_NOERR on success and LC_ERROR on failure.
+*/
+int lcaio_open_fd(lcaio_t *aio, int fd);
+
+/* LCAIO_WRITE
+Append BYTES bytes from DATA to the file.  Full buffers are submitted as
+they fill.  This only blocks if every buffer is still being written.
+
+Returns LC_NOERR on success and LC_ERROR if a write has failed.
+*/
+int lcaio_write(lcaio_t *aio, const void *data, size_t bytes);
+
+/* LCAIO_SERVICE
+Collect any writes that have finished without waiting.  LCAIO_WRITE() does
+this on its own, but applications may call it while they are idle.
+
+Returns LC_NOERR on success and LC_ERROR if a write has failed.
+*/
+int lcaio_service(lcaio_t *aio);
+
+/* LCAIO_TELL
+Returns the number of bytes appended to the file so far, including those
+that are still waiting to be written.
+*/
+uint64_t lcaio_tell(lcaio_t *aio);
+
+/* LCAIO_CLOSE
+Write the partly filled buffer, wait for every write to finish, and close
+the file.
+
+Returns LC_NOERR if every write succeeded and LC_ERROR otherwise.
+*/
+int lcaio_close(lcaio_t *aio);
+
+/* LCAIO_DATAFILE_INIT
+LCAIO_DATAFILE_SEGMENT
+LCAIO_DATAFILE_WRITE
+LCAIO_DATAFILE_CHECKPOINT
+These behave exactly like LC_DATAFILE_INIT(), LC_DATAFILE_SEGMENT(), 
+LC_DATAFILE_WRITE(), and LC_DATAFILE_CHECKPOINT(), but they write through 
+an LCAIO_T.
+*/
+int lcaio_datafile_init(lc_devconf_t *dconf, lcaio_t *aio);
+int lcaio_datafile_segment(lc_devconf_t *dconf, lcaio_t *aio,
+        unsigned int segment, uint64_t scan);
+int lcaio_datafile_write(lc_devconf_t *dconf, lcaio_t *aio, const double *data,
+        unsigned int channels, unsigned int samples_per_read);
+int lcaio_datafile_checkpoint(lc_devconf_t *dconf, lcaio_t *aio);
+
+#endif
@@ -19,6 +19,8 @@
 */
 
 #include "lconfig.h"
+#include "lctools.h"
+#include "lcaio.h"
 #include <string.h>     // duh
 #include <unistd.h>     // for system calls
 #include <stdlib.h>     // for malloc and free
@@ -50,6 +52,9 @@ const char help_text[] = \
 "-d DATAFILE\n"\
 "  Specifies the data file to output.  This overrides the default, which is\n"\
 "  constructed from the current date and time: \"YYYYMMDDHHmmSS_lcburst.dat\"\n"\
+"  With \"-d -\", the data are written to stdout in the framed binary\n"\
+"  format, and the messages go to stderr.\n"\
+"     $ lcburst -t 10 -d - | zstd > burst.dat.zst\n"\
 "\n"\
 "-f param=value\n"\
 "-i param=value\n"\
@@ -127,6 +132,9 @@ int main(int argc, char *argv[]){
     // Finally, the essentials; a data file and the device configuration
     FILE *dfile;
     lc_devconf_t dconf;
+    // Writing to stdout
+    lcaio_t pipe_out;
+    int pipe_fd = -1;
 
     // Parse the command-line options
     // use an outer foor loop as a catch-all safety
@@ -205,6 +213,13 @@ int main(int argc, char *argv[]){
         }
     }
 
+    // Writing data to stdout; everything else goes to stderr
+    if(strcmp(data_file, "-") == 0){
+        fflush(stdout);
+        pipe_fd = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+
     // Load the configuration
     printf("Loading configuration file...");
     fflush(stdout);
@@ -221,6 +236,9 @@ int main(int argc, char *argv[]){
     }
     // Detect the number of input columns
     nich = lc_nistream(&dconf);
+    // Pipes always carry frames, so readers can tell where blocks end
+    if(pipe_fd >= 0)
+        dconf.dataformat = LC_DF_FRAMED;
 
     // Process the staged command-line meta parameters
     // use an outer for loop as a catch-all safety
@@ -326,8 +344,9 @@ int main(int argc, char *argv[]){
         printf("\nWaiting for trigger\n");
 
     while(!lc_stream_iscomplete(&dconf)){
-        itemp = dconf.trigstate;
-        if(lc_stream_service(&dconf)){
+        itemp = lc_stream_trigstate(&dconf);
+        // Sleep until the next block arrives (or the callback delivers it)
+        if(lc_stream_wait(&dconf, 1000)){
             fprintf(stderr, "\nLCBURST failed while servicing the T7 connection!\n");
             lc_stream_stop(&dconf);
             lc_close(&dconf);
@@ -335,7 +354,7 @@ int main(int argc, char *argv[]){
             return -1;            
         }
         
-        if(itemp != LC_TRIG_ACTIVE && dconf.trigstate == LC_TRIG_ACTIVE){
+        if(itemp != LC_TRIG_ACTIVE && lc_stream_trigstate(&dconf) == LC_TRIG_ACTIVE){
             printf("Streaming data.\n");
         }
     }
@@ -348,6 +367,34 @@ int main(int argc, char *argv[]){
     }
     printf("DONE\n");
 
+    // Write to stdout through LCAIO, which splices into pipes
+    if(pipe_fd >= 0){
+        printf("Writing to stdout");
+        fflush(stdout);
+        if(lcaio_open_fd(&pipe_out, pipe_fd) || lcaio_datafile_init(&dconf, &pipe_out)){
+            fprintf(stderr, "LCBURST failed to write to stdout\n");
+            lcaio_close(&pipe_out);
+            lc_close(&dconf);
+            lc_clean(&dconf);
+            return -1;
+        }
+        while(!lc_stream_isempty(&dconf)){
+            lc_stream_read(&dconf, &data, &channels, &samples_per_read);
+            lct_pipeline(&dconf, data, channels, &samples_per_read, 0, NULL, 0);
+            if(lcaio_datafile_write(&dconf, &pipe_out, data, channels, samples_per_read))
+                break;
+            printf(".");
+            fflush(stdout);
+        }
+        lcaio_datafile_checkpoint(&dconf, &pipe_out);
+        if(lcaio_close(&pipe_out))
+            fprintf(stderr, "\nLCBURST: The reader did not get all of the data.\n");
+        lc_close(&dconf);
+        lc_clean(&dconf);
+        printf("Exited successfully.\n");
+        return 0;
+    }
+
     // Open the output file
     printf("Writing the data file");
     fflush(stdout);
@@ -363,11 +410,12 @@ int main(int argc, char *argv[]){
     // Write the samples
     while(!lc_stream_isempty(&dconf)){
         lc_stream_read(&dconf, &data, &channels, &samples_per_read);
-        lc_stream_downsample(&dconf, data, channels, &samples_per_read);
+        lct_pipeline(&dconf, data, channels, &samples_per_read, 0, NULL, 0);
         lc_datafile_write(&dconf, dfile, data, channels, samples_per_read);
         printf(".");
         fflush(stdout);
     }
+    lc_datafile_checkpoint(&dconf, dfile);
     fclose(dfile);
     lc_close(&dconf);
     lc_clean(&dconf);
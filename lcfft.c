@@ -0,0 +1,303 @@
+/*
+  This file is part of the LCONFIG laboratory configuration system.
+
+    LCONFIG is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    LCONFIG is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with LCONFIG.  If not, see <https://www.gnu.org/licenses/>.
+
+    Authored by C.Martin crm28@psu.edu
+*/
+
+#include "lcfft.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+
+int lcfft_plan(lcfft_plan_t *plan, unsigned int n){
+    unsigned int k, m, bits, r, j;
+
+    plan->cos = plan->sin = plan->work = NULL;
+    plan->rev = NULL;
+    plan->n = n;
+    if(n < LCFFT_MIN_N || n > LCFFT_MAX_N || (n & (n-1))){
+        fprintf(stderr, "LCFFT_PLAN: The length must be a power of two from %d to %d, but got %u.\n",
+                LCFFT_MIN_N, LCFFT_MAX_N, n);
+        return LC_ERROR;
+    }
+    m = n / 2;
+    plan->cos = malloc(m * sizeof(double));
+    plan->sin = malloc(m * sizeof(double));
+    plan->rev = malloc(m * sizeof(unsigned int));
+    plan->work = malloc(n * sizeof(double));
+    if(!plan->cos || !plan->sin || !plan->rev || !plan->work){
+        fprintf(stderr, "LCFFT_PLAN: Failed to allocate the tables for %u points.\n", n);
+        lcfft_free(plan);
+        return LC_ERROR;
+    }
+    // Twiddles exp(-2 pi i k / N)
+    for(k=0; k<m; k++){
+        plan->cos[k] = cos(2 * M_PI * k / n);
+        plan->sin[k] = -sin(2 * M_PI * k / n);
+    }
+    // Bit reversal of the M complex points
+    for(bits=0; (1u<<bits) < m; bits++);
+    for(k=0; k<m; k++){
+        for(r=0, j=0; j<bits; j++)
+            r |= ((k >> j) & 1) << (bits - 1 - j);
+        plan->rev[k] = r;
+    }
+    return LC_NOERR;
+}
+
+
+void lcfft_free(lcfft_plan_t *plan){
+    free(plan->cos);
+    free(plan->sin);
+    free(plan->rev);
+    free(plan->work);
+    plan->cos = plan->sin = plan->work = NULL;
+    plan->rev = NULL;
+}
+
+
+void lcfft_real(lcfft_plan_t *plan, const double *x, double *re, double *im){
+    unsigned int n = plan->n, m = n / 2, len, half, step, i, j, k;
+    double *z = plan->work;
+    double wr, wi, ur, ui, vr, vi, er, ei, dr, di, odr, odi;
+
+    // Pack the even and odd points as the real and imaginary parts of
+    // M complex points in bit-reversed order
+    for(k=0; k<m; k++){
+        z[2*plan->rev[k]] = x[2*k];
+        z[2*plan->rev[k] + 1] = x[2*k + 1];
+    }
+    // Radix-2 butterflies.  The twiddles of a LEN-point stage are every
+    // (N/LEN)th entry of the N-point table.
+    for(len=2; len<=m; len<<=1){
+        half = len / 2;
+        step = n / len;
+        for(i=0; i<m; i+=len){
+            for(j=0; j<half; j++){
+                wr = plan->cos[j * step];
+                wi = plan->sin[j * step];
+                ur = z[2*(i+j)];
+                ui = z[2*(i+j) + 1];
+                vr = z[2*(i+j+half)] * wr - z[2*(i+j+half) + 1] * wi;
+                vi = z[2*(i+j+half)] * wi + z[2*(i+j+half) + 1] * wr;
+                z[2*(i+j)] = ur + vr;
+                z[2*(i+j) + 1] = ui + vi;
+                z[2*(i+j+half)] = ur - vr;
+                z[2*(i+j+half) + 1] = ui - vi;
+            }
+        }
+    }
+    // Split the result into the spectra of the even and odd points and
+    // combine them: X[k] = E[k] + exp(-2 pi i k / N) O[k]
+    re[0] = z[0] + z[1];
+    im[0] = 0.;
+    re[m] = z[0] - z[1];
+    im[m] = 0.;
+    for(k=1; k<m; k++){
+        // E = (Z[k] + conj(Z[M-k]))/2 and O = (Z[k] - conj(Z[M-k]))/2i
+        er = 0.5 * (z[2*k] + z[2*(m-k)]);
+        ei = 0.5 * (z[2*k + 1] - z[2*(m-k) + 1]);
+        dr = 0.5 * (z[2*k] - z[2*(m-k)]);
+        di = 0.5 * (z[2*k + 1] + z[2*(m-k) + 1]);
+        odr = di;
+        odi = -dr;
+        re[k] = er + plan->cos[k] * odr - plan->sin[k] * odi;
+        im[k] = ei + plan->cos[k] * odi + plan->sin[k] * odr;
+    }
+}
+
+
+int lcfft_welch_init(lcfft_welch_t *welch, lc_devconf_t *dconf,
+        unsigned int channels, unsigned int n, unsigned int hop, int downsampled){
+    unsigned int k, ch;
+    double samplehz, wsum;
+
+    memset(welch, 0, sizeof(lcfft_welch_t));
+    if(channels == 0 || channels > LC_MAX_STCH){
+        fprintf(stderr, "LCFFT_WELCH_INIT: Expected 1 to %d channels, but got %u.\n",
+                LC_MAX_STCH, channels);
+        return LC_ERROR;
+    }
+    if(lcfft_plan(&welch->plan, n))
+        return LC_ERROR;
+    welch->channels = channels;
+    welch->n = n;
+    welch->hop = (hop == 0 || hop > n) ? n / 2 : hop;
+    welch->bins = n / 2 + 1;
+    samplehz = dconf->samplehz;
+    if(downsampled)
+        samplehz /= dconf->downsample + 1;
+    welch->df = samplehz / n;
+    for(ch=0; ch<channels; ch++){
+        welch->slope[ch] = ch < dconf->naich ? dconf->aich[ch].calslope : 1.;
+        welch->zero[ch] = ch < dconf->naich ? dconf->aich[ch].calzero : 0.;
+    }
+
+    welch->window = malloc(n * sizeof(double));
+    welch->history = malloc((size_t) n * channels * sizeof(double));
+    welch->segment = malloc(n * sizeof(double));
+    welch->re = malloc(welch->bins * sizeof(double));
+    welch->im = malloc(welch->bins * sizeof(double));
+    welch->sum = calloc((size_t) welch->bins * channels, sizeof(double));
+    welch->psd = calloc((size_t) welch->bins * channels, sizeof(double));
+    if(!welch->window || !welch->history || !welch->segment || !welch->re
+            || !welch->im || !welch->sum || !welch->psd){
+        fprintf(stderr, "LCFFT_WELCH_INIT: Failed to allocate %u channels of %u points.\n",
+                channels, n);
+        lcfft_welch_free(welch);
+        return LC_ERROR;
+    }
+    // Periodic Hann window
+    wsum = 0.;
+    for(k=0; k<n; k++){
+        welch->window[k] = 0.5 - 0.5 * cos(2 * M_PI * k / n);
+        wsum += welch->window[k] * welch->window[k];
+    }
+    welch->scale = 1. / (samplehz * wsum);
+    return LC_NOERR;
+}
+
+
+// Transform the history of channel CH and add its PSD to the sum
+void welch_segment(lcfft_welch_t *welch, unsigned int ch){
+    const double *h = &welch->history[(size_t) ch * welch->n];
+    double *sum = &welch->sum[(size_t) ch * welch->bins];
+    double mean = 0.;
+    unsigned int k;
+
+    for(k=0; k<welch->n; k++)
+        mean += h[k];
+    mean /= welch->n;
+    for(k=0; k<welch->n; k++)
+        welch->segment[k] = (h[k] - mean) * welch->window[k];
+    lcfft_real(&welch->plan, welch->segment, welch->re, welch->im);
+    // One-sided: every bin but DC and Nyquist has a negative twin
+    sum[0] += (welch->re[0] * welch->re[0]) * welch->scale;
+    for(k=1; k<welch->bins-1; k++)
+        sum[k] += 2 * (welch->re[k] * welch->re[k] + welch->im[k] * welch->im[k]) * welch->scale;
+    sum[k] += (welch->re[k] * welch->re[k]) * welch->scale;
+}
+
+
+unsigned int lcfft_welch_block(lcfft_welch_t *welch, const double *data,
+        unsigned int channels, unsigned int samples){
+    unsigned int ii, ch, nch, count = 0;
+    double *h;
+
+    nch = channels < welch->channels ? channels : welch->channels;
+    for(ii=0; ii<samples; ii++, data+=channels){
+        for(ch=0; ch<nch; ch++)
+            welch->history[(size_t) ch * welch->n + welch->fill] =
+                    welch->slope[ch] * (data[ch] - welch->zero[ch]);
+        if(++welch->fill < welch->n)
+            continue;
+        // The history is full; transform it and make room for HOP more
+        for(ch=0; ch<nch; ch++){
+            welch_segment(welch, ch);
+            h = &welch->history[(size_t) ch * welch->n];
+            memmove(h, h + welch->hop, (welch->n - welch->hop) * sizeof(double));
+        }
+        welch->fill = welch->n - welch->hop;
+        welch->segments ++;
+        count ++;
+    }
+    return count;
+}
+
+
+uint64_t lcfft_welch_update(lcfft_welch_t *welch, int reset){
+    size_t k, total = (size_t) welch->bins * welch->channels;
+    uint64_t segments = welch->segments;
+
+    for(k=0; k<total; k++)
+        welch->psd[k] = segments ? welch->sum[k] / segments : 0.;
+    if(reset){
+        memset(welch->sum, 0, total * sizeof(double));
+        welch->segments = 0;
+    }
+    return segments;
+}
+
+
+double lcfft_welch_band(lcfft_welch_t *welch, unsigned int ch, double f1, double f2){
+    const double *psd = &welch->psd[(size_t) ch * welch->bins];
+    double power = 0.;
+    unsigned int k;
+
+    for(k=0; k<welch->bins; k++)
+        if(k * welch->df >= f1 && k * welch->df <= f2)
+            power += psd[k];
+    return sqrt(power * welch->df);
+}
+
+
+unsigned int lcfft_welch_peaks(lcfft_welch_t *welch, unsigned int ch,
+        unsigned int npeak, double freq[], double rms[]){
+    const double *psd = &welch->psd[(size_t) ch * welch->bins];
+    unsigned int found[LCFFT_MAX_PEAKS];
+    unsigned int k, j, p, best, lo, hi, nfound = 0;
+    double power, moment;
+    // A Hann window spreads a tone over two bins on either side
+    const unsigned int lobe = 2;
+
+    npeak = npeak < LCFFT_MAX_PEAKS ? npeak : LCFFT_MAX_PEAKS;
+    for(p=0; p<npeak; p++){
+        best = 0;
+        for(k=1; k<welch->bins; k++){
+            // Local maxima only
+            if(psd[k] < psd[k-1] || (k+1 < welch->bins && psd[k] <= psd[k+1]))
+                continue;
+            // ... that are not part of a peak already found
+            for(j=0; j<nfound; j++)
+                if(k + lobe >= found[j] && k <= found[j] + lobe)
+                    break;
+            if(j < nfound)
+                continue;
+            if(best == 0 || psd[k] > psd[best])
+                best = k;
+        }
+        if(best == 0 || psd[best] <= 0.)
+            break;
+        found[nfound++] = best;
+        // The power under the main lobe and its centroid
+        lo = best > lobe ? best - lobe : 1;
+        hi = best + lobe < welch->bins ? best + lobe : welch->bins - 1;
+        power = moment = 0.;
+        for(k=lo; k<=hi; k++){
+            power += psd[k];
+            moment += psd[k] * k;
+        }
+        freq[p] = moment / power * welch->df;
+        rms[p] = sqrt(power * welch->df);
+    }
+    return nfound;
+}
+
+
+void lcfft_welch_free(lcfft_welch_t *welch){
+    lcfft_free(&welch->plan);
+    free(welch->window);
+    free(welch->history);
+    free(welch->segment);
+    free(welch->re);
+    free(welch->im);
+    free(welch->sum);
+    free(welch->psd);
+    welch->window = welch->history = welch->segment = NULL;
+    welch->re = welch->im = welch->sum = welch->psd = NULL;
+}
@@ -0,0 +1,175 @@
+/*
+  This file is part of the LCONFIG laboratory configuration system.
+
+    LCONFIG is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    LCONFIG is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with LCONFIG.  If not, see <https://www.gnu.org/licenses/>.
+
+    Authored by C.Martin crm28@psu.edu
+*/
+
+/*  The LCFFT header computes spectra on streams as they arrive.  It only
+needs lconfig.h for the device configuration and the C math library.
+
+LCFFT_PLAN_T is a real fast Fourier transform of a fixed power-of-two
+length.  The N real points are transformed as N/2 complex points with an
+iterative radix-2 algorithm, and the result is split into the spectrum of
+the real signal.  The twiddle factors and the bit-reversal permutation
+are computed once by LCFFT_PLAN(), so a transform allocates nothing and
+costs about N/2 log2(N) butterflies.
+
+LCFFT_WELCH_T estimates the power spectral density (PSD) of every channel
+in a stream with Welch's method.  Each channel keeps only the last N
+samples.  Every HOP samples, the most recent N have their mean removed,
+are weighted by a Hann window, and are transformed, and the squared
+magnitudes are added to a running sum.  Segments overlap by half by
+default.  The memory is fixed when it is initialized, so it never grows no
+matter how long the average runs.
+
+    lcfft_welch_t welch;
+    lcfft_welch_init(&welch, &dconf, lc_nistream(&dconf), 4096, 0, 0);
+    while( ... ){
+        lc_stream_read(&dconf, &data, &channels, &samples);
+        lcfft_welch_block(&welch, data, channels, samples);
+    }
+    lcfft_welch_update(&welch, 0);
+    lcfft_welch_peaks(&welch, 0, 3, freq, rms);
+    lcfft_welch_free(&welch);
+
+CHANGELOG
+
+v1.0    10/2026     ORIGINAL RELEASE
+*/
+
+#ifndef __LCFFT
+#define __LCFFT
+
+#include "lconfig.h"
+#include <stdint.h>
+
+#define LCFFT_MIN_N         8           // Shortest transform
+#define LCFFT_MAX_N         (1<<20)     // Longest transform
+#define LCFFT_MAX_PEAKS     16          // Most peaks LCFFT_WELCH_PEAKS() finds
+
+
+/* LCFFT_PLAN_T
+The tables for a real transform of N points.  COS and SIN are the N/2
+twiddle factors exp(-2 pi i k / N), and REV is the bit-reversal
+permutation of the N/2 complex points.  WORK holds N doubles for the
+complex points while they are transformed.
+*/
+typedef struct __lcfft_plan_t__ {
+    unsigned int n;
+    double *cos, *sin;
+    unsigned int *rev;
+    double *work;
+} lcfft_plan_t;
+
+
+/* LCFFT_WELCH_T
+A Welch power spectral density estimate on CHANNELS channels.  The members
+are managed by the LCFFT_WELCH_XXX functions.
+
+PSD holds N/2+1 bins for each channel: the mean of the one-sided PSD of
+every segment since the last reset, in (calibrated units)^2/Hz.  Bin K is
+at K*DF Hz.  SEGMENTS is the number of segments averaged.
+*/
+typedef struct __lcfft_welch_t__ {
+    lcfft_plan_t plan;
+    unsigned int channels;          // Channels in each scan
+    unsigned int n;                 // Samples in each segment
+    unsigned int hop;               // Samples between segments
+    unsigned int bins;              // N/2 + 1
+    double df;                      // Bin spacing in Hz
+    double scale;                   // PSD scale: 1/(SAMPLEHZ * sum(window^2))
+    double slope[LC_MAX_STCH];      // Calibration of each channel
+    double zero[LC_MAX_STCH];
+    double *window;                 // Hann window (N)
+    double *history;                // The last N samples of each channel
+    unsigned int fill;              // Samples in each channel's history
+    double *segment, *re, *im;      // Work space for one transform
+    double *sum;                    // Sum of the segments' PSDs
+    double *psd;                    // SUM / SEGMENTS, made by LCFFT_WELCH_UPDATE()
+    uint64_t segments;              // Segments in SUM
+} lcfft_welch_t;
+
+
+/* LCFFT_PLAN
+Build the tables for a real transform of N points.  N must be a power of
+two from LCFFT_MIN_N to LCFFT_MAX_N.  Returns LC_NOERR on success and
+LC_ERROR on failure.  LCFFT_FREE() is safe to call on a plan whose
+pointers are NULL.
+*/
+int lcfft_plan(lcfft_plan_t *plan, unsigned int n);
+void lcfft_free(lcfft_plan_t *plan);
+
+/* LCFFT_REAL
+Transform the N real points in X.  The real and imaginary parts of bins 0
+through N/2 are written to RE and IM, which must each hold N/2+1 doubles.
+X is not modified.
+*/
+void lcfft_real(lcfft_plan_t *plan, const double *x, double *re, double *im);
+
+/* LCFFT_WELCH_INIT
+Prepare a Welch PSD estimate on CHANNELS channels of the stream configured
+in DCONF with segments of N samples.  Successive segments start HOP
+samples apart; if HOP is zero, they overlap by half (HOP = N/2).  The
+analog input channels are calibrated (see LCT_CAL()), and the sample rate
+is DCONF->SAMPLEHZ / (DCONF->DOWNSAMPLE + 1) when DOWNSAMPLED is nonzero,
+or DCONF->SAMPLEHZ otherwise.
+
+Returns LC_NOERR on success and LC_ERROR on failure.  LCFFT_WELCH_FREE()
+is safe to call on a struct that failed to initialize.
+*/
+int lcfft_welch_init(lcfft_welch_t *welch, lc_devconf_t *dconf,
+        unsigned int channels, unsigned int n, unsigned int hop, int downsampled);
+
+/* LCFFT_WELCH_BLOCK
+Add SAMPLES scans of CHANNELS channels from DATA to the estimate.  Only
+the first WELCH->CHANNELS are used.  Every completed segment is
+transformed and added to the running sum, so a block may complete none or
+several.  Returns the number of segments completed.
+*/
+unsigned int lcfft_welch_block(lcfft_welch_t *welch, const double *data,
+        unsigned int channels, unsigned int samples);
+
+/* LCFFT_WELCH_UPDATE
+Compute WELCH->PSD from the segments summed so far.  If RESET is nonzero,
+the sum is cleared afterwards so that the next average starts fresh; the
+history is kept so that the next segment does not have to wait.  Returns
+the number of segments in the average.
+*/
+uint64_t lcfft_welch_update(lcfft_welch_t *welch, int reset);
+
+/* LCFFT_WELCH_BAND
+Returns the RMS of channel CH between frequencies F1 and F2 in Hz, found
+by integrating WELCH->PSD over the bins in the band.
+*/
+double lcfft_welch_band(lcfft_welch_t *welch, unsigned int ch, double f1, double f2);
+
+/* LCFFT_WELCH_PEAKS
+Find the NPEAK largest peaks in WELCH->PSD for channel CH.  Their
+frequencies (Hz) and RMS amplitudes are written to FREQ and RMS in order
+of decreasing amplitude.  Each RMS includes the bins under the window's
+main lobe, so a pure tone reports its true RMS.  The DC bin is ignored.
+Returns the number of peaks found, which may be fewer than NPEAK.  No more
+than LCFFT_MAX_PEAKS are found.
+*/
+unsigned int lcfft_welch_peaks(lcfft_welch_t *welch, unsigned int ch,
+        unsigned int npeak, double freq[], double rms[]);
+
+/* LCFFT_WELCH_FREE
+Release the memory held by the estimate.
+*/
+void lcfft_welch_free(lcfft_welch_t *welch);
+
+#endif
@@ -455,3 +455,105 @@ int tf_butterworth(tf_t *g, unsigned int order, double wc){
     }
     return 0;
 }
+
+
+
+int rs_init(rs_t *rs){
+    rs->x = NULL;
+    rs->size = 0;
+    rs->channels = 0;
+    rs->t = RS_HISTORY;
+    rs->step = 1.;
+    rs->primed = 0;
+    return 0;
+}
+
+
+int rs_construct(rs_t *rs, unsigned int channels){
+    if(rs->x){
+        fprintf(stderr, "RS_CONSTRUCT: The resampler is already constructed.\n");
+        return -1;
+    }else if(channels == 0){
+        fprintf(stderr, "RS_CONSTRUCT: The resampler needs at least one channel.\n");
+        return -1;
+    }
+    rs->x = malloc(RS_HISTORY * channels * sizeof(double));
+    if(rs->x == NULL){
+        fprintf(stderr, "RS_CONSTRUCT: Memory allocation failed.\n");
+        return -1;
+    }
+    rs->size = RS_HISTORY;
+    rs->channels = channels;
+    rs->t = RS_HISTORY;
+    rs->step = 1.;
+    rs->primed = 0;
+    return 0;
+}
+
+
+int rs_destruct(rs_t *rs){
+    if(rs->x)
+        free(rs->x);
+    rs->x = NULL;
+    rs->size = 0;
+    return 0;
+}
+
+
+int rs_eval(rs_t *rs, const double *in, unsigned int nin, 
+        double *out, unsigned int maxout){
+    unsigned int ii, ch, total, count, channels;
+    double mu, wm1, w0, w1, w2, *ptr;
+    const double *xm1, *x0, *x1, *x2;
+
+    channels = rs->channels;
+    if(nin == 0)
+        return 0;
+    // Make room for the history and the new block
+    total = RS_HISTORY + nin;
+    if(total > rs->size){
+        ptr = realloc(rs->x, total * channels * sizeof(double));
+        if(ptr == NULL){
+            fprintf(stderr, "RS_EVAL: Memory allocation failed.\n");
+            return -1;
+        }
+        rs->x = ptr;
+        rs->size = total;
+    }
+    // The first block starts with a history of copies of its first scan
+    if(!rs->primed){
+        for(ii=0; ii<RS_HISTORY; ii++)
+            memcpy(&rs->x[ii*channels], in, channels * sizeof(double));
+        rs->primed = 1;
+    }
+    memcpy(&rs->x[RS_HISTORY*channels], in, nin * channels * sizeof(double));
+
+    // The output between scans ii and ii+1 needs scans ii-1 through ii+2.
+    // T never falls below 1, so ii-1 is always in the history.
+    count = 0;
+    for(ii = (unsigned int) rs->t; ii+2 < total; ii = (unsigned int) rs->t){
+        if(count >= maxout){
+            fprintf(stderr, "RS_EVAL: The output buffer is too small.\n");
+            return -1;
+        }
+        // Cubic Lagrange weights at the fractional position
+        mu = rs->t - ii;
+        wm1 = -mu*(mu-1.)*(mu-2.)/6.;
+        w0 = (mu+1.)*(mu-1.)*(mu-2.)/2.;
+        w1 = -(mu+1.)*mu*(mu-2.)/2.;
+        w2 = (mu+1.)*mu*(mu-1.)/6.;
+        xm1 = &rs->x[(ii-1)*channels];
+        x0 = xm1 + channels;
+        x1 = x0 + channels;
+        x2 = x1 + channels;
+        ptr = &out[count*channels];
+        for(ch=0; ch<channels; ch++)
+            ptr[ch] = wm1*xm1[ch] + w0*x0[ch] + w1*x1[ch] + w2*x2[ch];
+        count++;
+        rs->t += rs->step;
+    }
+    // Keep the newest scans as the history for the next block
+    memmove(rs->x, &rs->x[nin*channels], RS_HISTORY * channels * sizeof(double));
+    rs->t -= nin;
+    return count;
+}
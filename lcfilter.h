@@ -281,5 +281,77 @@ int tf_pid(tf_t *g, double ts, double Kp, double Ki, double Kd);
 int tf_butterworth(tf_t *g, unsigned int order, double wc);
 
 
+/***********************************************************************
+ * 6. Fractional resampling                                            *
+ *      These functions interpolate multi-channel data at arbitrary    *
+ *      (and slowly varying) fractional positions.  They are used to   *
+ *      correct the clock drift between independent devices.          *
+ ***********************************************************************/
+
+/* RS_T
+ * 
+ * The resampler state struct holds the last few input scans so that the
+ * interpolation can continue seamlessly from one block to the next.  
+ * Data are interleaved by channel, as they are in the stream buffers.
+ * 
+ * Outputs are computed with a third-order Lagrange interpolator in 
+ * Farrow form, so the fractional position may change from one output 
+ * to the next without recomputing any filter tables.  T is the position
+ * of the next output measured in input scans from the oldest scan kept
+ * in the history, and STEP is the number of input scans between 
+ * outputs.  STEP slightly greater than 1 removes scans (the source 
+ * clock is fast), and STEP slightly less than 1 adds them.
+ */
+#define RS_HISTORY  3
+
+typedef struct __rs_t__ {
+    double *x;              // History followed by the current input block
+    unsigned int size;      // Scans allocated in x
+    unsigned int channels;  // Channels per scan
+    double t;               // Position of the next output
+    double step;            // Input scans per output scan
+    int primed;             // 1 once the history holds real data
+} rs_t;
+
+/* RS_INIT
+ * RS_CONSTRUCT
+ * RS_DESTRUCT
+ * 
+ * These follow the same rules as their TF_ counterparts.  RS_INIT() 
+ * must be called once before anything else.  RS_CONSTRUCT() prepares
+ * the resampler for data with CHANNELS channels per scan and STEP = 1.
+ * The history is filled from the first scan of the first block, so the
+ * first output lands exactly on the first input.  RS_DESTRUCT() frees 
+ * the history.
+ * 
+ * Prerequisite: RS_INIT() (construct and destruct)
+ * Integrity checks: RS_CONSTRUCT() fails if CHANNELS is zero or the
+ *      struct is already constructed.
+ * Returns: 0 on success, -1 on failure
+ */
+int rs_init(rs_t *rs);
+int rs_construct(rs_t *rs, unsigned int channels);
+int rs_destruct(rs_t *rs);
+
+/* RS_EVAL
+ * 
+ * Resample NIN scans from IN and write the outputs to OUT, which has 
+ * room for MAXOUT scans.  Every output that can be computed from the 
+ * inputs received so far is written, and the rest are computed when the
+ * next block arrives, so the number of outputs varies from call to 
+ * call.  No more than (NIN+RS_HISTORY)/STEP + 1 outputs are ever 
+ * produced.  STEP may be changed between calls.
+ * 
+ * The inner loop runs over the channels of a scan with fixed weights,
+ * so it is written to be vectorized by the compiler.
+ * 
+ * Prerequisite: RS_CONSTRUCT()
+ * Integrity checks: Error if MAXOUT is too small for the outputs
+ * Returns: number of output scans on success, -1 on failure
+ */
+int rs_eval(rs_t *rs, const double *in, unsigned int nin, 
+        double *out, unsigned int maxout);
+
+
 
 #endif
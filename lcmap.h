@@ -67,11 +67,31 @@ static const lcm_map_t lcm_device[] = {
 static const lcm_map_t lcm_dataformat[] = {
     {.value=LC_DF_ASCII, .message="ASCII", .config="ascii"},
     {.value=LC_DF_BIN, .message="Binary", .config="bin"},
+    {.value=LC_DF_FRAMED, .message="Framed binary", .config="framed"},
+    {.value=LC_DF_COLUMNAR, .message="Columnar framed binary", .config="columnar"},
     {.value=LC_DF_ASCII, .message="", .config="text"},
     {.value=LC_DF_BIN, .message="", .config="binary"},
     {.value=-1}
 };
 
+//
+// Stream service mode
+//
+static const lcm_map_t lcm_service[] = {
+    {.value=LC_SERVICE_POLL, .message="Polling", .config="poll"},
+    {.value=LC_SERVICE_CALLBACK, .message="LJM Callback", .config="callback"},
+    {.value=-1}
+};
+
+//
+// Ring buffer memory
+//
+static const lcm_map_t lcm_ringbuffer[] = {
+    {.value=LC_RING_BLOCK, .message="Blocks", .config="block"},
+    {.value=LC_RING_MIRROR, .message="Mirrored", .config="mirror"},
+    {.value=-1}
+};
+
 //
 // Analog Output Signal
 //
@@ -0,0 +1,432 @@
+/*
+  This file is part of the LCONFIG laboratory configuration system.
+
+    LCONFIG is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    LCONFIG is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with LCONFIG.  If not, see <https://www.gnu.org/licenses/>.
+
+    Authored by C.Martin crm28@psu.edu
+*/
+
+#include "lconfig.h"
+#include "lctools.h"
+#include "lcnet.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#define DEF_ADDRESS     "5500"
+#define DEF_SOURCES     2
+#define DEF_BUFFER_SEC  10.
+#define MAXSRC          16
+#define MAXSTR          128
+#define ROWS_PER_WRITE  256     // Merged rows collected before each write
+#define RATE_TOLERANCE  1e-6    // Largest relative difference in data rates
+
+
+/*....................
+. Help text
+.....................*/
+const char help_text[] = \
+"lcmerge [-h] [-l ADDRESS] [-n SOURCES] [-b SECONDS] [-d DATAFILE]\n"\
+"  Receives live streams from several LCRUN processes (see lcrun -o),\n"\
+"  lines them up by the time each stream started, and writes them to a\n"\
+"  single data file with one row per scan and the devices' channels side\n"\
+"  by side.  The header lists every device configuration in the order\n"\
+"  the sources connected.  Scans that a source did not deliver (because\n"\
+"  it fell behind, stopped early, or started late) are written as nan.\n"\
+"\n"\
+"  Every source must produce data at the same rate (samplehz divided by\n"\
+"  downsample+1).  Separate devices drift apart slowly unless the\n"\
+"  senders correct their clocks (lcrun -r).\n"\
+"\n"\
+"-l ADDRESS\n"\
+"  The address to listen on.  This may be a TCP port (PORT or HOST:PORT)\n"\
+"  or a Unix domain socket (unix:PATH).  The default is port 5500.\n"\
+"\n"\
+"-n SOURCES\n"\
+"  The number of streams to merge.  Writing begins once every source has\n"\
+"  connected.  The default is 2.\n"\
+"\n"\
+"-b SECONDS\n"\
+"  The most data held for each source while waiting on the others.  When\n"\
+"  a source gets this far ahead, the rows are written without the\n"\
+"  sources that are late.  The default is 10 seconds.\n"\
+"\n"\
+"-d DATAFILE\n"\
+"  The merged data file name.  The default is \"YYYYMMDDHHmmSS_merge.dat\".\n"\
+"\n"\
+"  For example, to merge two test cells,\n"\
+"     $ lcmerge -n 2 -d cells.dat &\n"\
+"     cell1 $ lcrun -r -o aggregator:5500\n"\
+"     cell2 $ lcrun -r -o aggregator:5500\n"\
+"\n"\
+"GPLv3\n"\
+"(c)2026 C.Martin\n";
+
+
+// One incoming stream and the scans it has delivered that have not been
+// written.  Scan K lives in FIFO[(K % CAPACITY) * CHANNELS] while
+// FIRST <= K < FIRST + COUNT.
+typedef struct __source_t__ {
+    int fd;                 // Socket or -1 when the source is finished
+    int loaded;             // Has the configuration arrived?
+    lc_devconf_t dconf;     // Configuration received from the source
+    double rate;            // Data rate in Hz
+    int64_t start_ns;       // Time of the source's first scan
+    unsigned int channels;  // Channels per scan
+    double *fifo;           // Scans waiting to be written
+    uint64_t capacity;      // Length of FIFO in scans
+    uint64_t first;         // Index of the oldest scan in FIFO
+    uint64_t count;         // Scans in FIFO
+    uint64_t offset;        // Index of the scan written on the first row
+    uint64_t lost;          // Scans written as nan
+    lcnet_rx_t rx;          // The frame being received
+} source_t;
+
+
+// Add a scan to the end of a source FIFO.  DATA may be NULL for a missing
+// scan.  If the FIFO is full, the oldest scan is discarded.
+void push_scan(source_t *src, const double *data){
+    double *dest;
+    unsigned int ii;
+
+    if(src->count == src->capacity){
+        src->first ++;
+        src->count --;
+    }
+    dest = &src->fifo[((src->first + src->count) % src->capacity) * src->channels];
+    for(ii=0; ii<src->channels; ii++)
+        dest[ii] = data ? data[ii] : NAN;
+    src->count ++;
+}
+
+
+// Write a device configuration to the merged file header.  LC_WRITE() ends
+// every configuration with the "##" line that ends the header, so it is 
+// removed from all but the LAST device.
+void write_config(lc_devconf_t *dconf, FILE *ff, int last){
+    char *text = NULL, *end;
+    size_t bytes = 0;
+    FILE *mem;
+
+    mem = open_memstream(&text, &bytes);
+    if(mem == NULL)
+        return;
+    lc_write(dconf, mem);
+    fclose(mem);
+    if(!last && (end = strstr(text, "\n##")))
+        end[1] = '\0';
+    fputs(text, ff);
+    free(text);
+}
+
+
+// Discard every scan before scan index K
+void drop_before(source_t *src, uint64_t k){
+    if(k <= src->first)
+        return;
+    if(k >= src->first + src->count){
+        src->first = k;
+        src->count = 0;
+    }else{
+        src->count -= k - src->first;
+        src->first = k;
+    }
+}
+
+
+/*....................
+. Main
+.....................*/
+int main(int argc, char *argv[]){
+    char    address[MAXSTR] = DEF_ADDRESS,
+            data_file[MAXSTR] = "";
+    char    go;
+    int     lfd, ii, err, nsrc = 0, nwant = DEF_SOURCES, npoll, aligned = 0,
+            full, ready, waiting;
+    double  buffer_sec = DEF_BUFFER_SEC;
+    source_t src[MAXSRC];
+    struct pollfd pfd[MAXSRC + 2];
+    lcnet_frame_t *frame;
+    void    *payload;
+    unsigned int jj, total = 0, nrows = 0;
+    uint64_t k, row = 0;
+    int64_t t0 = 0;
+    double  *out = NULL, *dest;
+    const double *scan;
+    FILE    *dfile = NULL;
+    time_t  now;
+
+    while((go = getopt(argc, argv, "hl:n:b:d:"))!=-1){
+        switch(go){
+        case 'l':
+            if(snprintf(address, MAXSTR, "%s", optarg) >= MAXSTR){
+                fprintf(stderr, "LCMERGE: The address is too long: %s\n", optarg);
+                return -1;
+            }
+        break;
+        case 'n':
+            if(sscanf(optarg, "%d", &nwant)!=1 || nwant < 1 || nwant > MAXSRC){
+                fprintf(stderr, "LCMERGE: -n requires an integer from 1 to %d, but got: %s\n", MAXSRC, optarg);
+                return -1;
+            }
+        break;
+        case 'b':
+            if(sscanf(optarg, "%lf", &buffer_sec)!=1 || buffer_sec <= 0){
+                fprintf(stderr, "LCMERGE: -b requires a positive number of seconds, but got: %s\n", optarg);
+                return -1;
+            }
+        break;
+        case 'd':
+            if(snprintf(data_file, MAXSTR, "%s", optarg) >= MAXSTR){
+                fprintf(stderr, "LCMERGE: The data file name is too long: %s\n", optarg);
+                return -1;
+            }
+        break;
+        case 'h':
+            printf(help_text);
+            return 0;
+        default:
+            fprintf(stderr, "LCMERGE: Got unsupported command line option: %c\n", go);
+            return -1;
+        }
+    }
+    if(data_file[0] == '\0'){
+        time(&now);
+        strftime(data_file, MAXSTR, "%Y%m%d%H%M%S_merge.dat", localtime(&now));
+    }
+
+    lfd = lcnet_listen(address);
+    if(lfd < 0){
+        fprintf(stderr, "LCMERGE: Failed to listen on %s\n", address);
+        return -1;
+    }
+    printf("Waiting for %d sources on %s\nPress \"Q\" to quit\n", nwant, address);
+    fflush(stdout);
+    lct_setup_keypress();
+
+    go = 1;
+    while(go){
+        // Watch the listener (until every source is here), stdin, and the
+        // sources that are still sending.
+        pfd[0].fd = nsrc < nwant ? lfd : -1;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = STDIN_FILENO;
+        pfd[1].events = POLLIN;
+        npoll = 2;
+        for(ii=0; ii<nsrc; ii++){
+            pfd[npoll].fd = src[ii].fd;
+            pfd[npoll++].events = POLLIN;
+        }
+        if(poll(pfd, npoll, -1) < 0)
+            break;
+
+        if(pfd[1].revents & POLLIN && getchar() == 'Q')
+            go = 0;
+
+        // New sources
+        if(pfd[0].revents & POLLIN){
+            ii = lcnet_accept(lfd);
+            if(ii >= 0){
+                src[nsrc].fd = ii;
+                src[nsrc].loaded = 0;
+                src[nsrc].rate = 0.;
+                src[nsrc].fifo = NULL;
+                src[nsrc].first = 0;
+                src[nsrc].count = 0;
+                src[nsrc].lost = 0;
+                memset(&src[nsrc].rx, 0, sizeof(lcnet_rx_t));
+                nsrc++;
+            }
+        }
+
+        // Collect everything that arrived
+        for(ii=0; ii<npoll-2; ii++){
+            if(src[ii].fd < 0 || !(pfd[ii+2].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            // A source in the middle of a frame does not hold up the others
+            err = lcnet_recv(src[ii].fd, &src[ii].rx);
+            if(err == LCNET_AGAIN)
+                continue;
+            if(err){
+                fprintf(stderr, "LCMERGE: Lost the connection to source %d\n", ii);
+                close(src[ii].fd);
+                src[ii].fd = -1;
+                continue;
+            }
+            frame = &src[ii].rx.frame;
+            payload = src[ii].rx.payload;
+            switch(frame->type){
+            case LCNET_CONFIG:
+                if(src[ii].loaded || lc_load_string(&src[ii].dconf, 1, payload)){
+                    fprintf(stderr, "LCMERGE: Source %d sent a configuration that could not be loaded.\n", ii);
+                    close(src[ii].fd);
+                    src[ii].fd = -1;
+                    break;
+                }
+                src[ii].loaded = 1;
+                src[ii].rate = lc_downsamplehz(&src[ii].dconf);
+                src[ii].start_ns = frame->start_ns;
+                src[ii].channels = lc_nistream(&src[ii].dconf);
+                src[ii].capacity = ceil(buffer_sec * src[ii].rate);
+                src[ii].fifo = malloc(src[ii].capacity * src[ii].channels * sizeof(double));
+                if(src[ii].fifo == NULL || src[ii].channels == 0){
+                    fprintf(stderr, "LCMERGE: Failed to allocate the buffer for source %d\n", ii);
+                    go = 0;
+                    break;
+                }
+                printf("Source %d: %s, %d channels at %.6g Hz\n", ii,
+                        src[ii].dconf.name, src[ii].channels, src[ii].rate);
+                // Every source has to agree on the rate; nothing is
+                // resampled here.  Compare with the first other source
+                // whose configuration has arrived.
+                for(jj=0; jj<nsrc && (jj == ii || !src[jj].loaded); jj++);
+                if(jj < nsrc && fabs(src[ii].rate - src[jj].rate) > RATE_TOLERANCE * src[jj].rate){
+                    fprintf(stderr, "LCMERGE: Source %d runs at %.6g Hz, but source %d runs at %.6g Hz.\n",
+                            ii, src[ii].rate, jj, src[jj].rate);
+                    go = 0;
+                }
+            break;
+            case LCNET_BLOCK:
+                if(!src[ii].loaded || frame->channels != src[ii].channels
+                        || frame->bytes != (uint64_t) frame->channels * frame->samples * sizeof(double)){
+                    fprintf(stderr, "LCMERGE: Source %d sent a block that does not match its configuration.\n", ii);
+                    break;
+                }
+                // Blocks the sender dropped become missing scans
+                k = src[ii].first + src[ii].count;
+                if(frame->scan > k + src[ii].capacity)
+                    drop_before(&src[ii], frame->scan - src[ii].capacity);
+                for(k=src[ii].first + src[ii].count; k<frame->scan; k++)
+                    push_scan(&src[ii], NULL);
+                // Scans before the end of the FIFO were already discarded
+                // while lining up the sources.
+                for(jj=0; jj<frame->samples; jj++)
+                    if(frame->scan + jj >= src[ii].first + src[ii].count)
+                        push_scan(&src[ii], (const double*) payload + jj * frame->channels);
+            break;
+            case LCNET_END:
+                close(src[ii].fd);
+                src[ii].fd = -1;
+            break;
+            }
+        }
+
+        // Once every source has reported, line up their first rows on the
+        // latest start time and write the header.
+        if(!aligned && nsrc == nwant && go){
+            for(ii=0, aligned=1; ii<nsrc; ii++)
+                aligned = aligned && src[ii].loaded;
+            if(aligned){
+                for(ii=0; ii<nsrc; ii++)
+                    t0 = src[ii].start_ns > t0 ? src[ii].start_ns : t0;
+                dfile = fopen(data_file, "wb");
+                if(dfile == NULL){
+                    fprintf(stderr, "LCMERGE: Failed to open data file: %s\n", data_file);
+                    break;
+                }
+                for(ii=0; ii<nsrc; ii++){
+                    src[ii].offset = llround((t0 - src[ii].start_ns) * 1e-9 * src[ii].rate);
+                    drop_before(&src[ii], src[ii].offset);
+                    total += src[ii].channels;
+                    // The whole file uses the first source's format
+                    src[ii].dconf.dataformat = src[0].dconf.dataformat;
+                    write_config(&src[ii].dconf, dfile, ii == nsrc-1);
+                }
+                now = t0 / 1000000000;
+                fprintf(dfile, "#: %s", ctime(&now));
+                // Framed files index their frames from the end of the header
+                src[0].dconf.framer.offset = ftell(dfile);
+                out = malloc(ROWS_PER_WRITE * total * sizeof(double));
+                printf("Merging %d sources into %s\n", nsrc, data_file);
+                fflush(stdout);
+            }
+        }
+        if(!aligned)
+            continue;
+
+        // Write every row that is complete.  A row is complete when each
+        // source either has its scan or never will.  If any source's
+        // buffer is full, the late sources are skipped to bound memory.
+        while(1){
+            ready = 1;
+            full = 0;
+            waiting = 0;
+            for(ii=0; ii<nsrc; ii++){
+                k = src[ii].offset + row;
+                if(k < src[ii].first + src[ii].count)
+                    waiting = 1;
+                else if(src[ii].fd >= 0)
+                    ready = 0;
+                full = full || src[ii].count == src[ii].capacity;
+            }
+            if(!waiting || !(ready || full))
+                break;
+            dest = &out[nrows * total];
+            for(ii=0; ii<nsrc; ii++){
+                k = src[ii].offset + row;
+                if(k >= src[ii].first && k < src[ii].first + src[ii].count){
+                    scan = &src[ii].fifo[(k % src[ii].capacity) * src[ii].channels];
+                    drop_before(&src[ii], k + 1);
+                }else{
+                    scan = NULL;
+                    src[ii].lost ++;
+                }
+                for(jj=0; jj<src[ii].channels; jj++)
+                    *dest++ = scan ? scan[jj] : NAN;
+            }
+            row ++;
+            if(++nrows == ROWS_PER_WRITE){
+                lc_datafile_write(&src[0].dconf, dfile, out, total, nrows);
+                nrows = 0;
+            }
+        }
+
+        // Stop once every source is finished and written
+        for(ii=0, waiting=0; ii<nsrc; ii++)
+            waiting = waiting || src[ii].fd >= 0;
+        if(!waiting)
+            go = 0;
+    }
+    lct_finish_keypress();
+
+    if(dfile){
+        if(nrows)
+            lc_datafile_write(&src[0].dconf, dfile, out, total, nrows);
+        lc_datafile_checkpoint(&src[0].dconf, dfile);
+        fclose(dfile);
+        printf("Wrote %llu rows\n", (unsigned long long) row);
+    }
+    for(ii=0; ii<nsrc; ii++){
+        if(src[ii].fd >= 0)
+            close(src[ii].fd);
+        if(src[ii].loaded){
+            if(aligned)
+                printf("Source %d: %llu scans were missing\n", ii,
+                        (unsigned long long) src[ii].lost);
+            lc_clean(&src[ii].dconf);
+        }
+        free(src[ii].fifo);
+        lcnet_rx_free(&src[ii].rx);
+    }
+    free(out);
+    close(lfd);
+    if(strncmp(address, "unix:", 5) == 0)
+        unlink(address + 5);
+    return 0;
+}
@@ -0,0 +1,383 @@
+/*
+  This file is part of the LCONFIG laboratory configuration system.
+
+    LCONFIG is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    LCONFIG is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with LCONFIG.  If not, see <https://www.gnu.org/licenses/>.
+
+    Authored by C.Martin crm28@psu.edu
+*/
+
+#include "lcnet.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+// Address parsing results
+typedef struct __address_t__ {
+    int local;                      // Nonzero for a Unix domain socket
+    char host[LC_MAX_STR];          // TCP host or Unix path
+    char port[LC_MAX_STR];          // TCP port
+} address_t;
+
+
+// Split ADDRESS into its parts.  Returns LC_ERROR if it can't be parsed.
+int parse_address(const char *address, address_t *addr){
+    const char *colon;
+
+    addr->host[0] = '\0';
+    addr->port[0] = '\0';
+    addr->local = 0;
+    if(strncmp(address, "unix:", 5) == 0){
+        addr->local = 1;
+        snprintf(addr->host, LC_MAX_STR, "%s", address + 5);
+        return addr->host[0] ? LC_NOERR : LC_ERROR;
+    }
+    if(strncmp(address, "tcp:", 4) == 0)
+        address += 4;
+    colon = strrchr(address, ':');
+    // A bare port number
+    if(colon == NULL){
+        snprintf(addr->port, LC_MAX_STR, "%s", address);
+    }else{
+        snprintf(addr->host, LC_MAX_STR, "%.*s", (int)(colon - address), address);
+        snprintf(addr->port, LC_MAX_STR, "%s", colon + 1);
+    }
+    return addr->port[0] ? LC_NOERR : LC_ERROR;
+}
+
+
+// Open a socket to (or for) ADDR.  If PASSIVE is nonzero, bind and listen.
+// Otherwise, connect.  Returns the file descriptor or -1.
+int open_socket(const address_t *addr, int passive){
+    struct sockaddr_un saddr;
+    struct addrinfo hints, *res, *ai;
+    int fd = -1, one = 1;
+
+    if(addr->local){
+        memset(&saddr, 0, sizeof(saddr));
+        saddr.sun_family = AF_UNIX;
+        if(strlen(addr->host) >= sizeof(saddr.sun_path))
+            return -1;
+        strcpy(saddr.sun_path, addr->host);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd < 0)
+            return -1;
+        if(passive){
+            unlink(addr->host);
+            if(bind(fd, (struct sockaddr*) &saddr, sizeof(saddr))
+                    || listen(fd, LCNET_BACKLOG)){
+                close(fd);
+                return -1;
+            }
+        }else if(connect(fd, (struct sockaddr*) &saddr, sizeof(saddr))){
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(passive)
+        hints.ai_flags = AI_PASSIVE;
+    if(getaddrinfo(addr->host[0] ? addr->host : NULL, addr->port, &hints, &res))
+        return -1;
+    // Use the first address that works
+    for(ai=res; ai; ai=ai->ai_next){
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if(fd < 0)
+            continue;
+        if(passive){
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if(!bind(fd, ai->ai_addr, ai->ai_addrlen) && !listen(fd, LCNET_BACKLOG))
+                break;
+        }else if(!connect(fd, ai->ai_addr, ai->ai_addrlen))
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+
+// Append a frame to the queue if it fits.  Returns LC_ERROR if it does not.
+int queue_frame(lcnet_t *net, lcnet_frame_t *frame, const void *payload){
+    size_t need;
+
+    need = sizeof(lcnet_frame_t) + frame->bytes;
+    // Make room by moving the pending bytes to the front
+    if(net->end + need > net->size && net->start > 0){
+        memmove(net->queue, net->queue + net->start, net->end - net->start);
+        net->end -= net->start;
+        net->start = 0;
+    }
+    if(net->end + need > net->size)
+        return LC_ERROR;
+    frame->magic = LCNET_MAGIC;
+    frame->device = net->device;
+    frame->ndev = net->ndev;
+    frame->start_ns = net->start_ns;
+    memcpy(net->queue + net->end, frame, sizeof(lcnet_frame_t));
+    net->end += sizeof(lcnet_frame_t);
+    if(frame->bytes)
+        memcpy(net->queue + net->end, payload, frame->bytes);
+    net->end += frame->bytes;
+    return LC_NOERR;
+}
+
+
+int lcnet_open(lcnet_t *net, const char *address, lc_devconf_t *dconf,
+        unsigned int device, unsigned int ndev, size_t queue_bytes){
+    address_t addr;
+    lcnet_frame_t frame;
+    char *config = NULL;
+    size_t config_bytes = 0;
+    FILE *ff;
+
+    net->fd = -1;
+    net->queue = NULL;
+    net->seq = 0;
+    net->scan = 0;
+    net->dropped = 0;
+    net->start_ns = (int64_t) dconf->RB.start.tv_sec * 1000000000 + dconf->RB.start.tv_nsec;
+    net->start = 0;
+    net->end = 0;
+    net->device = device;
+    net->ndev = ndev;
+    net->size = queue_bytes ? queue_bytes : LCNET_QUEUE_BYTES;
+    net->frame_samples = dconf->RB.samples_per_read ?
+            dconf->RB.samples_per_read : dconf->nsample;
+    if(net->frame_samples == 0)
+        net->frame_samples = LC_SAMPLES_PER_READ;
+
+    if(parse_address(address, &addr)){
+        fprintf(stderr, "LCNET: Could not understand the address: %s\n", address);
+        return LC_ERROR;
+    }
+    // Render the configuration
+    ff = open_memstream(&config, &config_bytes);
+    if(ff == NULL){
+        fprintf(stderr, "LCNET: Failed to render the configuration.\n");
+        return LC_ERROR;
+    }
+    lc_write(dconf, ff);
+    fclose(ff);
+
+    net->queue = malloc(net->size);
+    if(net->queue == NULL || config_bytes + sizeof(lcnet_frame_t) > net->size){
+        fprintf(stderr, "LCNET: Failed to allocate a %zu byte send queue.\n", net->size);
+        lcnet_close(net);
+        free(config);
+        return LC_ERROR;
+    }
+    memset(&frame, 0, sizeof(frame));
+    frame.type = LCNET_CONFIG;
+    frame.bytes = config_bytes;
+    queue_frame(net, &frame, config);
+    free(config);
+
+    net->fd = open_socket(&addr, 0);
+    if(net->fd < 0){
+        fprintf(stderr, "LCNET: Failed to connect to %s\n", address);
+        lcnet_close(net);
+        return LC_ERROR;
+    }
+    // From here on, the network never gets to block us
+    fcntl(net->fd, F_SETFL, fcntl(net->fd, F_GETFL) | O_NONBLOCK);
+    return lcnet_flush(net, 0);
+}
+
+
+int lcnet_send(lcnet_t *net, const double *data, unsigned int channels,
+        unsigned int samples){
+    lcnet_frame_t frame;
+    unsigned int count;
+
+    if(net->fd < 0)
+        return LC_ERROR;
+    memset(&frame, 0, sizeof(frame));
+    frame.type = LCNET_BLOCK;
+    frame.channels = channels;
+    while(samples){
+        count = samples < net->frame_samples ? samples : net->frame_samples;
+        frame.seq = net->seq++;
+        frame.scan = net->scan;
+        frame.samples = count;
+        frame.bytes = (uint64_t) count * channels * sizeof(double);
+        if(queue_frame(net, &frame, data))
+            net->dropped ++;
+        data += count * channels;
+        net->scan += count;
+        samples -= count;
+    }
+    return lcnet_flush(net, 0);
+}
+
+
+int lcnet_flush(lcnet_t *net, int timeout_ms){
+    struct pollfd pfd;
+    struct timespec t0, t1;
+    ssize_t sent;
+    int remaining;
+
+    if(net->fd < 0)
+        return LC_ERROR;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while(net->end > net->start){
+        sent = send(net->fd, net->queue + net->start, net->end - net->start,
+                MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(sent > 0){
+            net->start += sent;
+            continue;
+        }else if(sent < 0 && errno == EINTR)
+            continue;
+        else if(sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            // The socket is full; wait only if we were asked to
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            remaining = timeout_ms - (int)((t1.tv_sec - t0.tv_sec)*1000
+                    + (t1.tv_nsec - t0.tv_nsec)/1000000);
+            if(remaining <= 0)
+                break;
+            pfd.fd = net->fd;
+            pfd.events = POLLOUT;
+            poll(&pfd, 1, remaining);
+            continue;
+        }
+        // Anything else means the connection is gone
+        fprintf(stderr, "LCNET: The connection failed: %s\n",
+                sent < 0 ? strerror(errno) : "closed by the receiver");
+        close(net->fd);
+        net->fd = -1;
+        return LC_ERROR;
+    }
+    // Reset the queue when it empties so it never needs to be compacted
+    if(net->start == net->end)
+        net->start = net->end = 0;
+    return LC_NOERR;
+}
+
+
+void lcnet_close(lcnet_t *net){
+    lcnet_frame_t frame;
+
+    if(net->fd >= 0){
+        memset(&frame, 0, sizeof(frame));
+        frame.type = LCNET_END;
+        frame.seq = net->seq;
+        queue_frame(net, &frame, NULL);
+        lcnet_flush(net, LCNET_CLOSE_MS);
+        if(net->fd >= 0)
+            close(net->fd);
+        net->fd = -1;
+    }
+    if(net->queue){
+        free(net->queue);
+        net->queue = NULL;
+    }
+}
+
+
+int lcnet_listen(const char *address){
+    address_t addr;
+
+    if(parse_address(address, &addr)){
+        fprintf(stderr, "LCNET: Could not understand the address: %s\n", address);
+        return -1;
+    }
+    return open_socket(&addr, 1);
+}
+
+
+int lcnet_accept(int lfd){
+    int fd, flags;
+
+    fd = accept(lfd, NULL, NULL);
+    if(fd < 0)
+        return -1;
+    flags = fcntl(fd, F_GETFL);
+    if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+int lcnet_recv(int fd, lcnet_rx_t *rx){
+    const size_t head = sizeof(lcnet_frame_t);
+    ssize_t got;
+    size_t want;
+    char *dest;
+    void *ptr;
+
+    while(1){
+        if(rx->got < head){
+            dest = (char*) &rx->frame + rx->got;
+            want = head - rx->got;
+        }else{
+            dest = (char*) rx->payload + (rx->got - head);
+            want = head + rx->frame.bytes - rx->got;
+        }
+        // The frame is complete; start the next one on the next call
+        if(want == 0){
+            ((char*) rx->payload)[rx->frame.bytes] = '\0';
+            rx->got = 0;
+            return LC_NOERR;
+        }
+        got = read(fd, dest, want);
+        if(got < 0 && errno == EINTR)
+            continue;
+        if(got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return LCNET_AGAIN;
+        if(got <= 0)
+            return LC_ERROR;
+        rx->got += got;
+        if(rx->got != head)
+            continue;
+        // The header is in; check it and make room for the payload
+        if(rx->frame.magic != LCNET_MAGIC || rx->frame.bytes > LCNET_MAX_FRAME){
+            fprintf(stderr, "LCNET: Received an invalid frame.\n");
+            return LC_ERROR;
+        }
+        // Leave room for the NUL after configuration text
+        if(rx->frame.bytes + 1 > rx->size){
+            ptr = realloc(rx->payload, rx->frame.bytes + 1);
+            if(ptr == NULL){
+                fprintf(stderr, "LCNET: Failed to allocate %llu bytes for a frame.\n",
+                        (unsigned long long) rx->frame.bytes);
+                return LC_ERROR;
+            }
+            rx->payload = ptr;
+            rx->size = rx->frame.bytes + 1;
+        }
+    }
+}
+
+
+void lcnet_rx_free(lcnet_rx_t *rx){
+    free(rx->payload);
+    rx->payload = NULL;
+    rx->size = 0;
+    rx->got = 0;
+}
@@ -0,0 +1,216 @@
+/*
+  This file is part of the LCONFIG laboratory configuration system.
+
+    LCONFIG is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    LCONFIG is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with LCONFIG.  If not, see <https://www.gnu.org/licenses/>.
+
+    Authored by C.Martin crm28@psu.edu
+*/
+
+/*  The LCNET header sends a live stream to another process over a TCP or Unix
+domain socket.  The sender connects to a receiver (like LCRECV) and sends a
+sequence of frames.  Every frame starts with an LCNET_FRAME_T header followed
+by BYTES of payload.
+
+    LCNET_CONFIG    The device configuration text, exactly as LC_WRITE()
+                    produces it.  This is always the first frame.
+    LCNET_BLOCK     CHANNELS x SAMPLES doubles in the same order as the
+                    stream data.  SEQ counts every block offered to the
+                    sender, so gaps in SEQ show where blocks were dropped.
+                    SCAN is the index of the block's first scan in the
+                    stream (after downsampling).
+    LCNET_END       The sender is finished.  There is no payload.
+
+Every frame carries START_NS, the wall clock time of the first scan in the
+stream, so the scan at index K was measured at about START_NS + K/F, where F
+is the data rate (LC_DOWNSAMPLEHZ()) of the configuration.  This is what
+lets a receiver line up streams from different hosts.
+
+All values are in the sender's native byte order.
+
+Acquisition must never wait on the network.  Frames are appended to a
+bounded queue and written to the socket without blocking as the socket
+allows, so many frames usually go out in a single system call.  When the
+queue is full, new blocks are dropped (and counted) until the receiver
+catches up.
+
+Receivers never wait on a sender either.  Their sockets are non-blocking,
+and each connection keeps the frame it is in the middle of (LCNET_RX_T), so
+a sender that stalls mid-frame only holds up its own connection.
+
+CHANGELOG
+
+v1.2    10/2026
+- LCNET_RECV() receives frames incrementally on non-blocking sockets
+- Added LCNET_ACCEPT() and LCNET_RX_FREE()
+
+v1.1    10/2026
+- Frames carry the stream start time and the index of their first scan
+
+v1.0    10/2026     ORIGINAL RELEASE
+*/
+
+#ifndef __LCNET
+#define __LCNET
+
+#include "lconfig.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define LCNET_MAGIC         0x4c434e46U     // "LCNF"
+#define LCNET_QUEUE_BYTES   (4<<20)         // Default send queue size
+#define LCNET_MAX_FRAME     (64<<20)        // Largest payload a receiver accepts
+#define LCNET_CLOSE_MS      1000            // Time allowed to flush on close
+#define LCNET_BACKLOG       8               // Pending connections for a listener
+#define LCNET_AGAIN         1               // LCNET_RECV() needs more bytes
+
+#define LCNET_CONFIG    1
+#define LCNET_BLOCK     2
+#define LCNET_END       3
+
+
+/* LCNET_FRAME_T
+The header that precedes every frame on the wire.  DEVICE and NDEV identify
+the device in the sender's configuration, so one receiver can collect from
+several devices at once.
+*/
+typedef struct __lcnet_frame_t__ {
+    uint32_t magic;         // LCNET_MAGIC
+    uint16_t type;          // LCNET_CONFIG, LCNET_BLOCK, or LCNET_END
+    uint8_t device;         // Index of the device at the sender
+    uint8_t ndev;           // Number of devices at the sender
+    uint64_t seq;           // Block sequence number
+    int64_t start_ns;       // Time of the first scan in the stream (ns since the epoch)
+    uint64_t scan;          // Index of the block's first scan
+    uint32_t channels;      // Channels per scan (blocks only)
+    uint32_t samples;       // Scans in the block (blocks only)
+    uint64_t bytes;         // Bytes of payload that follow
+} lcnet_frame_t;
+
+
+/* LCNET_T
+The sending end of a connection.  QUEUE holds frames that have not been
+written to the socket yet; the bytes from START to END are pending.
+*/
+typedef struct __lcnet_t__ {
+    int fd;                 // Socket or -1 when closed
+    uint8_t device;         // Device index put in every frame
+    uint8_t ndev;           // Number of devices put in every frame
+    uint64_t seq;           // Sequence number of the next block
+    uint64_t scan;          // Index of the next scan
+    int64_t start_ns;       // Time of the first scan in the stream
+    uint64_t dropped;       // Blocks dropped because the queue was full
+    unsigned int frame_samples; // Most scans sent in one frame
+    char *queue;            // Send queue
+    size_t size;            // Queue capacity in bytes
+    size_t start;           // First pending byte
+    size_t end;             // One past the last pending byte
+} lcnet_t;
+
+
+/* LCNET_RX_T
+The receiving end of a connection.  FRAME and PAYLOAD hold the frame being
+received, and GOT counts its bytes (header and payload) received so far.
+Initialize it with zeros.
+*/
+typedef struct __lcnet_rx_t__ {
+    lcnet_frame_t frame;    // Header of the frame being received
+    size_t got;             // Bytes of the frame received so far
+    void *payload;          // Payload, grown with realloc() as needed
+    size_t size;            // Capacity of PAYLOAD in bytes
+} lcnet_rx_t;
+
+
+/* LCNET_OPEN
+Connect to the receiver at ADDRESS and queue the configuration of DCONF.
+ADDRESS may be
+
+    unix:PATH           A Unix domain socket
+    tcp:HOST:PORT       A TCP socket
+    HOST:PORT           Same as tcp:HOST:PORT
+
+DEVICE and NDEV are copied into every frame.  The stream should already be
+started, so its start time (RB.START) can be sent along.  QUEUE_BYTES sets the size of
+the send queue; if it is zero, LCNET_QUEUE_BYTES is used.  The connection
+is made before LCNET_OPEN() returns, but the socket never blocks after that.
+
+Returns LC_NOERR on success and LC_ERROR on failure.
+*/
+int lcnet_open(lcnet_t *net, const char *address, lc_devconf_t *dconf,
+        unsigned int device, unsigned int ndev, size_t queue_bytes);
+
+/* LCNET_SEND
+Queue SAMPLES scans of CHANNELS channels from DATA and write as much of the
+queue as the socket will accept without blocking.  The data are split into
+frames of no more than the stream's block size (RB.SAMPLES_PER_READ).
+Frames that do not fit in the queue are dropped and counted in NET->DROPPED.
+
+Returns LC_NOERR unless the connection has failed, in which case the socket
+is closed and LC_ERROR is returned.
+*/
+int lcnet_send(lcnet_t *net, const double *data, unsigned int channels,
+        unsigned int samples);
+
+/* LCNET_FLUSH
+Write as much of the queue as the socket will accept without blocking.  If
+TIMEOUT_MS is positive, keep waiting up to that long for the queue to empty.
+
+Returns LC_NOERR unless the connection has failed.
+*/
+int lcnet_flush(lcnet_t *net, int timeout_ms);
+
+/* LCNET_CLOSE
+Queue an LCNET_END frame, allow up to LCNET_CLOSE_MS for the queue to empty,
+and close the connection.  It is safe to call LCNET_CLOSE() on a connection
+that is already closed.
+*/
+void lcnet_close(lcnet_t *net);
+
+/* LCNET_LISTEN
+Open a listening socket at ADDRESS for a receiver.  The address formats are
+the same as for LCNET_OPEN(), except that the host may be omitted (":PORT"
+or just "PORT") to listen on every interface.  A stale Unix socket file is
+removed first.
+
+Returns the listening file descriptor or -1 on failure.
+*/
+int lcnet_listen(const char *address);
+
+/* LCNET_ACCEPT
+Accept a sender on the listening socket LFD.  The connection is made 
+non-blocking for LCNET_RECV().
+
+Returns the connection's file descriptor or -1 on failure.
+*/
+int lcnet_accept(int lfd);
+
+/* LCNET_RECV
+Continue receiving a frame from the non-blocking socket FD into RX.  Only 
+the bytes that have already arrived are read, and a partial frame is kept
+in RX for the next call.  When the frame is complete, RX->FRAME is its 
+header and RX->PAYLOAD its payload until the next call.  The configuration 
+payload is always NUL-terminated.  At most one frame is returned per call, 
+so busy senders take turns.
+
+Returns LC_NOERR when a frame is complete, LCNET_AGAIN if more bytes are 
+needed, and LC_ERROR if the connection closed or the frame is not valid.
+*/
+int lcnet_recv(int fd, lcnet_rx_t *rx);
+
+/* LCNET_RX_FREE
+Release the payload buffer and forget any partial frame, so RX can be used
+for another connection.
+*/
+void lcnet_rx_free(lcnet_rx_t *rx);
+
+#endif
@@ -18,6 +18,7 @@
     Authored by C.Martin crm28@psu.edu
 */
 
+#define _GNU_SOURCE     // for memfd_create
 #include <stdio.h>      // 
 #include <stdlib.h>     // for rand, malloc, and free
 #include <unistd.h>     // for sleep
@@ -29,6 +30,9 @@
 #include <LabJackM.h>   // duh
 #include <stdint.h>     // being careful about bit widths
 #include <sys/sysinfo.h>    // for ram overload checking
+#include <sys/eventfd.h>    // for waking the application from the stream callback
+#include <poll.h>           // for waiting on the stream callback
+#include <sys/mman.h>       // for the mirrored ring buffer
 #include "lconfig.h"
 #include "lcmap.h"
 
@@ -239,10 +243,13 @@ void init_config(lc_devconf_t* dconf){
     // Global sample settings
     dconf->samplehz =       -1.;
     dconf->settleus =       1.;
+    dconf->latencyms =      -1.;    // Disable block size tuning
     dconf->nsample =        LC_DEF_NSAMPLE;
     dconf->downsample =     0;  // Disable downsampling
     dconf->dscount =        0;
     dconf->dataformat =     LC_DF_ASCII;
+    dconf->service =        LC_SERVICE_POLL;
+    dconf->ringbuffer =     LC_RING_BLOCK;
     // Trigger settings
     dconf->trigchannel =    -1;
     dconf->triglevel =      0.;
@@ -310,8 +317,14 @@ void init_config(lc_devconf_t* dconf){
         dconf->comch[comnum].rate =     -1;
     }
     dconf->RB.buffer = NULL;
+    dconf->RB.efd = -1;
+    dconf->RB.error = LC_NOERR;
+    dconf->RB.service_us = -1.;
+    dconf->RB.scan_us = -1.;
+    pthread_mutex_init(&dconf->RB.lock, NULL);
     // Initialize the downselect counter
     dconf->dscount = 0;
+    memset(&dconf->framer, 0, sizeof(lc_framer_t));
 }
 
 
@@ -339,12 +352,71 @@ int test_digital(lc_devconf_t *dconf){
 
 
 
+// Map the buffer's pages twice, back-to-back, so that any span of up to 
+// SIZE_SAMPLES that starts inside the buffer is contiguous in memory.  The
+// number of blocks is rounded up so the buffer is a whole number of pages.
+// Returns LC_ERROR and leaves the buffer unallocated if the mapping fails or
+// the rounding would waste too much memory.
+int mirror_buffer(lc_ringbuf_t* RB){
+    long unsigned int page, block_bytes, bytes, blocks, step, a, b;
+    char *base;
+    int fd;
+
+    page = sysconf(_SC_PAGESIZE);
+    block_bytes = RB->blocksize_samples * sizeof(double);
+    if(block_bytes == 0)
+        return LC_ERROR;
+    // The smallest number of blocks that fills whole pages is
+    // page / gcd(page, block_bytes)
+    for(a = page, b = block_bytes; b; ){
+        step = a % b;
+        a = b;
+        b = step;
+    }
+    step = page / a;
+    blocks = RB->size_samples / RB->blocksize_samples;
+    blocks = ((blocks + step - 1) / step) * step;
+    bytes = blocks * block_bytes;
+    if(bytes > 2 * RB->size_samples * sizeof(double) && 
+            bytes - RB->size_samples * sizeof(double) > LC_MAX_MIRROR_PAD)
+        return LC_ERROR;
+
+    fd = memfd_create("lconfig_ringbuf", MFD_CLOEXEC);
+    if(fd < 0)
+        return LC_ERROR;
+    if(ftruncate(fd, bytes)){
+        close(fd);
+        return LC_ERROR;
+    }
+    // Reserve room for both copies, then map the file over each half
+    base = mmap(NULL, 2*bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED){
+        close(fd);
+        return LC_ERROR;
+    }
+    if(mmap(base, bytes, PROT_READ | PROT_WRITE, 
+                MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+            mmap(base + bytes, bytes, PROT_READ | PROT_WRITE, 
+                MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED){
+        munmap(base, 2*bytes);
+        close(fd);
+        return LC_ERROR;
+    }
+    // The mappings keep the memory alive
+    close(fd);
+    RB->buffer = (double*) base;
+    RB->size_samples = blocks * RB->blocksize_samples;
+    RB->mirror = 1;
+    return LC_NOERR;
+}
+
 // Initialization declares the buffer memory and initializes all
 // internal variables to describe the buffer's size and read/write oeprations
 int init_buffer(lc_ringbuf_t* RB,    // Ring buffer struct to initialize
                 const unsigned int channels, // The number of channels in the stream
                 const unsigned int samples_per_read, // The samples (scans) per R/W block
-                const unsigned int blocks){ // The number of R/W blocks to buffer
+                const unsigned int blocks, // The number of R/W blocks to buffer
+                const int mirror){ // Try to mirror the buffer?
     
     struct sysinfo sinf;
     long unsigned int bytes;
@@ -362,6 +434,9 @@ int init_buffer(lc_ringbuf_t* RB,    // Ring buffer struct to initialize
     RB->size_samples = RB->blocksize_samples * blocks;
     RB->read = 0;
     RB->write = 0;
+    RB->blocks_streamed = 0;
+    RB->backlog = 0;
+    RB->mirror = 0;
     // Do some sanity checking on the buffer size
     sysinfo(&sinf);
     bytes = RB->size_samples * sizeof(double);
@@ -370,7 +445,14 @@ int init_buffer(lc_ringbuf_t* RB,    // Ring buffer struct to initialize
         RB->buffer = NULL;
         return LC_ERROR;
     }
+    // Use the mirrored mapping if it was requested and we can
+    if(mirror && mirror_buffer(RB) == LC_NOERR)
+        return LC_NOERR;
     RB->buffer = malloc(bytes);
+    if(RB->buffer == NULL){
+        print_error("INIT_BUFFER: Failed to allocate %lu bytes.\n", bytes);
+        return LC_ERROR;
+    }
     return LC_NOERR;
 }
 
@@ -395,6 +477,7 @@ void service_write_buffer(lc_ringbuf_t* RB){
     // advance the write index
     RB->write += RB->blocksize_samples;
     RB->samples_streamed += RB->samples_per_read;
+    RB->blocks_streamed ++;
     // Check for wrapping
     if(RB->write + RB->blocksize_samples > RB->size_samples)
         RB->write = 0;
@@ -434,12 +517,27 @@ void service_read_buffer(lc_ringbuf_t *RB){
         RB->read = 0;
 }
 
+// The buffer only needs to be locked when the LJM stream callback is 
+// writing to it from another thread.
+void lock_buffer(lc_ringbuf_t* RB){
+    if(RB->efd >= 0)
+        pthread_mutex_lock(&RB->lock);
+}
+
+void unlock_buffer(lc_ringbuf_t* RB){
+    if(RB->efd >= 0)
+        pthread_mutex_unlock(&RB->lock);
+}
+
 // Free the buffer's memory
 void clean_buffer(lc_ringbuf_t* RB){
-    if(RB->buffer){
+    if(RB->buffer && RB->mirror)
+        munmap(RB->buffer, 2 * RB->size_samples * sizeof(double));
+    else if(RB->buffer)
         free(RB->buffer);
-        RB->buffer = NULL;
-    }
+    RB->buffer = NULL;
+    RB->mirror = 0;
+    RB->error = LC_NOERR;
     RB->samples_per_read = 0;
     RB->channels = 0;
     RB->blocksize_samples = 0;
@@ -566,18 +664,20 @@ double lc_downsamplehz(const lc_devconf_t *dconf){
 ......................................*/
 
 
-int lc_load(lc_devconf_t* dconf, const unsigned int devmax, const char* filename){
+// Parse a configuration from an open stream.  FILENAME is only used in 
+// error messages.  FF is always closed before returning.
+int load_file(lc_devconf_t* dconf, const unsigned int devmax, FILE* ff, const char* filename){
     int devnum=-1, ainum=-1, aonum=-1, efnum=-1, comnum=-1;
     int itemp, itemp2, itemp3, itemp4;
     float ftemp;
     char param[LC_MAX_STR], value[LC_MAX_STR];
     char metatype;
     char ctemp;
-    FILE* ff;
 
     if(devmax>LC_MAX_NDEV){
         print_error( "LCONFIG: LOAD_CONFIG called with %d devices, but only %d are supported.\n",
                 devmax, LC_MAX_NDEV);
+        fclose(ff);
         return LC_ERROR;
     }
 
@@ -593,12 +693,6 @@ int lc_load(lc_devconf_t* dconf, const unsigned int devmax, const char* filename
     // start at the beginning.
     devnum = -1;
 
-    // open the file
-    ff = fopen(filename, "r");
-    if(ff==NULL){
-        print_error( "LOAD: Failed to open the configuration file \"%s\".\n",filename);
-        return LC_ERROR;
-    }
     // Read the entire file
     while(!feof(ff)){
         // Read in the parameter name
@@ -714,6 +808,15 @@ Found \"%s\"\n", param);
             }
             dconf[devnum].settleus = ftemp;
         //
+        // The LATENCYMS parameter
+        //
+        }else if(streq(param,"latencyms")){
+            if(sscanf(value,"%f",&ftemp)!=1){
+                print_error("LOAD: Illegal LATENCYMS value \"%s\". Expected float.\n",value);
+                loadfail();
+            }
+            dconf[devnum].latencyms = ftemp;
+        //
         // The NSAMPLE parameter
         //
         }else if(streq(param,"nsample")){
@@ -746,9 +849,29 @@ Found \"%s\"\n", param);
         }else if(streq(param, "dataformat")){
             if(lcm_get_value(lcm_dataformat, value, &dconf[devnum].dataformat)){
                 print_error( "LOAD: Unrecognized dataformat: %s\n", value);
-                print_error( "Expected \"ascii\" \"text\" \"bin\" or \"binary\"\n");
+                print_error( "Expected \"ascii\" \"text\" \"bin\" \"binary\" \"framed\" or \"columnar\"\n");
+                loadfail();
+            }
+        //
+        // The SERVICE parameter
+        //
+        }else if(streq(param, "service")){
+            if(lcm_get_value(lcm_service, value, &itemp)){
+                print_error( "LOAD: Unrecognized service mode: %s\n", value);
+                print_error( "Expected \"poll\" or \"callback\"\n");
+                loadfail();
+            }
+            dconf[devnum].service = (lc_service_t) itemp;
+        //
+        // The RINGBUFFER parameter
+        //
+        }else if(streq(param, "ringbuffer")){
+            if(lcm_get_value(lcm_ringbuffer, value, &itemp)){
+                print_error( "LOAD: Unrecognized ring buffer mode: %s\n", value);
+                print_error( "Expected \"block\" or \"mirror\"\n");
                 loadfail();
             }
+            dconf[devnum].ringbuffer = (lc_ringmode_t) itemp;
         //
         // The AICHANNEL parameter
         //
@@ -1437,6 +1560,30 @@ even channels they serve.  (e.g. AI0/AI1)\n", itemp, dconf[devnum].aich[ainum].c
 }
 
 
+int lc_load(lc_devconf_t* dconf, const unsigned int devmax, const char* filename){
+    FILE* ff;
+
+    ff = fopen(filename, "r");
+    if(ff==NULL){
+        print_error( "LOAD: Failed to open the configuration file \"%s\".\n",filename);
+        return LC_ERROR;
+    }
+    return load_file(dconf, devmax, ff, filename);
+}
+
+
+int lc_load_string(lc_devconf_t* dconf, const unsigned int devmax, const char* text){
+    FILE* ff;
+
+    ff = fmemopen((void*) text, strlen(text), "r");
+    if(ff==NULL){
+        print_error( "LOAD: Failed to read the configuration from memory.\n");
+        return LC_ERROR;
+    }
+    return load_file(dconf, devmax, ff, "(memory)");
+}
+
+
 
 
 void lc_write(lc_devconf_t* dconf, FILE* ff){
@@ -1462,11 +1609,16 @@ void lc_write(lc_devconf_t* dconf, FILE* ff){
     write_str(subnet,subnet);
     write_flt(samplehz,samplehz);
     write_flt(settleus,settleus);
+    write_flt(latencyms,latencyms);
     write_int(nsample,nsample);
     write_int(downsample,downsample);
     
     fprintf(ff, "dataformat %s\n", 
             lcm_get_config(lcm_dataformat, dconf->dataformat));
+    fprintf(ff, "service %s\n", 
+            lcm_get_config(lcm_service, dconf->service));
+    fprintf(ff, "ringbuffer %s\n", 
+            lcm_get_config(lcm_ringbuffer, dconf->ringbuffer));
     // Analog inputs
     if(dconf->naich)
         fprintf(ff,"\n# Analog Inputs\n");
@@ -1769,6 +1921,11 @@ int lc_clean(lc_devconf_t* dconf){
     int ainum;
     // Clean the ring buffer
     clean_buffer(&dconf->RB);
+    if(dconf->RB.efd >= 0){
+        close(dconf->RB.efd);
+        dconf->RB.efd = -1;
+    }
+    pthread_mutex_destroy(&dconf->RB.lock);
     // Clean analog input filters (if configured)
     for(ainum=0; ainum<dconf->naich; ainum++){
         tf_destruct(&dconf->aich[ainum].filter);
@@ -2567,6 +2724,13 @@ void lc_show(lc_devconf_t* dconf){
                 "Settling Time", dconf->settleus);
         printf(SHOW_PARAM LC_FONT_BOLD "%d\n" LC_FONT_NULL, 
                 "Samples", dconf->nsample);
+        printf(SHOW_PARAM LC_FONT_BOLD "%s\n" LC_FONT_NULL, 
+                "Service", lcm_get_message(lcm_service, dconf->service));
+        printf(SHOW_PARAM LC_FONT_BOLD "%s\n" LC_FONT_NULL, 
+                "Ring Buffer", lcm_get_message(lcm_ringbuffer, dconf->ringbuffer));
+        if(dconf->latencyms > 0)
+            printf(SHOW_PARAM LC_FONT_BOLD "%.1f" LC_FONT_NULL "ms\n", 
+                    "Latency Target", dconf->latencyms);
     }
     for(ainum=0;ainum<dconf->naich;ainum++){
         printf(" -> Analog Input [" LC_FONT_BOLD "%d" LC_FONT_NULL "] (%s) <-\n",
@@ -3353,10 +3517,11 @@ int lc_meta_put_str(lc_devconf_t* dconf, const char* param, char* value){
 
 
 void lc_stream_status(lc_devconf_t* dconf,
-        unsigned int *samples_streamed, unsigned int *samples_read,
+        uint64_t *samples_streamed, uint64_t *samples_read,
         unsigned int *samples_waiting){
 
     if(dconf->RB.buffer){
+        lock_buffer(&dconf->RB);
         *samples_streamed = dconf->RB.samples_streamed;
         *samples_read = dconf->RB.samples_read;
         // Case out the read and write status
@@ -3370,25 +3535,139 @@ void lc_stream_status(lc_devconf_t* dconf,
         else
             *samples_waiting = (dconf->RB.write-dconf->RB.read)/\
                 dconf->RB.channels;
+        unlock_buffer(&dconf->RB);
     }
 }
 
 
 
+int lc_stream_clock(lc_devconf_t* dconf, double *seconds, double *scans){
+    int err = LC_ERROR;
+
+    if(dconf->RB.buffer){
+        lock_buffer(&dconf->RB);
+        if(dconf->RB.blocks_streamed){
+            *seconds = (dconf->RB.stamp.tv_sec - dconf->RB.start.tv_sec) + \
+                    1e-9 * (dconf->RB.stamp.tv_nsec - dconf->RB.start.tv_nsec);
+            *scans = (double) dconf->RB.blocks_streamed * dconf->RB.samples_per_read \
+                    + dconf->RB.backlog;
+            err = LC_NOERR;
+        }
+        unlock_buffer(&dconf->RB);
+    }
+    return err;
+}
+
+
 int lc_stream_iscomplete(lc_devconf_t* dconf){
-    return (dconf->RB.samples_streamed > dconf->nsample);
+    int out;
+    lock_buffer(&dconf->RB);
+    out = (dconf->RB.samples_streamed > dconf->nsample);
+    unlock_buffer(&dconf->RB);
+    return out;
+}
+
+
+int lc_stream_trigstate(lc_devconf_t* dconf){
+    int out;
+    lock_buffer(&dconf->RB);
+    out = dconf->trigstate;
+    unlock_buffer(&dconf->RB);
+    return out;
 }
 
 
 int lc_stream_isempty(lc_devconf_t* dconf){
-    return isempty_buffer(&dconf->RB);
+    int out;
+    lock_buffer(&dconf->RB);
+    out = isempty_buffer(&dconf->RB);
+    unlock_buffer(&dconf->RB);
+    return out;
 }
 
 int lc_stream_isfull(lc_devconf_t* dconf){
-    return isfull_buffer(&dconf->RB);
+    int out;
+    lock_buffer(&dconf->RB);
+    out = isfull_buffer(&dconf->RB);
+    unlock_buffer(&dconf->RB);
+    return out;
+}
+
+int lc_stream_fd(lc_devconf_t* dconf){
+    return dconf->RB.efd;
 }
 
 
+// The LJM stream callback is defined below with lc_stream_service()
+void stream_callback(void *arg);
+
+
+int lc_stream_autotune(lc_devconf_t* dconf){
+    double spr, spr_min, scan_us, budget_us;
+    int channels;
+
+    if(dconf->latencyms <= 0 || dconf->samplehz <= 0)
+        return LC_SAMPLES_PER_READ;
+
+    lock_buffer(&dconf->RB);
+    scan_us = dconf->RB.scan_us;
+    unlock_buffer(&dconf->RB);
+    channels = lc_nistream(dconf);
+    if(channels < 1)
+        channels = 1;
+    // The latency target determines the largest block we can accept
+    spr = dconf->samplehz * dconf->latencyms * 1e-3;
+    // but the blocks have to be long enough that reading them does not
+    // dominate the block period.  Each scan adds SCAN_US to the read, and 
+    // the block period grows by 1/SAMPLEHZ, so only the fixed part of the
+    // cost is paid for by making the blocks longer.
+    budget_us = LC_SERVICE_DUTY * 1e6 / dconf->samplehz;
+    if(scan_us < 0)
+        spr_min = dconf->samplehz * LC_SERVICE_COST_US * 1e-6 / LC_SERVICE_DUTY;
+    else if(scan_us < budget_us)
+        spr_min = LC_SERVICE_FIXED_US / (budget_us - scan_us);
+    else
+        spr_min = LC_MAX_BLOCK_SAMPLES;
+    if(spr < spr_min)
+        spr = spr_min;
+    if(spr * channels > LC_MAX_BLOCK_SAMPLES)
+        spr = LC_MAX_BLOCK_SAMPLES / channels;
+    // Round to a multiple of 8 scans so small changes in the measured cost
+    // do not produce a new recommendation.
+    if(spr >= 16)
+        spr = 8 * floor(spr / 8);
+    else if(spr < 1)
+        spr = 1;
+    return (int) spr;
+}
+
+
+int lc_stream_retune(lc_devconf_t* dconf){
+    int spr, current;
+    struct timespec now;
+
+    if(dconf->latencyms <= 0 || dconf->trigchannel >= 0 || !dconf->RB.buffer)
+        return LC_NOERR;
+    // Give the new block size time to be measured before judging it
+    clock_gettime(CLOCK_REALTIME, &now);
+    if((now.tv_sec - dconf->RB.start.tv_sec) + 
+            1e-9 * (now.tv_nsec - dconf->RB.start.tv_nsec) < LC_RETUNE_SEC)
+        return LC_NOERR;
+    spr = lc_stream_autotune(dconf);
+    current = dconf->RB.samples_per_read;
+    // Is the change worth a restart?
+    if(spr < current * LC_RETUNE_RATIO && current < spr * LC_RETUNE_RATIO)
+        return LC_NOERR;
+    // Never throw away data
+    if(!lc_stream_isempty(dconf))
+        return LC_NOERR;
+    if(lc_stream_stop(dconf) || lc_stream_start(dconf, spr)){
+        print_error("STREAM_RETUNE: Failed to restart the stream with %d samples per read.\n", spr);
+        return LC_ERROR;
+    }
+    return LC_NOERR;
+}
+
 int lc_stream_start(lc_devconf_t* dconf, int samples_per_read){
     int ainum,
         aonum,
@@ -3403,7 +3682,7 @@ int lc_stream_start(lc_devconf_t* dconf, int samples_per_read){
 
     // If the application specifies samples, it overrides the default.
     if(samples_per_read <= 0)
-        samples_per_read = LC_SAMPLES_PER_READ;
+        samples_per_read = lc_stream_autotune(dconf);
 
     // Configure the LJM library for safe timeout mode
     // In this mode, the eStreamRead function will not hang.
@@ -3508,11 +3787,23 @@ int lc_stream_start(lc_devconf_t* dconf, int samples_per_read){
     if(init_buffer(&dconf->RB, 
                 lc_nistream(dconf),
                 samples_per_read,
-                blocks)){
+                blocks,
+                dconf->ringbuffer == LC_RING_MIRROR)){
         print_error("STREAM_START: Failed to initialize the buffer.\n");
         return LC_ERROR;
     }
 
+    // In callback mode, the application is woken through an eventfd.  
+    // Creating it also turns on the ring buffer lock.  It is kept across 
+    // restarts so applications waiting on it do not need to know.
+    if(dconf->service == LC_SERVICE_CALLBACK && dconf->RB.efd < 0){
+        dconf->RB.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(dconf->RB.efd < 0){
+            print_error("STREAM_START: Failed to create the callback eventfd.\n");
+            return LC_ERROR;
+        }
+    }
+
     // Initialize the trigger
     dconf->trigmem = 0;
     if(dconf->trigchannel >= 0)
@@ -3529,21 +3820,40 @@ int lc_stream_start(lc_devconf_t* dconf, int samples_per_read){
         print_error("STREAM_START: Failed to start the stream.\n");
         startfail();
     }
+    // Time stamp the first scan so streams from separate devices (or 
+    // hosts) can be lined up later.
+    clock_gettime(CLOCK_REALTIME, &dconf->RB.start);
+
+    // Hand the transfers over to LJM's thread
+    if(dconf->service == LC_SERVICE_CALLBACK){
+        err = LJM_SetStreamCallback(dconf->handle, stream_callback, dconf);
+        if(err){
+            print_error("STREAM_START: Failed to register the stream callback.\n");
+            LJM_eStreamStop(dconf->handle);
+            startfail();
+        }
+    }
     return LC_NOERR;
 }
 
 
-int lc_stream_service(lc_devconf_t* dconf){
+// Transfer a block from LJM into the ring buffer and tend the trigger.
+// This is the body of lc_stream_service() in polling mode, and it is called
+// by stream_callback() in callback mode.
+int transfer_stream(lc_devconf_t* dconf){
     int dev_backlog, ljm_backlog, size, err;
     int index, this;
-    double *write_data;
+    double *write_data, cost_us, scan_us;
+    struct timespec start, stop;
 
     // Retrieve the write buffer pointer
     write_data = get_write_buffer(&dconf->RB);
     // Perform the data transfer
+    clock_gettime(CLOCK_MONOTONIC, &start);
     err = LJM_eStreamRead(dconf->handle, 
             write_data,
             &dev_backlog, &ljm_backlog);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
     
     if(err == LJME_NO_SCANS_RETURNED){
         // Do nothing
@@ -3552,8 +3862,25 @@ int lc_stream_service(lc_devconf_t* dconf){
         LJM_ErrorToString(err, err_str);
         print_error("%s\n", err_str);
         return LC_ERROR;
-    }else
+    }else{
         service_write_buffer(&dconf->RB);
+        dconf->RB.backlog = ljm_backlog > 0 ? ljm_backlog : 0;
+        clock_gettime(CLOCK_REALTIME, &dconf->RB.stamp);
+        // Keep a running average of the read time for lc_stream_autotune()
+        cost_us = (stop.tv_sec - start.tv_sec) * 1e6 + \
+                (stop.tv_nsec - start.tv_nsec) * 1e-3;
+        if(dconf->RB.service_us < 0)
+            dconf->RB.service_us = cost_us;
+        else
+            dconf->RB.service_us += 0.1 * (cost_us - dconf->RB.service_us);
+        // ... and of the part that grows with the block
+        scan_us = (cost_us - LC_SERVICE_FIXED_US) / dconf->RB.samples_per_read;
+        scan_us = scan_us > 0 ? scan_us : 0.;
+        if(dconf->RB.scan_us < 0)
+            dconf->RB.scan_us = scan_us;
+        else
+            dconf->RB.scan_us += 0.1 * (scan_us - dconf->RB.scan_us);
+    }
     
 /*
     if(dev_backlog > LC_BACKLOG_THRESHOLD)
@@ -3638,7 +3965,7 @@ int lc_stream_service(lc_devconf_t* dconf){
             // a sample block and reduce the record of samples streamed
             if(!err && dconf->trigstate == LC_TRIG_ARMED){
                 service_read_buffer(&dconf->RB);
-                dconf->RB.samples_streamed = dconf->RB.samples_per_read > dconf->RB.samples_streamed ? \
+                dconf->RB.samples_streamed = dconf->RB.samples_streamed > dconf->RB.samples_per_read ? \
                         dconf->RB.samples_streamed - dconf->RB.samples_per_read : 0;
             }
         }
@@ -3650,14 +3977,80 @@ int lc_stream_service(lc_devconf_t* dconf){
 }
 
 
+// LJM calls this from its own thread each time a block of SAMPLES_PER_READ
+// scans is ready.  Errors are stored for lc_stream_service() to report, 
+// since there is nobody to return them to here.
+void stream_callback(void *arg){
+    lc_devconf_t *dconf = (lc_devconf_t*) arg;
+    uint64_t one = 1;
+    
+    lock_buffer(&dconf->RB);
+    if(transfer_stream(dconf))
+        dconf->RB.error = LC_ERROR;
+    unlock_buffer(&dconf->RB);
+    // Wake the application.  If the counter is somehow saturated, a wake-up
+    // is already pending, so there is nothing to do on failure.
+    if(write(dconf->RB.efd, &one, sizeof(one)) < 0){}
+}
+
+
+int lc_stream_service(lc_devconf_t* dconf){
+    // In callback mode, the transfer has already happened in LJM's thread
+    if(dconf->RB.efd >= 0)
+        return dconf->RB.error;
+    return transfer_stream(dconf);
+}
+
+
+int lc_stream_wait(lc_devconf_t* dconf, int timeout_ms){
+    struct pollfd pfd;
+    struct timeval start, now;
+    uint64_t count;
+    uint64_t blocks;
+    long int retry_us;
+
+    if(dconf->RB.efd >= 0){
+        pfd.fd = dconf->RB.efd;
+        pfd.events = POLLIN;
+        // Clear the eventfd counter if it fired
+        if(poll(&pfd, 1, timeout_ms) > 0 && \
+                read(dconf->RB.efd, &count, sizeof(count)) < 0){}
+        return dconf->RB.error;
+    }
+
+    // In polling mode, retry at 1/8 of the block period, but not faster 
+    // than every 100us.
+    retry_us = 100;
+    if(dconf->samplehz > 0 && 
+            1e6 * dconf->RB.samples_per_read / dconf->samplehz / 8 > retry_us)
+        retry_us = (long int)(1e6 * dconf->RB.samples_per_read / dconf->samplehz / 8);
+
+    blocks = dconf->RB.blocks_streamed;
+    gettimeofday(&start, NULL);
+    while(1){
+        if(transfer_stream(dconf))
+            return LC_ERROR;
+        if(dconf->RB.blocks_streamed != blocks)
+            return LC_NOERR;
+        gettimeofday(&now, NULL);
+        if(timeout_ms >= 0 && (now.tv_sec - start.tv_sec) * 1000 + \
+                (now.tv_usec - start.tv_usec) / 1000 >= timeout_ms)
+            return LC_NOERR;
+        usleep(retry_us);
+    }
+}
+
+
 int lc_stream_read(lc_devconf_t* dconf,
         double **data, unsigned int *channels, unsigned int *samples_per_read){
     
     // Deal with the read buffer
+    lock_buffer(&dconf->RB);
     *data = get_read_buffer(&dconf->RB);
     service_read_buffer(&dconf->RB);
     *samples_per_read = dconf->RB.samples_per_read;
     *channels = dconf->RB.channels;
+    unlock_buffer(&dconf->RB);
     
     if(data)
         return LC_NOERR;
@@ -3665,6 +4058,106 @@ int lc_stream_read(lc_devconf_t* dconf,
 }
 
 
+int lc_stream_read_bulk(lc_devconf_t* dconf,
+        double **data, unsigned int *channels, unsigned int *samples){
+    lc_ringbuf_t *RB = &dconf->RB;
+    unsigned int start, stop;
+
+    *data = NULL;
+    *samples = 0;
+    lock_buffer(RB);
+    *channels = RB->channels;
+    if(RB->buffer && !isempty_buffer(RB)){
+        // When the buffer is full, the oldest data are at the write index
+        start = isfull_buffer(RB) ? RB->write : RB->read;
+        // With a mirrored buffer, everything waiting is contiguous.
+        if(RB->mirror)
+            stop = start + (isfull_buffer(RB) ? RB->size_samples : 
+                    (RB->write + RB->size_samples - start) % RB->size_samples);
+        // Otherwise, the span runs to the write index unless it wraps 
+        // first.  Blocks always tile the buffer exactly, so the wrap is at 
+        // size_samples.
+        else
+            stop = RB->write > start ? RB->write : RB->size_samples;
+        *data = &RB->buffer[start];
+        *samples = (stop - start) / RB->channels;
+    }
+    unlock_buffer(RB);
+
+    if(*data)
+        return LC_NOERR;
+    return LC_ERROR;
+}
+
+
+int lc_stream_peek(lc_devconf_t* dconf, int channel, unsigned int decimate,
+        double *dest, unsigned int *samples){
+    lc_ringbuf_t *RB = &dconf->RB;
+    unsigned int available, count, index, stride, ii;
+
+    if(decimate < 1)
+        decimate = 1;
+    lock_buffer(RB);
+    if(!RB->buffer || channel >= (int) RB->channels){
+        unlock_buffer(RB);
+        *samples = 0;
+        return LC_ERROR;
+    }
+    // Every scan that has been written and not yet overwritten is fair game,
+    // whether or not it has been read.
+    available = RB->size_samples / RB->channels;
+    if(RB->blocks_streamed * RB->samples_per_read < available)
+        available = RB->blocks_streamed * RB->samples_per_read;
+    // Count back from the newest scan in steps of DECIMATE
+    count = (available + decimate - 1) / decimate;
+    if(count > *samples)
+        count = *samples;
+    *samples = count;
+    if(count == 0){
+        unlock_buffer(RB);
+        return LC_NOERR;
+    }
+    // Index of the oldest scan to be copied
+    index = (RB->write + RB->size_samples - 
+            (1 + (count-1)*decimate) * RB->channels) % RB->size_samples;
+    // A mirrored buffer lets the whole span go in one copy
+    if(RB->mirror && decimate == 1 && channel < 0){
+        memcpy(dest, &RB->buffer[index], count * RB->channels * sizeof(double));
+    }else{
+        stride = decimate * RB->channels;
+        for(ii=0; ii<count; ii++){
+            if(channel >= 0)
+                dest[ii] = RB->buffer[index + channel];
+            else
+                memcpy(&dest[ii * RB->channels], &RB->buffer[index], 
+                        RB->channels * sizeof(double));
+            // Scans never straddle the end of the buffer
+            index += stride;
+            if(index >= RB->size_samples)
+                index -= RB->size_samples;
+        }
+    }
+    unlock_buffer(RB);
+    return LC_NOERR;
+}
+
+
+int lc_stream_release_bulk(lc_devconf_t* dconf, unsigned int samples){
+    unsigned int blocks;
+
+    if(!dconf->RB.samples_per_read || samples % dconf->RB.samples_per_read){
+        print_error("STREAM_RELEASE_BULK: %d samples is not a whole number of blocks.\n", samples);
+        return LC_ERROR;
+    }
+    lock_buffer(&dconf->RB);
+    for(blocks = samples / dconf->RB.samples_per_read; 
+            blocks > 0 && !isempty_buffer(&dconf->RB); blocks--)
+        service_read_buffer(&dconf->RB);
+    unlock_buffer(&dconf->RB);
+    return LC_NOERR;
+}
+
+
 
 int lc_stream_downsample(lc_devconf_t *dconf, double *data, 
         const unsigned int channels,
@@ -3693,10 +4186,10 @@ int lc_stream_downsample(lc_devconf_t *dconf, double *data,
     // We'll forward shift data to overwrite the earliest samples with the 
     // selected later samples.  index will be the forward location and index2
     // will be the later (source) location.
-    // The first sample to be retained will be shifted by the DSCOUNT, which
-    // represents the samples remaining from the last data block.
+    // The last scan of every DOWNSAMPLE+1 is kept.  DSCOUNT is the number 
+    // of scans left over from the last data block.
     index = 0;
-    index2 = (dconf->downsample + 1 - dconf->dscount) * channels;
+    index2 = (dconf->downsample - dconf->dscount) * channels;
     stop = (*samples_per_read) * channels;
     increment = (dconf->downsample+1) * channels;
     for(;index2<stop; index2+=increment){
@@ -3709,7 +4202,7 @@ int lc_stream_downsample(lc_devconf_t *dconf, double *data,
     dconf->dscount = (dconf->dscount + *samples_per_read) % (dconf->downsample+1);
 
     // Modify the samples_per_read to match the number of samples selected
-    *samples_per_read = (dconf->dscount + *samples_per_read) / (dconf->downsample+1);
+    *samples_per_read = index / channels;
     
     return LC_NOERR;
 }
@@ -3734,6 +4227,18 @@ int lc_stream_stop(lc_devconf_t* dconf){
 }
 
 
+// Start the frame count for a new file whose header ends at FF's position
+void start_framer(lc_devconf_t *dconf, FILE *FF, uint64_t scan){
+    long offset;
+    memset(&dconf->framer, 0, sizeof(lc_framer_t));
+    dconf->framer.scan = scan;
+    dconf->framer.index_scan = scan;
+    // Pipes can't tell their position; they are never indexed anyway
+    offset = ftell(FF);
+    dconf->framer.offset = offset < 0 ? 0 : offset;
+}
+
+
 int lc_datafile_init(lc_devconf_t* dconf, FILE* FF){
     time_t now;
 
@@ -3742,33 +4247,60 @@ int lc_datafile_init(lc_devconf_t* dconf, FILE* FF){
     // Log the time
     time(&now);
     fprintf(FF, "#: %s", ctime(&now));
+    start_framer(dconf, FF, 0);
+    return LC_NOERR;
+}
+
 
+int lc_datafile_segment(lc_devconf_t* dconf, FILE* FF, unsigned int segment,
+        uint64_t scan){
+    time_t now;
+
+    lc_write(dconf,FF);
+    // The segment line comes before the timestamp, so it is skipped by 
+    // loaders that look for the timestamp to find the data.
+    fprintf(FF, "#segment %u %llu\n", segment, (unsigned long long) scan);
+    time(&now);
+    fprintf(FF, "#: %s", ctime(&now));
+    start_framer(dconf, FF, scan);
     return LC_NOERR;
 }
 
 
 
 
+// The LC_EMIT_T for stdio files
+int emit_file(void *arg, const void *bytes, size_t count){
+    if(fwrite(bytes, 1, count, (FILE*) arg) != count)
+        return LC_ERROR;
+    return LC_NOERR;
+}
+
+
 int lc_datafile_write(lc_devconf_t *dconf, FILE* FF, double *data, 
             unsigned int channels, unsigned int samples_per_read){
-    int index, row, col;
-    float ftemp;    // Used to convert double to single for binary write
-    double value;
-    char flag;
+    int index, row, col, ii;
+    float fbuffer[LC_WRITE_CHUNK];  // Used to convert double to single for binary write
 
     // Verify that there are data to work with
     if(!data)
         return LC_ERROR;
 
     // Case out binary versus ASCII data formats
-    if(dconf->dataformat == LC_DF_BIN){
+    if(dconf->dataformat == LC_DF_FRAMED || dconf->dataformat == LC_DF_COLUMNAR){
+        return lc_frame_write(dconf, data, channels, samples_per_read, 
+                emit_file, FF);
+    }else if(dconf->dataformat == LC_DF_BIN){
         // borrow col to represent the number of samples
         col = channels*samples_per_read;
-        // Convert each of the doubles into a single and write it to the file
-        // No need to track columns and rows
-        for(index=0; index<col; index++){
-            ftemp = (float) data[index];
-            fwrite(&ftemp, sizeof(ftemp), 1, FF);
+        // Convert the doubles to singles a chunk at a time so that long 
+        // spans from lc_stream_read_bulk() go out in a few large writes.
+        // No need to track columns and rows; borrow row for the chunk size
+        for(index=0; index<col; index+=row){
+            row = col - index < LC_WRITE_CHUNK ? col - index : LC_WRITE_CHUNK;
+            for(ii=0; ii<row; ii++)
+                fbuffer[ii] = (float) data[index + ii];
+            fwrite(fbuffer, sizeof(float), row, FF);
         }
     }else{
         index = 0;
@@ -3782,4 +4314,239 @@ int lc_datafile_write(lc_devconf_t *dconf, FILE* FF, double *data,
 }
 
 
+int lc_datafile_checkpoint(lc_devconf_t *dconf, FILE *FF){
+    if(dconf->dataformat != LC_DF_FRAMED && dconf->dataformat != LC_DF_COLUMNAR)
+        return LC_NOERR;
+    return lc_frame_checkpoint(dconf, emit_file, FF);
+}
+
+
+// Add the data frame that was just written to the index.  LENGTH is the 
+// frame's header and payload, and SAMPLES is the number of scans in it.
+int index_frame(lc_devconf_t *dconf, uint32_t length, unsigned int samples,
+        lc_emit_t emit, void *arg){
+    lc_framer_t *framer = &dconf->framer;
+
+    if(framer->nindex == 0)
+        framer->index_scan = framer->scan;
+    framer->index[framer->nindex++] = framer->offset;
+    framer->offset += length + sizeof(lc_frame_end_t);
+    framer->seq ++;
+    framer->scan += samples;
+    if(framer->nindex >= LC_FRAME_NINDEX)
+        return lc_frame_checkpoint(dconf, emit, arg);
+    return LC_NOERR;
+}
+
+
+// Write the scans collected in a columnar file's chunk as one frame
+int write_chunk(lc_devconf_t *dconf, lc_emit_t emit, void *arg){
+    lc_framer_t *framer = &dconf->framer;
+    lc_frame_t frame;
+    lc_frame_end_t end;
+    unsigned int ch, samples = framer->chunk_fill;
+    size_t run = samples * sizeof(float);
+
+    memset(&frame, 0, sizeof(frame));
+    frame.magic = LC_FRAME_MAGIC;
+    frame.type = LC_FRAME_COLUMNS;
+    frame.seq = framer->seq;
+    frame.scan = framer->scan;
+    frame.channels = framer->chunk_channels;
+    frame.samples = samples;
+    frame.bytes = run * framer->chunk_channels;
+    end.crc = lc_crc32c(0, &frame, sizeof(frame));
+    if(emit(arg, &frame, sizeof(frame)))
+        return LC_ERROR;
+    // A partial chunk leaves gaps between the runs
+    for(ch=0; ch<framer->chunk_channels; ch++){
+        end.crc = lc_crc32c(end.crc, &framer->chunk[ch * LC_COLUMN_SCANS], run);
+        if(emit(arg, &framer->chunk[ch * LC_COLUMN_SCANS], run))
+            return LC_ERROR;
+    }
+    end.length = sizeof(frame) + frame.bytes;
+    if(emit(arg, &end, sizeof(end)))
+        return LC_ERROR;
+    framer->chunk_fill = 0;
+    return index_frame(dconf, end.length, samples, emit, arg);
+}
+
+
+// Transpose scans into a columnar file's chunk, writing it each time it fills
+int write_columns(lc_devconf_t *dconf, const double *data, unsigned int channels,
+        unsigned int samples, lc_emit_t emit, void *arg){
+    lc_framer_t *framer = &dconf->framer;
+    unsigned int ii, ch, count;
+    float *run;
+
+    // The channel count should never change, but don't mix them if it does
+    if(framer->chunk_fill && framer->chunk_channels != channels
+            && write_chunk(dconf, emit, arg))
+        return LC_ERROR;
+    while(samples){
+        // Checkpoints free the chunk, so it is allocated as needed
+        if(framer->chunk == NULL || framer->chunk_channels != channels){
+            free(framer->chunk);
+            framer->chunk = malloc((size_t) channels * LC_COLUMN_SCANS * sizeof(float));
+            if(framer->chunk == NULL){
+                print_error("LC_DATAFILE_WRITE: Failed to allocate the columnar chunk buffer.\n");
+                return LC_ERROR;
+            }
+            framer->chunk_channels = channels;
+            framer->chunk_fill = 0;
+        }
+        count = LC_COLUMN_SCANS - framer->chunk_fill;
+        if(count > samples)
+            count = samples;
+        for(ch=0; ch<channels; ch++){
+            run = &framer->chunk[ch * LC_COLUMN_SCANS + framer->chunk_fill];
+            for(ii=0; ii<count; ii++)
+                run[ii] = (float) data[(size_t) ii * channels + ch];
+        }
+        data += (size_t) count * channels;
+        samples -= count;
+        framer->chunk_fill += count;
+        if(framer->chunk_fill == LC_COLUMN_SCANS && write_chunk(dconf, emit, arg))
+            return LC_ERROR;
+    }
+    return LC_NOERR;
+}
+
+
+int lc_frame_write(lc_devconf_t *dconf, const double *data, unsigned int channels,
+        unsigned int samples, lc_emit_t emit, void *arg){
+    lc_framer_t *framer = &dconf->framer;
+    lc_frame_t frame;
+    lc_frame_end_t end;
+    float fbuffer[LC_WRITE_CHUNK];
+    size_t index, total, count, ii;
+
+    if(samples == 0)
+        return LC_NOERR;
+    if(dconf->dataformat == LC_DF_COLUMNAR)
+        return write_columns(dconf, data, channels, samples, emit, arg);
+    total = (size_t) channels * samples;
+    memset(&frame, 0, sizeof(frame));
+    frame.magic = LC_FRAME_MAGIC;
+    frame.type = LC_FRAME_DATA;
+    frame.seq = framer->seq;
+    frame.scan = framer->scan;
+    frame.channels = channels;
+    frame.samples = samples;
+    frame.bytes = total * sizeof(float);
+    // The checksum is built up as the chunks are converted, so the data are
+    // only touched once.
+    end.crc = lc_crc32c(0, &frame, sizeof(frame));
+    if(emit(arg, &frame, sizeof(frame)))
+        return LC_ERROR;
+    for(index=0; index<total; index+=count){
+        count = total - index < LC_WRITE_CHUNK ? total - index : LC_WRITE_CHUNK;
+        for(ii=0; ii<count; ii++)
+            fbuffer[ii] = (float) data[index + ii];
+        end.crc = lc_crc32c(end.crc, fbuffer, count*sizeof(float));
+        if(emit(arg, fbuffer, count*sizeof(float)))
+            return LC_ERROR;
+    }
+    end.length = sizeof(frame) + frame.bytes;
+    if(emit(arg, &end, sizeof(end)))
+        return LC_ERROR;
+    return index_frame(dconf, end.length, samples, emit, arg);
+}
+
+
+int lc_frame_checkpoint(lc_devconf_t *dconf, lc_emit_t emit, void *arg){
+    lc_framer_t *framer = &dconf->framer;
+    lc_frame_t frame;
+    lc_frame_end_t end;
+
+    // The partial chunk of a columnar file goes out first
+    if(framer->chunk){
+        if(framer->chunk_fill && write_chunk(dconf, emit, arg))
+            return LC_ERROR;
+        free(framer->chunk);
+        framer->chunk = NULL;
+        framer->chunk_fill = 0;
+    }
+    if(framer->nindex == 0)
+        return LC_NOERR;
+    memset(&frame, 0, sizeof(frame));
+    frame.magic = LC_FRAME_MAGIC;
+    frame.type = LC_FRAME_INDEX;
+    frame.seq = framer->seq - framer->nindex;
+    frame.scan = framer->index_scan;
+    frame.samples = framer->nindex;
+    frame.bytes = (framer->nindex + 1) * sizeof(uint64_t);
+    // The previous checkpoint goes in the last slot
+    framer->index[framer->nindex] = framer->last_index;
+    end.crc = lc_crc32c(0, &frame, sizeof(frame));
+    end.crc = lc_crc32c(end.crc, framer->index, frame.bytes);
+    end.length = sizeof(frame) + frame.bytes;
+    if(emit(arg, &frame, sizeof(frame)) 
+            || emit(arg, framer->index, frame.bytes)
+            || emit(arg, &end, sizeof(end)))
+        return LC_ERROR;
+    framer->last_index = framer->offset;
+    framer->offset += end.length + sizeof(end);
+    framer->nindex = 0;
+    return LC_NOERR;
+}
+
+
+// CRC32C (Castagnoli), reflected polynomial
+#define CRC32C_POLY 0x82f63b78U
+uint32_t crc32c_table[256];
+pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+void crc32c_build(void){
+    uint32_t crc;
+    int ii, jj;
+    for(ii=0; ii<256; ii++){
+        crc = ii;
+        for(jj=0; jj<8; jj++)
+            crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY : 0);
+        crc32c_table[ii] = crc;
+    }
+}
+
+uint32_t crc32c_table_eval(uint32_t crc, const unsigned char *data, size_t bytes){
+    pthread_once(&crc32c_once, crc32c_build);
+    while(bytes--)
+        crc = crc32c_table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+// The SSE4.2 CRC32 instruction computes exactly this checksum 8 bytes at a 
+// time.  It is compiled for SSE4.2 regardless of the build flags and only
+// called when the processor says it has it.
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42_eval(uint32_t crc, const unsigned char *data, size_t bytes){
+    uint64_t crc64;
+    uint64_t word;
+    while(bytes && ((uintptr_t) data & 7)){
+        crc = __builtin_ia32_crc32qi(crc, *data++);
+        bytes--;
+    }
+    crc64 = crc;
+    for(; bytes >= 8; bytes -= 8, data += 8){
+        memcpy(&word, data, 8);
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+    }
+    crc = (uint32_t) crc64;
+    while(bytes--)
+        crc = __builtin_ia32_crc32qi(crc, *data++);
+    return crc;
+}
+#endif
+
+uint32_t lc_crc32c(uint32_t crc, const void *data, size_t bytes){
+    crc = ~crc;
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    if(__builtin_cpu_supports("sse4.2"))
+        return ~crc32c_sse42_eval(crc, data, bytes);
+#endif
+    return ~crc32c_table_eval(crc, data, bytes);
+}
+
+
 
@@ -34,11 +34,14 @@ $chmod a+x your_exec.bin
 #define __LCONFIG
 
 #include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdint.h>
 #include <LabJackM.h>
 #include "lcfilter.h"
 
 
-#define LC_VERSION 5.01   // Track modifications in the header
+#define LC_VERSION 5.02   // Track modifications in the header
 /*
 These change logs follow the convention below:
 **LC_VERSION
@@ -228,6 +231,50 @@ with init_data_file() and write_data_file() utilities.
 - Added lcfilter.c and lcfilter.h to support the digital downsample filtering.
 - Added LC_STREAM_DOWNSAMPLE() to implement downsampling
 - Added LC_DOWNSAMPLEHZ() to calculate effective stream rate after downsampling.
+
+** 5.02
+10/2026
+- Added BLOCKS_STREAMED and BACKLOG to the ring buffer so applications can
+  tell when LC_STREAM_SERVICE() transferred a block and how many scans LJM
+  is still holding.  These support the LCT_LOOP_T event loop in lctools.h.
+- Added the SERVICE parameter.  In "callback" mode, LJM's stream callback
+  transfers data into the ring buffer from its own thread, and the 
+  application is woken through an eventfd.  The ring buffer is now guarded
+  by a mutex when callbacks are in use.
+- Added LC_STREAM_FD() and LC_STREAM_WAIT().
+- Added the LATENCYMS parameter.  When it is set and the application passes
+  SAMPLES_PER_READ <= 0, LC_STREAM_START() chooses the block size from the
+  sample rate, the stream channel count, and the measured LJM read cost.
+- Added LC_STREAM_AUTOTUNE() and LC_STREAM_RETUNE().
+- Added LC_STREAM_READ_BULK() and LC_STREAM_RELEASE_BULK() to process all
+  contiguous blocks waiting in the buffer at once.
+- LC_DATAFILE_WRITE() converts binary data in chunks instead of writing 
+  one value at a time.
+- Added the RINGBUFFER parameter.  With "mirror", the ring buffer is mapped 
+  twice back-to-back in virtual memory when possible, so 
+  LC_STREAM_READ_BULK() returns everything waiting in one span.
+- Added LC_STREAM_PEEK() to copy the latest data without consuming them.
+- Added LC_LOAD_STRING() to parse configurations held in memory.
+- The ring buffer records the wall clock time when the stream started.
+- The ring buffer records the wall clock time of the latest transfer, and
+  LC_STREAM_CLOCK() reports it with the number of scans acquired by then.
+- The ring buffer's SAMPLES_READ, SAMPLES_STREAMED, and BLOCKS_STREAMED are
+  64-bit so they do not wrap in long tests.  LC_STREAM_STATUS() returns
+  them as uint64_t.
+- Added LC_DATAFILE_SEGMENT() to start each file of a test that is split
+  across several files.
+- Added the "framed" DATAFORMAT.  Blocks are written in frames with a CRC32C
+  and periodic index checkpoints so files can be checked, recovered, and 
+  searched.  Added LC_CRC32C(), LC_FRAME_WRITE(), LC_FRAME_CHECKPOINT(), and
+  LC_DATAFILE_CHECKPOINT().
+- Added the "columnar" DATAFORMAT.  It is framed, but the scans are 
+  collected into chunks of LC_COLUMN_SCANS, and each chunk is written with
+  one channel after another so a single channel can be read on its own.
+- LC_STREAM_DOWNSAMPLE() keeps the last scan of every DOWNSAMPLE+1, and
+  it reports the number of scans it actually kept.  It could skip or 
+  repeat a scan when the block length was not a multiple of DOWNSAMPLE+1.
+- Added LC_STREAM_TRIGSTATE().  It and LC_STREAM_ISCOMPLETE() lock the ring
+  buffer, since the stream callback changes the state from its own thread.
 */
 
 #define TWOPI 6.283185307179586     // REALLY comes in handy for signal generation
@@ -257,6 +304,17 @@ with init_data_file() and write_data_file() utilities.
 #define LC_BACKLOG_THRESHOLD 1024   // raise a warning if the backlog exceeds this number.
 #define LC_CLOCK_MHZ    80.0        // Clock frequency in MHz
 #define LC_SAMPLES_PER_READ 64      // Data read/write block size
+#define LC_SERVICE_DUTY 0.1         // Auto-tuned blocks keep LJM reads under this fraction of the block period
+#define LC_SERVICE_COST_US 200.     // Assumed LJM read cost per block until it has been measured
+#define LC_SERVICE_FIXED_US 50.     // Part of the LJM read cost that does not depend on the block size
+#define LC_MAX_BLOCK_SAMPLES 262144 // Largest auto-tuned R/W block (samples on all channels)
+#define LC_RETUNE_RATIO 2           // Only retune when the block size is off by this factor
+#define LC_RETUNE_SEC   10.         // Only retune a stream that has run at least this long
+#define LC_WRITE_CHUNK  1024        // Values converted per fwrite() in binary data files
+#define LC_FRAME_MAGIC  0x4c434642U // "LCFB" starts every frame in a framed data file
+#define LC_FRAME_NINDEX 64          // Data frames between index checkpoints
+#define LC_COLUMN_SCANS 4096        // Scans per chunk in a columnar data file
+#define LC_MAX_MIRROR_PAD 1048576   // Bytes the ring buffer may grow to be mirrored
 #define LC_TRIG_EFOFFSET 2000       // Offset in trigger channel number for hardware trigger
 /* Downsample pre-filter cutoff frequency
  * The 5th-order butterworth filters should be tuned to have a 0.1 magnitude
@@ -346,12 +404,103 @@ typedef enum __lc_edge_t__ {
 
 // The file format specifier indicates whether to use binary or ascii/text 
 // data formatting.  The former is faster and more efficient, but the latter
-// is human readable.
+// is human readable.  Framed files are binary, but each block is wrapped in
+// a frame with a checksum (see LC_FRAME_T) so damaged files can be checked
+// and recovered.  Columnar files are framed, but each frame holds a chunk
+// of scans stored one channel after another.
 typedef enum __lc_dataformat_t__ {
     LC_DF_ASCII = 0,
     LC_DF_BIN = 1,
+    LC_DF_FRAMED = 2,
+    LC_DF_COLUMNAR = 3,
 } lc_dataformat_t;
 
+// Frame types in a framed data file
+#define LC_FRAME_DATA   1
+#define LC_FRAME_INDEX  2
+#define LC_FRAME_COLUMNS 3
+
+/* LC_FRAME_T
+In framed data files, the data after the header are a series of frames.  
+Each frame is an LC_FRAME_T, BYTES of payload, and an LC_FRAME_END_T.  The 
+CRC in the end record is the CRC32C of the frame header and its payload, and
+LENGTH is the number of bytes from the start of the frame to the end record,
+so a reader may also walk the frames backwards from the end of the file.
+
+LC_FRAME_DATA frames hold SAMPLES scans of CHANNELS single precision values
+in the same order as binary data files.  SEQ counts the data frames in the
+file, and SCAN is the index of the frame's first scan in the stream.
+
+LC_FRAME_COLUMNS frames are the data frames of columnar files.  They hold
+the same values, but all SAMPLES values of the first channel come first, 
+then all of the second, and so on.  The writer collects LC_COLUMN_SCANS 
+scans for each frame (only the last frame of a file may be shorter), so 
+a reader can fetch one channel with a single read of 4*SAMPLES bytes at 
+offset 4*SAMPLES*CHANNEL in the payload.  Everything else is the same as 
+in framed files, including the index, which serves as the chunk index.
+
+LC_FRAME_INDEX frames are checkpoints written after every LC_FRAME_NINDEX 
+data frames (and when the file is closed properly).  Their payload is
+SAMPLES 64-bit file offsets of the data frames written since the previous 
+checkpoint followed by the offset of the previous checkpoint (zero for the
+first).  SEQ and SCAN describe the first data frame listed.  A reader can
+find any block quickly by following the checkpoints back from the end.
+
+All values are in the writer's native byte order.
+*/
+typedef struct __lc_frame_t__ {
+    uint32_t magic;         // LC_FRAME_MAGIC
+    uint32_t type;          // LC_FRAME_DATA, LC_FRAME_COLUMNS, or LC_FRAME_INDEX
+    uint64_t seq;           // Data frames before this one in the file
+    uint64_t scan;          // Index of the first scan in the stream
+    uint32_t channels;      // Channels per scan (zero for an index)
+    uint32_t samples;       // Scans in the frame or offsets in an index
+    uint64_t bytes;         // Bytes of payload that follow
+} lc_frame_t;
+
+typedef struct __lc_frame_end_t__ {
+    uint32_t crc;           // CRC32C of the frame header and payload
+    uint32_t length;        // Bytes in the frame header and payload
+} lc_frame_end_t;
+
+// Persistent state for writing a framed data file
+typedef struct __lc_framer_t__ {
+    uint64_t offset;                // File offset of the next frame
+    uint64_t seq;                   // Next data frame number
+    uint64_t scan;                  // Index of the next scan
+    uint64_t last_index;            // Offset of the last checkpoint (0 if none)
+    uint64_t index_scan;            // First scan of the first unindexed frame
+    unsigned int nindex;            // Data frames since the last checkpoint
+    uint64_t index[LC_FRAME_NINDEX + 1]; // Their offsets and LAST_INDEX
+    // Columnar files
+    float *chunk;                   // LC_COLUMN_SCANS values per channel or NULL
+    unsigned int chunk_channels;    // Channels in CHUNK
+    unsigned int chunk_fill;        // Scans in CHUNK
+} lc_framer_t;
+
+// Functions that append bytes to a data file.  They return LC_NOERR or 
+// LC_ERROR.  See LC_FRAME_WRITE().
+typedef int (*lc_emit_t)(void *arg, const void *bytes, size_t count);
+
+// The service mode determines who is responsible for moving data from LJM
+// into the ring buffer.  In polling mode, the application calls 
+// lc_stream_service() repeatedly.  In callback mode, LJM calls back into
+// lconfig from its own thread whenever a block is ready.
+typedef enum __lc_service_t__ {
+    LC_SERVICE_POLL = 0,
+    LC_SERVICE_CALLBACK = 1
+} lc_service_t;
+
+// The ring buffer mode determines how the buffer memory is allocated.  A 
+// block buffer is an ordinary allocation.  A mirrored buffer is a memfd 
+// mapped twice back-to-back, so spans that wrap are still contiguous.  It
+// is rounded up to whole pages, and it is shared with (not copied into) 
+// child processes after fork().
+typedef enum __lc_ringmode_t__ {
+    LC_RING_BLOCK = 0,
+    LC_RING_MIRROR = 1
+} lc_ringmode_t;
+
 // Flexible Input/Output configuration struct
 // This includes everything needed to configure an extended feature EF channel
 typedef struct __lc_efconf_t__ {
@@ -429,16 +578,29 @@ typedef struct __lc_meta_t__ {
 
 // Ring Buffer structure
 // The LCONF ring buffer supports reading and writing in R/W blocks that mimic
-// the T7 stream read block.  
+// the T7 stream read block.  When MIRROR is set, the buffer's pages are 
+// mapped a second time immediately after the first, so BUFFER[ii] and 
+// BUFFER[ii + SIZE_SAMPLES] are the same memory, and any span of up to 
+// SIZE_SAMPLES can be addressed without splitting it at the wrap.
 typedef struct __lc_ringbuf_t__ {
     unsigned int size_samples;      // length of the buffer array (NOT per channel)
     unsigned int blocksize_samples; // size of each read/write block
     unsigned int samples_per_read;  // samples per channel in each block
-    unsigned int samples_read;      // number of samples read since streaming began
-    unsigned int samples_streamed;  // number of samples streamed from the T7
+    uint64_t samples_read;          // number of samples read since streaming began
+    uint64_t samples_streamed;      // number of samples streamed from the T7
     unsigned int channels;          // channels in the stream
     unsigned int read;              // beginning index of the next read block
     unsigned int write;             // beginning index of the next write block
+    uint64_t blocks_streamed;       // number of R/W blocks transferred from the T7
+    unsigned int backlog;           // scans left waiting in the LJM buffer
+    int efd;                        // eventfd signaled by the stream callback (-1 if polling)
+    int error;                      // error raised inside the stream callback
+    double service_us;              // running average LJM read time per block (<0 until measured)
+    double scan_us;                 // ... less LC_SERVICE_FIXED_US, per scan (<0 until measured)
+    int mirror;                     // 1 if the buffer is mapped twice back-to-back
+    struct timespec start;          // wall clock (CLOCK_REALTIME) time the stream started
+    struct timespec stamp;          // wall clock time of the latest transfer
+    pthread_mutex_t lock;           // guards the indices when callbacks are in use
     double* buffer;                 // the buffer array
 } lc_ringbuf_t;
 
@@ -486,9 +648,11 @@ typedef struct __lc_devconf_t__ {
     int handle;                     // device handle
     double samplehz;                // *sample rate in Hz
     double settleus;                // *settling time in us
+    double latencyms;               // *target block latency in ms (<=0 for fixed blocks)
     unsigned int nsample;           // *number of samples per read
     unsigned int downsample;        // number of samples to reject per sample to keep
     unsigned int dscount;           // Downsample count (persistent state)
+    lc_framer_t framer;             // Framed data file state (persistent state)
     // Analog input
     lc_aiconf_t aich[LC_MAX_NAICH];    // analog input configuration array
     unsigned int naich;             // number of configured analog input channels
@@ -516,6 +680,10 @@ typedef struct __lc_devconf_t__ {
     enum {LC_TRIG_IDLE, LC_TRIG_PRE, LC_TRIG_ARMED, LC_TRIG_ACTIVE} trigstate; // Trigger state
     // data file format
     lc_dataformat_t dataformat;
+    // stream service mode
+    lc_service_t service;
+    // ring buffer memory
+    lc_ringmode_t ringbuffer;
     // Meta & filestream
     lc_meta_t meta[LC_MAX_META];  // *meta parameters
     lc_ringbuf_t RB;                  // ring buffer
@@ -679,6 +847,13 @@ The following parameters are recognized:
 .   efficiency, use BIN or BINARY to indicate a binary file.  Note that 
 .   the application should open the file in "binary" mode to ensure that
 .   both modes will be supported.
+-SERVICE
+.   Accepts POLL (the default) or CALLBACK to determine how data are moved
+.   from the LJM library into the ring buffer.  In POLL mode, the application
+.   must call LC_STREAM_SERVICE() often enough to keep up with the stream.  In
+.   CALLBACK mode, LJM calls back into lconfig from its own thread whenever
+.   a block is ready, and the application can sleep on LC_STREAM_FD() or
+.   LC_STREAM_WAIT() until there are data to read.
 -SAMPLEHZ
 .   This parameter is not explicitly used to configure the T7.  It is intended
 .   to specify the sample rate in Hz for streaming applications run by the 
@@ -707,6 +882,13 @@ The following parameters are recognized:
 .   application access prior to calling LC_STREAM_DOWNSAMPLE().  This is 
 .   especially useful for the digital channels, which may have high-frequency
 .   information that will be lost otherwise.
+-LATENCYMS
+.   The target time in milliseconds between a sample being measured and its
+.   block becoming available to the application.  When LATENCYMS is greater
+.   than zero and the application passes SAMPLES_PER_READ <= 0 to 
+.   LC_STREAM_START(), the block size is chosen automatically; see 
+.   LC_STREAM_AUTOTUNE().  By default, LATENCYMS is -1, and blocks of 
+.   LC_SAMPLES_PER_READ scans are used.
 -SETTLEUS
 .   Settling time to be used during AI streaming, specified in microseconds.  
 .   The minimum settling time supported is > 5us.  Any value <= 5us will prompt
@@ -1091,6 +1273,15 @@ int lc_load(lc_devconf_t* dconf,         // array of device configuration struct
                 const unsigned int devmax, // maximum number of devices to load
                 const char* filename);  // name of the file to read
 
+/* LC_LOAD_STRING
+Identical to LC_LOAD(), but the configuration is parsed from the NUL-
+terminated string TEXT instead of a file.  This is useful for configurations
+that were received from another process (see lcshm.h).
+*/
+int lc_load_string(lc_devconf_t* dconf,  // array of device configuration structs
+                const unsigned int devmax, // maximum number of devices to load
+                const char* text);      // configuration text
+
 
 /* WRITE_CONFIG
 Write the configuration parameters set in DCONF to a configuration
@@ -1338,19 +1529,44 @@ SAMPLES_STREAMED - a running total of the samples per channel streamed into the
 SAMPLES_READ - a running total of the samples per channel read from the buffer.
 SAMPLES_WAITING - the number of samples waiting in the buffer
 
+The running totals are 64-bit, so they do not wrap in multi-day tests.
+
 To determine the total number of samples in a read/write block, calculate
     CHANNELS * SAMPLES_PER_READ
 */
 void lc_stream_status(lc_devconf_t* dconf, 
-        unsigned int *samples_streamed, unsigned int *samples_read,
+        uint64_t *samples_streamed, uint64_t *samples_read,
         unsigned int *samples_waiting);
 
+/*LC_STREAM_CLOCK
+Report when the latest block was transferred from LJM and how many scans the
+device had acquired by then.  SECONDS is the wall clock time of the transfer
+measured from the start of the stream (RB.START), and SCANS counts every scan
+transferred since the stream started plus the scans LJM was still holding.
+
+Independent devices run on separate oscillators, so their true scan rates
+differ slightly from SAMPLEHZ and from one another.  Fitting a line to a
+series of SECONDS and SCANS measures each device's rate against the host
+clock (see LCT_DRIFT_T in lctools.h).
+
+Returns LC_NOERR on success and LC_ERROR if no data have been transferred.
+*/
+int lc_stream_clock(lc_devconf_t* dconf, double *seconds, double *scans);
+
 /* LC_STREAM_ISCOMPLETE
 Returns 1 to indicate that at least dconf->nsample samples per channel
 have been streamed from the T7.  Returns a 0 otherwise.
 */
 int lc_stream_iscomplete(lc_devconf_t* dconf);
 
+/* LC_STREAM_TRIGSTATE
+Returns the trigger state (LC_TRIG_IDLE, LC_TRIG_PRE, LC_TRIG_ARMED, or 
+LC_TRIG_ACTIVE).  In callback mode, the LJM thread updates the state as 
+blocks arrive, so applications should use this instead of reading 
+dconf->trigstate directly.
+*/
+int lc_stream_trigstate(lc_devconf_t* dconf);
+
 /* LC_STREAM_ISACTIVE
 Returns 1 to indicate that a stream is currently active. A stream is "active"
 if it has been started by lc_stream_start() and the data collection process is
@@ -1369,6 +1585,17 @@ lc_stream_service will overwrite the oldest data.  Returns a 0 otherwise.
 */
 int lc_stream_isfull(lc_devconf_t* dconf);
 
+/* LC_STREAM_FD
+Returns a file descriptor that becomes readable each time the stream callback
+transfers a block into the buffer.  It is only available when the SERVICE 
+parameter is set to CALLBACK and the stream has been started.  Otherwise, 
+returns -1.  The descriptor is an eventfd; the application can clear it by 
+reading 8 bytes from it, and it should be added to select(), poll(), or 
+epoll() sets for reading only.  It remains the same across stream restarts,
+and it is closed by lc_clean().
+*/
+int lc_stream_fd(lc_devconf_t* dconf);
+
 
 /***********************************************************************
  * 7. DATA STREAM FUNCTIONS
@@ -1380,7 +1607,8 @@ int lc_stream_isfull(lc_devconf_t* dconf);
 Start a stream operation on the device pointed to by DCONF.
 
 SAMPLES_PER_READ determines the number of samples on each configured channel
-that will be transmitted in each data block.  Data blocks are transferred from the
+that will be transmitted in each data block.  If SAMPLES_PER_READ <= 0, the
+value returned by LC_STREAM_AUTOTUNE() is used.  Data blocks are transferred from the
 LabJack during calls to LC_STREAM_SERVICE(), and are made available to the 
 application using calls to LC_STREAM_READ().
 
@@ -1395,6 +1623,34 @@ int lc_stream_start(lc_devconf_t* dconf,   // Device array and number
             int samples_per_read);    // how many samples per call to read_data_stream
 
 
+/* LC_STREAM_AUTOTUNE
+Recommend a SAMPLES_PER_READ value for the device.  If the LATENCYMS 
+parameter is not set, this is always LC_SAMPLES_PER_READ.  Otherwise, the 
+block is sized to span LATENCYMS at SAMPLEHZ, but it is enlarged if the LJM
+read time per block would consume more than LC_SERVICE_DUTY of the block 
+period.  The read time is modeled as LC_SERVICE_FIXED_US per read plus 
+RB.SCAN_US per scan, measured by LC_STREAM_SERVICE(), so the estimate does 
+not grow with the blocks it is used to size.  Before any reads have been 
+measured, LC_SERVICE_COST_US per block is assumed.  Blocks are limited to LC_MAX_BLOCK_SAMPLES across all 
+stream channels, and they are rounded down to a multiple of 8 scans.
+*/
+int lc_stream_autotune(lc_devconf_t* dconf);
+
+/* LC_STREAM_RETUNE
+Restart an auto-tuned stream with a new block size if LC_STREAM_AUTOTUNE()
+recommends one that differs from the current block by more than a factor of 
+LC_RETUNE_RATIO.  The restart leaves a short gap in the data, so it is only
+performed when the buffer is empty, never when a trigger is configured, and 
+no more often than every LC_RETUNE_SEC seconds.
+Applications that record continuous data should not call it.  
+LC_STREAM_RETUNE() does nothing if LATENCYMS is not set.  The application can
+compare RB.samples_per_read before and after to see if a restart occurred.
+
+Returns LC_NOERR if the stream is running normally afterward
+Returns LC_ERROR if the restart failed
+*/
+int lc_stream_retune(lc_devconf_t* dconf);
+
 /*LC_STREAM_SERVICE
 Service an active data stream by reading another block of data an checking for
 trigger events (if a software trigger has been configured).  This is a blocking
@@ -1411,11 +1667,30 @@ Until data become available, READ_DATA_STREAM will return NULL data arrays,
 but once valid data are ready, READ_DATA_STREAM returns pointers into this
 ring buffer.
 
+When the SERVICE parameter is CALLBACK, the transfer happens in LJM's callback
+thread instead, and LC_STREAM_SERVICE() only reports whether the callback has
+encountered an error.
+
 Returns LC_NOERR on success even if no samples are returned
 Returns LC_ERROR if there is a communications problem with the LabJack.
 */
 int lc_stream_service(lc_devconf_t* dconf);
 
+/*LC_STREAM_WAIT
+Sleep until at least one new block has been transferred into the buffer or
+until TIMEOUT_MS milliseconds have elapsed.  A negative TIMEOUT_MS waits 
+indefinitely.  In callback mode, this sleeps on the LC_STREAM_FD() descriptor.
+In polling mode, LC_STREAM_WAIT() calls LC_STREAM_SERVICE() repeatedly, 
+sleeping for a fraction of the block period between attempts.
+
+Timing out is not an error; use LC_STREAM_ISEMPTY() or LC_STREAM_STATUS() to
+see whether data arrived.
+
+Returns LC_NOERR on success or timeout
+Returns LC_ERROR if there is a communications problem with the LabJack.
+*/
+int lc_stream_wait(lc_devconf_t* dconf, int timeout_ms);
+
 /*LC_STREAM_READ
 If data are available on the data stream, then READ_DATA_STREAM will return a 
 DATA pointer into a buffer that contains data ready for use.  The amount of data
@@ -1468,12 +1743,94 @@ SAMPLES_PER_READ data elements.  The following data might be valid, but they
 also might wrap around the end of the ring buffer.  Instead, READ_DATA_STREAM
 should be called again to return a new valid data pointer.
 
+The block is released as soon as it is read, so its place in the ring buffer
+is written again once the stream wraps around to it.  In callback mode, the 
+LJM thread writes new blocks without waiting for the application, so the 
+DATA pointer is only good until about NBUFFER more blocks arrive.  Finish 
+with the block (or copy it) before waiting for more data.  When the 
+application falls a whole buffer behind, the oldest blocks are overwritten 
+whether or not they have been read, and that is true of the spans returned 
+by LC_STREAM_READ_BULK() as well.
+
 Returns LC_NOERR on success
 Returns LC_ERROR if there are no data available
 */
 int lc_stream_read(lc_devconf_t* dconf, double **data, 
         unsigned int *channels, unsigned int *samples_per_read);
 
+/*LC_STREAM_READ_BULK
+LC_STREAM_RELEASE_BULK
+Like LC_STREAM_READ(), but LC_STREAM_READ_BULK() returns every block that is 
+ready and contiguous in memory.  When the ring buffer is mirrored (RB.MIRROR,
+which LC_STREAM_START() arranges when RINGBUFFER is LC_RING_MIRROR and the 
+system allows it), that is every block waiting.  Otherwise, the span stops where the ring buffer wraps (or at
+the last block written).  SAMPLES is set to the number of 
+samples per channel in the span, which is always a whole number of 
+SAMPLES_PER_READ blocks.  The data are laid out exactly as they are by 
+LC_STREAM_READ().
+
+Unlike LC_STREAM_READ(), the blocks are not released by the read.  Once the 
+application is done with them, it must call LC_STREAM_RELEASE_BULK() with the
+number of samples per channel it has consumed.  That number must be a whole
+number of blocks, and it is usually the SAMPLES value returned by the read.
+If the buffer has wrapped, a second read returns the remainder from the 
+start of the buffer.  For example,
+
+while(!lc_stream_read_bulk(dconf, &data, &channels, &samples)){
+    nread = samples;
+    lc_stream_downsample(dconf, data, channels, &samples);
+    lc_datafile_write(dconf, FF, data, channels, samples);
+    lc_stream_release_bulk(dconf, nread);
+}
+
+The two APIs can be mixed, but a block must not be read by LC_STREAM_READ()
+while a span that contains it is held.  As with LC_STREAM_READ(), if the
+stream overruns the buffer, the oldest data held by the application will be
+overwritten.
+
+LC_STREAM_READ_BULK() returns LC_NOERR on success, or LC_ERROR if there are 
+no data available.  LC_STREAM_RELEASE_BULK() returns LC_ERROR if SAMPLES is
+not a whole number of blocks.
+*/
+int lc_stream_read_bulk(lc_devconf_t* dconf, double **data, 
+        unsigned int *channels, unsigned int *samples);
+
+int lc_stream_release_bulk(lc_devconf_t* dconf, unsigned int samples);
+
+/*LC_STREAM_PEEK
+Copy the most recent scans in the ring buffer into DEST without consuming 
+them.  The read index is not touched, so a live display can watch a stream
+that is also being recorded.  Scans are eligible whether or not they have 
+been read, as long as they have not been overwritten.  Calibrations are not
+applied.
+
+Scans that have been read are copied as they are in the buffer now.  If the
+application modifies its blocks in place, for example with 
+LC_STREAM_DOWNSAMPLE() or LCT_PIPELINE(), which compact the kept scans at 
+the start of the block, the copy mixes those results with the scans that 
+were left behind.  Applications that peek should process a copy of each 
+block instead.
+
+On entry, SAMPLES is the most scans DEST can hold.  On return, it is the 
+number of scans actually copied.  The copied scans are the newest scan and
+every DECIMATE-th scan before it (DECIMATE of 0 or 1 copies every scan), 
+and they are written to DEST oldest first.
+
+If CHANNEL is negative, every stream channel is copied, and DEST is laid out
+exactly like the data returned by LC_STREAM_READ(), so it must hold 
+SAMPLES * CHANNELS values.  Otherwise, only stream channel number CHANNEL 
+is copied, and DEST must hold SAMPLES values.
+
+In callback mode, the copy is made while holding the ring buffer lock, so it
+is safe from concurrent writes; keep SAMPLES modest to avoid delaying LJM's
+thread.
+
+Returns LC_NOERR on success, even if no scans are available yet.
+Returns LC_ERROR if there is no stream buffer or CHANNEL is out of range.
+*/
+int lc_stream_peek(lc_devconf_t* dconf, int channel, unsigned int decimate,
+        double *dest, unsigned int *samples);
+
 
 /* LC_STREAM_DOWNSAMPLE
 
@@ -1482,6 +1839,8 @@ digital anti-aliasing filters to the analog channels before discarding
 DOWNSAMPLE (see LC_LOAD() DOWNSAMPLE parameter) measurements for every 
 measurement kept, effectively reducing the sample frequency to 
      SAMPLEHZ / (DOWNSAMPLE+1)
+The last scan of every DOWNSAMPLE+1 in the stream is kept, regardless of 
+where the blocks begin and end.
 Digital and extended feature channels are downsampled with no filtering.
 
 After execution, the value in SAMPLES_PER_CHANNEL is modified to indicate
@@ -1513,6 +1872,23 @@ be called prior to LC_DATAFILE_WRITE()
 int lc_datafile_init(lc_devconf_t* dconf, FILE *FF);
 
 
+/*LC_DATAFILE_SEGMENT
+Writes the header for one file (a segment) of a test whose data are split 
+across several files.  The header is the same as the one written by 
+LC_DATAFILE_INIT() with one more comment line before the timestamp,
+
+#segment SEGMENT SCAN
+
+where SEGMENT counts the files from zero and SCAN is the index of the first
+scan in this file counted from the start of the stream.  Applications may
+start a new segment between any two calls to LC_DATAFILE_WRITE() without 
+interrupting the stream, so the segments join without a gap.  Loaders that
+do not know about segments skip the line.
+*/
+int lc_datafile_segment(lc_devconf_t* dconf, FILE *FF, unsigned int segment,
+        uint64_t scan);
+
+
 /*LC_DATAFILE_WRITE
 Writes data obtained from LC_STREAM_READ to a data file initialized by
 LC_DATAFILE_INIT.  Pass the data array, channels, and samples_per_read
@@ -1525,6 +1901,47 @@ int lc_datafile_write(lc_devconf_t *dconf, FILE *FF, double *data,
         unsigned int channels, unsigned int samples_per_read);
 
 
+/*LC_DATAFILE_CHECKPOINT
+In framed data files, write an index checkpoint for the frames written since
+the last one.  This should be called just before the file is closed, so that
+readers can find every frame from the end of the file.  In columnar files,
+the partial chunk is written first, so this must be called for the last 
+scans to reach the file.  It does nothing for other data formats.
+*/
+int lc_datafile_checkpoint(lc_devconf_t *dconf, FILE *FF);
+
+
+/*LC_FRAME_WRITE
+LC_FRAME_CHECKPOINT
+These are the back end of framed data files for writers other than stdio 
+(see lcaio.h).  LC_FRAME_WRITE() wraps SAMPLES scans from DATA in a data 
+frame and passes the bytes to EMIT with ARG.  An index checkpoint follows
+automatically after every LC_FRAME_NINDEX data frames.  LC_FRAME_CHECKPOINT()
+writes a checkpoint now if there are frames that have not been indexed.
+
+When DATAFORMAT is LC_DF_COLUMNAR, LC_FRAME_WRITE() transposes the scans 
+into FRAMER.CHUNK instead, and a frame is only written when the chunk is
+full.  LC_FRAME_CHECKPOINT() writes the partial chunk and frees CHUNK.
+
+The file offsets in the checkpoints are counted from FRAMER.OFFSET, which
+LC_DATAFILE_INIT() and LC_DATAFILE_SEGMENT() set to the end of the header.
+Writers that produce the header some other way must set it themselves.
+
+Both return LC_NOERR on success and LC_ERROR if EMIT fails.
+*/
+int lc_frame_write(lc_devconf_t *dconf, const double *data, unsigned int channels,
+        unsigned int samples, lc_emit_t emit, void *arg);
+int lc_frame_checkpoint(lc_devconf_t *dconf, lc_emit_t emit, void *arg);
+
+
+/*LC_CRC32C
+Continue the CRC32C (Castagnoli) checksum CRC over BYTES bytes of DATA.  
+Start a new checksum with CRC = 0.  The SSE4.2 CRC32 instruction is used 
+when the processor has it, so the checksum costs far less than the write.
+*/
+uint32_t lc_crc32c(uint32_t crc, const void *data, size_t bytes);
+
+
 
 
 #endif
@@ -0,0 +1,262 @@
+/*
+  This file is part of the LCONFIG laboratory configuration system.
+
+    LCONFIG is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    LCONFIG is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with LCONFIG.  If not, see <https://www.gnu.org/licenses/>.
+
+    Authored by C.Martin crm28@psu.edu
+*/
+
+#include "lconfig.h"
+#include "lctools.h"
+#include "lcnet.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#define DEF_ADDRESS "5500"
+#define MAXCONN     16
+#define MAXSTR      128
+
+
+/*....................
+. Help text
+.....................*/
+const char help_text[] = \
+"lcrecv [-h] [-l ADDRESS] [-d DATAFILE]\n"\
+"  Receives live streams sent by LCRUN (see lcrun -o) and optionally\n"\
+"  writes them to data files.  LCRECV exits when every sender has\n"\
+"  finished or when the user presses Q.\n"\
+"\n"\
+"-l ADDRESS\n"\
+"  The address to listen on.  This may be a TCP port (PORT or HOST:PORT)\n"\
+"  or a Unix domain socket (unix:PATH).  The default is port 5500.\n"\
+"     $ lcrecv -l unix:/tmp/lcrun.sock\n"\
+"\n"\
+"-d DATAFILE\n"\
+"  Write the received data to DATAFILE.dat, or to DATAFILE_#.dat when\n"\
+"  the sender has multiple devices.  The files are the same as those\n"\
+"  written by LCRUN.  Without -d, the streams are only counted.\n"\
+"     $ lcrecv -d copy\n"\
+"\n"\
+"  To test a configuration on one machine,\n"\
+"     $ lcrecv -d copy &\n"\
+"     $ lcrun -o localhost:5500\n"\
+"\n"\
+"GPLv3\n"\
+"(c)2026 C.Martin\n";
+
+
+// One sender connection
+typedef struct __conn_t__ {
+    int fd;                 // Socket or -1 when done
+    int device;             // Device index at the sender
+    lc_devconf_t dconf;     // Configuration received from the sender
+    FILE *dfile;            // Data file or NULL
+    uint64_t next;          // Expected block sequence number
+    uint64_t blocks;        // Blocks received
+    uint64_t dropped;       // Blocks missing from the sequence
+    uint64_t samples;       // Scans received
+    lcnet_rx_t rx;          // The frame being received
+} conn_t;
+
+
+// Finish a connection and report on it
+void finish(conn_t *conn){
+    if(conn->fd >= 0)
+        close(conn->fd);
+    conn->fd = -1;
+    if(conn->dfile){
+        lc_datafile_checkpoint(&conn->dconf, conn->dfile);
+        fclose(conn->dfile);
+    }
+    conn->dfile = NULL;
+    printf("Device %d: %llu blocks (%llu scans) received, %llu dropped by the sender\n",
+            conn->device, (unsigned long long) conn->blocks,
+            (unsigned long long) conn->samples, (unsigned long long) conn->dropped);
+    // Only connections that sent a configuration have one to clean up
+    if(conn->device >= 0)
+        lc_clean(&conn->dconf);
+}
+
+
+/*....................
+. Main
+.....................*/
+int main(int argc, char *argv[]){
+    char    address[MAXSTR] = DEF_ADDRESS,
+            data_file_base[MAXSTR] = "",
+            data_file[MAXSTR];
+    char    go;
+    int     lfd, ii, fd, err, itemp, nconn = 0, nopen = 0, npoll;
+    conn_t  conn[MAXCONN];
+    struct pollfd pfd[MAXCONN + 2];
+    lcnet_frame_t *frame;
+    void    *payload;
+
+    while((go = getopt(argc, argv, "hl:d:"))!=-1){
+        switch(go){
+        case 'l':
+            if(snprintf(address, MAXSTR, "%s", optarg) >= MAXSTR){
+                fprintf(stderr, "LCRECV: The address is too long: %s\n", optarg);
+                return -1;
+            }
+        break;
+        case 'd':
+            if(snprintf(data_file_base, MAXSTR, "%s", optarg) >= MAXSTR){
+                fprintf(stderr, "LCRECV: The data file name is too long: %s\n", optarg);
+                return -1;
+            }
+        break;
+        case 'h':
+            printf(help_text);
+            return 0;
+        default:
+            fprintf(stderr, "LCRECV: Got unsupported command line option: %c\n", go);
+            return -1;
+        }
+    }
+
+    lfd = lcnet_listen(address);
+    if(lfd < 0){
+        fprintf(stderr, "LCRECV: Failed to listen on %s\n", address);
+        return -1;
+    }
+    printf("Listening on %s\nPress \"Q\" to quit\n", address);
+    fflush(stdout);
+    lct_setup_keypress();
+
+    go = 1;
+    while(go){
+        // Watch the listener, stdin, and every open connection
+        pfd[0].fd = lfd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = STDIN_FILENO;
+        pfd[1].events = POLLIN;
+        npoll = 2;
+        for(ii=0; ii<nconn; ii++){
+            pfd[npoll].fd = conn[ii].fd;
+            pfd[npoll++].events = POLLIN;
+        }
+        if(poll(pfd, npoll, -1) < 0)
+            break;
+
+        if(pfd[1].revents & POLLIN && getchar() == 'Q')
+            go = 0;
+
+        // New senders
+        if(pfd[0].revents & POLLIN){
+            fd = lcnet_accept(lfd);
+            // Reuse the slot of a sender that has finished
+            for(ii=0; ii<nconn && conn[ii].fd >= 0; ii++);
+            if(fd < 0)
+                ;
+            else if(ii >= MAXCONN){
+                fprintf(stderr, "LCRECV: Refused a connection; only %d are allowed at once.\n", MAXCONN);
+                close(fd);
+            }else{
+                if(ii == nconn){
+                    memset(&conn[ii].rx, 0, sizeof(lcnet_rx_t));
+                    nconn++;
+                }
+                conn[ii].fd = fd;
+                conn[ii].device = -1;
+                conn[ii].dfile = NULL;
+                conn[ii].next = 0;
+                conn[ii].blocks = 0;
+                conn[ii].dropped = 0;
+                conn[ii].samples = 0;
+                conn[ii].rx.got = 0;
+                nopen++;
+            }
+        }
+
+        // Only the connections that were polled
+        for(ii=0; ii<npoll-2; ii++){
+            if(conn[ii].fd < 0 || !(pfd[ii+2].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            // A sender in the middle of a frame does not hold up the others
+            err = lcnet_recv(conn[ii].fd, &conn[ii].rx);
+            if(err == LCNET_AGAIN)
+                continue;
+            if(err){
+                fprintf(stderr, "LCRECV: Lost the connection to device %d\n", conn[ii].device);
+                finish(&conn[ii]);
+                nopen--;
+                continue;
+            }
+            frame = &conn[ii].rx.frame;
+            payload = conn[ii].rx.payload;
+            switch(frame->type){
+            case LCNET_CONFIG:
+                if(conn[ii].device >= 0 || lc_load_string(&conn[ii].dconf, 1, payload)){
+                    fprintf(stderr, "LCRECV: Received a configuration that could not be loaded.\n");
+                    finish(&conn[ii]);
+                    nopen--;
+                    break;
+                }
+                conn[ii].device = frame->device;
+                printf("Device %d: receiving from %s\n", frame->device, conn[ii].dconf.name);
+                if(data_file_base[0]){
+                    if(frame->ndev <= 1)
+                        itemp = snprintf(data_file, MAXSTR, "%s.dat", data_file_base);
+                    else
+                        itemp = snprintf(data_file, MAXSTR, "%s_%d.dat", data_file_base, frame->device);
+                    if(itemp >= MAXSTR)
+                        fprintf(stderr, "LCRECV: The data file name for device %d is too long: %s\n", 
+                                frame->device, data_file_base);
+                    else if((conn[ii].dfile = fopen(data_file, "wb")) == NULL)
+                        fprintf(stderr, "LCRECV: Failed to open data file: %s\n", data_file);
+                    else
+                        lc_datafile_init(&conn[ii].dconf, conn[ii].dfile);
+                }
+            break;
+            case LCNET_BLOCK:
+                if(frame->bytes != (uint64_t) frame->channels * frame->samples * sizeof(double)){
+                    fprintf(stderr, "LCRECV: Received a block with the wrong size.\n");
+                    break;
+                }
+                conn[ii].dropped += frame->seq - conn[ii].next;
+                conn[ii].next = frame->seq + 1;
+                conn[ii].blocks ++;
+                conn[ii].samples += frame->samples;
+                if(conn[ii].dfile)
+                    lc_datafile_write(&conn[ii].dconf, conn[ii].dfile,
+                            payload, frame->channels, frame->samples);
+            break;
+            case LCNET_END:
+                conn[ii].dropped += frame->seq - conn[ii].next;
+                finish(&conn[ii]);
+                nopen--;
+            break;
+            }
+        }
+        // Stop once every sender has finished
+        if(nconn && !nopen)
+            go = 0;
+    }
+
+    for(ii=0; ii<nconn; ii++)
+        if(conn[ii].fd >= 0)
+            finish(&conn[ii]);
+    lct_finish_keypress();
+    for(ii=0; ii<nconn; ii++)
+        lcnet_rx_free(&conn[ii].rx);
+    close(lfd);
+    if(address[0] != '\0' && strncmp(address, "unix:", 5) == 0)
+        unlink(address + 5);
+    return 0;
+}
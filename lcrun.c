@@ -20,7 +20,9 @@
 
 #include "lctools.h"
 #include "lconfig.h"
+#include "lcsink.h"
 #include <string.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <time.h>   // For forming file names from timestamps
@@ -29,7 +31,10 @@
 #define MAXLOOP     "-1"
 #define NBUFFER     65535
 #define MAX_DEV        8
+#define MAX_SINK    4       // File, preview, shared memory, and network
 #define MAXSTR      128
+#define MONITOR_SCANS   64      // Scans averaged for each monitor reading
+#define MONITOR_WINDOW  0.1     // Seconds spanned by each monitor reading
 
 
 #define halt(){\
@@ -37,8 +42,12 @@
         lc_stream_stop(&dconf[devnum]);\
         lc_close(&dconf[devnum]);\
         lc_clean(&dconf[devnum]);\
-        if(dfile[devnum]){fclose(dfile[devnum]);dfile[devnum]=NULL;}\
+        for(sinknum=0; sinknum<nsink; sinknum++)\
+            lcsink_close(&sink[devnum][sinknum]);\
+        lct_drift_close(&drift[devnum]);\
     }\
+    free(work);\
+    work = NULL;\
 };
 
 
@@ -47,7 +56,9 @@
 . Help text
 .....................*/
 const char help_text[] = \
-"lcrun [-h] [-d DATAFILE] [-c CONFIGFILE] [-n MAXREAD] [-f|i|s param=value]\n"\
+"lcrun [-h] [-d DATAFILE] [-c CONFIGFILE] [-n MAXREAD] [-m SECONDS]\n"\
+"      [-p NAME] [-o ADDRESS] [-r] [-g LIMIT] [-w MODE] [-v FACTOR[:minmax]]\n"\
+"      [-e INTERVAL[:NFFT]] [-t SECONDS] [-f|i|s param=value]\n"\
 "\n"\
 "  Runs a data acquisition job until the user exists with a keystroke.\n"\
 "\n"\
@@ -66,6 +77,13 @@ const char help_text[] = \
 "  appended.  For configurations with multiple devices, a data file\n"\
 "  is created for each device, mydatafile_#.dat"\
 "\n"\
+"  With \"-d -\", the data are written to stdout in the framed binary\n"\
+"  format (see lcverify) so they can be piped into other programs, and\n"\
+"  all of the messages go to stderr.  When stdout is a pipe, the data\n"\
+"  are handed to it with vmsplice() instead of being copied.  This only\n"\
+"  works with one device, and -g and -w are ignored.\n"\
+"     $ lcrun -d - | zstd > test.dat.zst\n"\
+"\n"\
 "-n MAXREAD\n"\
 "  This option accepts an integer number of read operations after which\n"\
 "  the data collection will be halted.  The number of samples collected\n"\
@@ -73,6 +91,98 @@ const char help_text[] = \
 "  configuration file.  The maximum number of samples allowed per channel\n"\
 "  will be MAXREAD*NSAMPLE.  By default, the MAXREAD option is disabled.\n"\
 "\n"\
+"-m SECONDS\n"\
+"  Print a live readout of every analog input every SECONDS while the\n"\
+"  data are recorded.  Each reading is the calibrated average of the\n"\
+"  newest measurements over about 0.1 seconds.  The readout does not\n"\
+"  consume any data, so the data files are unaffected.\n"\
+"     $ lcrun -m 0.5\n"\
+"\n"\
+"-p NAME\n"\
+"  Publish the live stream in a POSIX shared memory segment called NAME\n"\
+"  so other processes can watch the data while they are recorded.  With\n"\
+"  multiple devices, the segments are called NAME_0, NAME_1, ...  The\n"\
+"  segments hold about two seconds of raw data (before downsampling).\n"\
+"  Readers that fall behind lose blocks; they never slow down LCRUN.\n"\
+"     $ lcrun -p mytest\n"\
+"     $ lcstat -a mytest\n"\
+"\n"\
+"-o ADDRESS\n"\
+"  Also send the data to a receiver (like LCRECV) listening at ADDRESS.\n"\
+"  ADDRESS may be HOST:PORT for TCP or unix:PATH for a Unix domain\n"\
+"  socket.  The data are queued and sent without ever waiting on the\n"\
+"  receiver; if it falls too far behind, blocks are dropped from the\n"\
+"  network copy only.  Each device gets its own connection.\n"\
+"     $ lcrun -o localhost:5500\n"\
+"\n"\
+"-r\n"\
+"  Correct the clock drift of every device.  Each device's true sample\n"\
+"  rate is measured against the computer's clock, and its data are\n"\
+"  resampled so that they land on the nominal rate.  Files from several\n"\
+"  devices (or several computers with synchronized clocks) can then be\n"\
+"  compared sample-by-sample even in very long tests.  The correction\n"\
+"  begins after about two seconds.\n"\
+"     $ lcrun -r\n"\
+"\n"\
+"-g LIMIT\n"\
+"  Split the data into files (segments) of limited size or duration so\n"\
+"  multi-day tests do not produce one enormous file.  LIMIT is a number\n"\
+"  followed by K, M, or G for a size in bytes or by s, m, or h for a\n"\
+"  duration.  The files are called DATAFILE.0000.dat, DATAFILE.0001.dat,\n"\
+"  ... (or DATAFILE_#.0000.dat, ... with multiple devices).  Each starts\n"\
+"  with the full header and the index of its first sample, and no data\n"\
+"  are lost between them.\n"\
+"     $ lcrun -g 500M\n"\
+"     $ lcrun -g 1h\n"\
+"\n"\
+"-w MODE\n"\
+"  Choose how the data files are written.  With \"stdio\" (the default),\n"\
+"  a slow disk can hold up the stream.  With \"uring\", the data are\n"\
+"  collected in large buffers that the kernel writes in the background\n"\
+"  (io_uring), so the stream only waits if the disk falls several\n"\
+"  megabytes behind.  \"direct\" is the same, but the data also bypass\n"\
+"  the page cache (O_DIRECT).\n"\
+"     $ lcrun -w uring\n"\
+"\n"\
+"-v FACTOR\n"\
+"  Also write a preview file, DATAFILE_preview.dat, with the mean of every\n"\
+"  FACTOR scans.  It is written in the same pass as the full data file,\n"\
+"  with the same header, so a long test can be browsed quickly while the\n"\
+"  full-rate file is kept for analysis.  Its sample rate accounts for\n"\
+"  FACTOR, so it loads like any other data file.\n"\
+"  With \":minmax\", each group of FACTOR scans is written as two scans,\n"\
+"  its minimum and then its maximum, so spikes and dropouts that a mean\n"\
+"  would hide are still seen.  FACTOR must be even, and the header has\n"\
+"  the meta parameter envelope.\n"\
+"     $ lcrun -v 100\n"\
+"     $ lcrun -v 1000:minmax\n"\
+"\n"\
+"-e INTERVAL[:NFFT]\n"\
+"  Record spectra instead of samples.  Every INTERVAL (a number followed\n"\
+"  by s, m, or h), the data file gets NFFT/2+1 rows: row K holds the RMS\n"\
+"  amplitude of each channel at K*DF Hz, where DF is the sample rate\n"\
+"  divided by NFFT, averaged over the interval with Welch's method.  NFFT\n"\
+"  is a power of two (4096 by default).  The header is the usual one with\n"\
+"  the meta parameters spectrum_nfft, spectrum_bins, spectrum_df, and\n"\
+"  spectrum_sec, so months of spectra take very little disk.  The other\n"\
+"  outputs (-v, -p, -o) still carry the samples.\n"\
+"     $ lcrun -e 1m:8192\n"\
+"\n"\
+"-t SECONDS\n"\
+"  Only record events.  The trigger settings in the configuration file\n"\
+"  decide what an event is: the analog input TRIGCHANNEL (or every\n"\
+"  analog input if there is no TRIGCHANNEL) is compared with TRIGLEVEL.\n"\
+"  With a rising TRIGEDGE, the signal is active while it is above the\n"\
+"  level, with falling, while it is below, and with all, every time it\n"\
+"  crosses.  Each event is written to its own file, DATAFILE.0000.dat,\n"\
+"  DATAFILE.0001.dat, ..., that starts TRIGPRE samples before the first\n"\
+"  active sample and ends SECONDS after the last one.  Each file's header\n"\
+"  has the index of its first sample counted from the start of the\n"\
+"  stream.  Nothing is written between events, and the stream is not\n"\
+"  held up waiting for a trigger.  The other outputs (-v, -p, -o) still\n"\
+"  carry every sample.  -t can't be used with -g or -e.\n"\
+"     $ lcrun -t 2\n"\
+"\n"\
 "-f param=value\n"\
 "-i param=value\n"\
 "-s param=value\n"\
@@ -85,6 +195,41 @@ const char help_text[] = \
 "(c)2017-2025 C.Martin\n";
 
 
+/*....................
+. Live monitor
+.....................*/
+// Print one line with the calibrated average of the newest scans on every
+// analog input.  The scans are copied with lc_stream_peek(), so the data 
+// still go to the data file.
+void monitor(lc_devconf_t dconf[], int ndev){
+    double mdata[MONITOR_SCANS], value;
+    unsigned int samples, decimate, ii;
+    int devnum, ainum;
+
+    printf("\r\x1b[K");
+    for(devnum=0; devnum<ndev; devnum++){
+        if(devnum)
+            printf("| ");
+        // Spread the scans over the monitor window
+        decimate = dconf[devnum].samplehz * MONITOR_WINDOW / MONITOR_SCANS;
+        for(ainum=0; ainum<dconf[devnum].naich; ainum++){
+            samples = MONITOR_SCANS;
+            if(lc_stream_peek(&dconf[devnum], ainum, decimate, mdata, &samples) 
+                    || samples == 0)
+                continue;
+            value = 0.;
+            for(ii=0; ii<samples; ii++)
+                value += mdata[ii];
+            value /= samples;
+            lct_cal(&dconf[devnum], ainum, &value);
+            printf("AI%d: %.4g%s  ", dconf[devnum].aich[ainum].channel, 
+                    value, dconf[devnum].aich[ainum].calunits);
+        }
+    }
+    fflush(stdout);
+}
+
+
 /*....................
 . Main
 .....................*/
@@ -95,8 +240,7 @@ int main(int argc, char *argv[]){
     char go;    // Flag for whether to continue the stream loop
     char param[MAXSTR];
     // Options
-    char    data_file_base[MAXSTR],
-            data_file[MAXSTR],
+    char    data_file_base[MAXSTR] = "",
             config_file[MAXSTR] = CONFIG_FILE;
 
     int     count;     // count the number of loops for safe exit
@@ -107,12 +251,40 @@ int main(int argc, char *argv[]){
     // Config and file
     lc_devconf_t dconf[MAX_DEV];
     time_t start;
-    FILE* dfile[MAX_DEV];
+    // Outputs
+    lcsink_t sink[MAX_DEV][MAX_SINK];
+    int nsink = 0, sinknum;
+    int write_mode = LCSINK_STDIO;
+    int pipe_fd = -1;
+    unsigned int preview = 0;
+    int envelope = 0;
+    double spectrum_sec = 0.;
+    unsigned int nfft = LCSINK_DEF_NFFT;
+    int gated = 0;
+    double gate_sec = 0.;
+    char *colon;
     // Streaming data
     double *data;
-    unsigned int channels, samples_per_read;
+    unsigned int channels, samples_per_read, samples_read;
     // Utility
-    lct_idle_t idle;
+    lct_loop_t loop;
+    int events;
+    // Live monitor
+    double monitor_sec = 0.;
+    struct timespec then, now;
+    double *work = NULL;    // Copy of each block for the pipeline
+    size_t nwork = 0;
+    // Shared memory publication
+    char shm_name[MAXSTR] = "";
+    // Network sink
+    char net_address[MAXSTR] = "";
+    // Clock drift correction
+    int resample = 0;
+    lct_drift_t drift[MAX_DEV];
+    double *rdata;
+    unsigned int rsamples;
+    // File rotation
+    double segment_bytes = 0., segment_sec = 0.;
 
 // TO DO:
 //  Rewrite option parsing to use optarg
@@ -123,7 +295,7 @@ int main(int argc, char *argv[]){
     // optarg processing is split in two parts:
     // Save the meta parameters for after the configuration file has been 
     // parsed.  (see below)
-    while((go = getopt(argc, argv, "hc:d:n:i:f:s:"))!=-1){
+    while((go = getopt(argc, argv, "hc:d:n:m:p:o:rg:w:v:e:t:i:f:s:"))!=-1){
         switch(go){
         case 'c':
             strcpy(config_file, optarg);
@@ -137,6 +309,96 @@ int main(int argc, char *argv[]){
                 return -1;
             }
         break;
+        case 'm':
+            if(sscanf(optarg, "%lf", &monitor_sec)!=1 || monitor_sec <= 0){
+                fprintf(stderr, "LCRUN: -m requires a positive number of seconds, but got: %s\n", optarg);
+                return -1;
+            }
+        break;
+        case 'p':
+            strcpy(shm_name, optarg);
+        break;
+        case 'o':
+            strcpy(net_address, optarg);
+        break;
+        case 'r':
+            resample = 1;
+        break;
+        case 'g':
+            if(sscanf(optarg, "%lf%c", &ftemp, &stemp[0]) != 2 || ftemp <= 0){
+                fprintf(stderr, "LCRUN: -g requires a size or duration like 500M or 1h, but got: %s\n", optarg);
+                return -1;
+            }
+            switch(stemp[0]){
+            case 'K': segment_bytes = ftemp * 1024.; break;
+            case 'M': segment_bytes = ftemp * 1024. * 1024.; break;
+            case 'G': segment_bytes = ftemp * 1024. * 1024. * 1024.; break;
+            case 's': segment_sec = ftemp; break;
+            case 'm': segment_sec = ftemp * 60.; break;
+            case 'h': segment_sec = ftemp * 3600.; break;
+            default:
+                fprintf(stderr, "LCRUN: -g LIMIT must end with K, M, G, s, m, or h, but got: %s\n", optarg);
+                return -1;
+            }
+        break;
+        case 'w':
+            if(strcmp(optarg, "stdio") == 0)
+                write_mode = LCSINK_STDIO;
+            else if(strcmp(optarg, "uring") == 0)
+                write_mode = LCSINK_URING;
+            else if(strcmp(optarg, "direct") == 0)
+                write_mode = LCSINK_DIRECT;
+            else{
+                fprintf(stderr, "LCRUN: -w must be stdio, uring, or direct, but got: %s\n", optarg);
+                return -1;
+            }
+        break;
+        case 'v':
+            if(sscanf(optarg, "%u", &preview)!=1 || preview < 2){
+                fprintf(stderr, "LCRUN: -v requires an integer of at least 2, but got: %s\n", optarg);
+                return -1;
+            }
+            colon = strchr(optarg, ':');
+            if(colon && strcmp(colon+1, "minmax")){
+                fprintf(stderr, "LCRUN: -v only accepts :minmax after the factor, but got: %s\n", optarg);
+                return -1;
+            }
+            envelope = colon != NULL;
+            if(envelope && preview % 2){
+                fprintf(stderr, "LCRUN: -v FACTOR:minmax requires an even factor, but got: %s\n", optarg);
+                return -1;
+            }
+        break;
+        case 'e':
+            colon = strchr(optarg, ':');
+            if(colon && (sscanf(colon+1, "%u", &nfft) != 1 || nfft < LCFFT_MIN_N 
+                    || nfft > LCFFT_MAX_N || (nfft & (nfft-1)))){
+                fprintf(stderr, "LCRUN: -e NFFT must be a power of two from %d to %d, but got: %s\n",
+                        LCFFT_MIN_N, LCFFT_MAX_N, colon+1);
+                return -1;
+            }
+            stemp[0] = 's';
+            if(sscanf(optarg, "%lf%c", &spectrum_sec, &stemp[0]) < 1 || spectrum_sec <= 0){
+                fprintf(stderr, "LCRUN: -e requires an interval like 30s or 1m, but got: %s\n", optarg);
+                return -1;
+            }
+            switch(stemp[0]){
+            case ':':
+            case 's': break;
+            case 'm': spectrum_sec *= 60.; break;
+            case 'h': spectrum_sec *= 3600.; break;
+            default:
+                fprintf(stderr, "LCRUN: -e INTERVAL must end with s, m, or h, but got: %s\n", optarg);
+                return -1;
+            }
+        break;
+        case 't':
+            if(sscanf(optarg, "%lf", &gate_sec)!=1 || gate_sec < 0){
+                fprintf(stderr, "LCRUN: -t requires a number of seconds, but got: %s\n", optarg);
+                return -1;
+            }
+            gated = 1;
+        break;
         case 'h':
             printf(help_text);
             return 0;
@@ -153,6 +415,30 @@ int main(int argc, char *argv[]){
         }
     }
 
+    // Writing data to stdout; everything else goes to stderr
+    if(strcmp(data_file_base, "-") == 0){
+        fflush(stdout);
+        pipe_fd = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        segment_bytes = segment_sec = 0.;
+        if(preview){
+            fprintf(stderr, "LCRUN: -v needs a data file name; it can't be used with \"-d -\".\n");
+            return -1;
+        }
+        if(gated){
+            fprintf(stderr, "LCRUN: -t needs a data file name; it can't be used with \"-d -\".\n");
+            return -1;
+        }
+    }
+    if(gated && spectrum_sec > 0){
+        fprintf(stderr, "LCRUN: -t and -e can't be used together.\n");
+        return -1;
+    }
+    if(gated && (segment_bytes > 0 || segment_sec > 0)){
+        fprintf(stderr, "LCRUN: -t and -g can't be used together; every event is already its own file.\n");
+        return -1;
+    }
+
     // Load the configuration
     printf("Loading configuration file...");
     if(lc_load(dconf, MAX_DEV, config_file)){
@@ -173,11 +459,20 @@ int main(int argc, char *argv[]){
 
     // go back and process meta parameters
     optind=1;
-    while((go = getopt(argc, argv, "c:d:n:i:f:s:"))!=-1){
+    while((go = getopt(argc, argv, "c:d:n:m:p:o:rg:w:v:e:t:i:f:s:"))!=-1){
         switch(go){
         case 'c':
         case 'd':
         case 'n':
+        case 'm':
+        case 'p':
+        case 'o':
+        case 'r':
+        case 'g':
+        case 'w':
+        case 'v':
+        case 'e':
+        case 't':
         break;
         // It's time; let's process the meta parameters
         case 'f':
@@ -228,8 +523,74 @@ int main(int argc, char *argv[]){
     
     // announce how many devices there are
     printf("Found %d device configurations\n",ndev);
+    if(pipe_fd >= 0 && ndev > 1){
+        fprintf(stderr, "LCRUN: Only one device can be written to stdout.\n");
+        return -1;
+    }
 
     // Before we start the streaming process, setup all the devices
+    // Every device feeds the same list of outputs
+    for(devnum=0; devnum<ndev; devnum++){
+        nsink = 0;
+        lcsink_init(&sink[devnum][nsink], LCSINK_FILE, data_file_base);
+        sink[devnum][nsink].mode = write_mode;
+        sink[devnum][nsink].segment_bytes = segment_bytes;
+        sink[devnum][nsink].segment_sec = segment_sec;
+        if(spectrum_sec > 0){
+            sink[devnum][nsink].type = LCSINK_SPECTRUM;
+            sink[devnum][nsink].spectrum_sec = spectrum_sec;
+            sink[devnum][nsink].nfft = nfft;
+        }
+        if(gated){
+            if(dconf[devnum].trigchannel >= LC_TRIG_EFOFFSET){
+                fprintf(stderr, "LCRUN: -t needs a software trigger, but device %d has a hardware trigger.\n", devnum);
+                return -1;
+            }
+            ftemp = dconf[devnum].samplehz / (dconf[devnum].downsample + 1);
+            sink[devnum][nsink].type = LCSINK_GATED;
+            sink[devnum][nsink].gate_channel = dconf[devnum].trigchannel;
+            sink[devnum][nsink].gate_level = dconf[devnum].triglevel;
+            sink[devnum][nsink].gate_edge = dconf[devnum].trigedge;
+            sink[devnum][nsink].gate_pre = dconf[devnum].trigpre / (dconf[devnum].downsample + 1);
+            sink[devnum][nsink].gate_post = gate_sec * ftemp;
+            // The events replace the trigger, so the stream starts at once
+            dconf[devnum].trigchannel = -1;
+        }
+        if(pipe_fd >= 0){
+            // Pipes always carry frames, so readers can tell where blocks end
+            sink[devnum][nsink].mode = LCSINK_PIPE;
+            sink[devnum][nsink].fd = pipe_fd;
+            sink[devnum][nsink].format = LC_DF_FRAMED;
+        }
+        nsink++;
+        if(preview){
+            if(snprintf(stemp, MAXSTR, "%s_preview", data_file_base) >= MAXSTR){
+                fprintf(stderr, "LCRUN: The data file name is too long for a preview: %s\n", data_file_base);
+                return -1;
+            }
+            lcsink_init(&sink[devnum][nsink], LCSINK_FILE, stemp);
+            sink[devnum][nsink].mode = write_mode;
+            sink[devnum][nsink].decimate = preview;
+            sink[devnum][nsink].envelope = envelope;
+            nsink++;
+        }
+        if(shm_name[0]){
+            if(ndev == 1)
+                strcpy(stemp, shm_name);
+            else
+                snprintf(stemp, MAXSTR, "%s_%d", shm_name, devnum);
+            lcsink_init(&sink[devnum][nsink++], LCSINK_SHM, stemp);
+        }
+        if(net_address[0])
+            lcsink_init(&sink[devnum][nsink++], LCSINK_NET, net_address);
+        drift[devnum].out = NULL;
+    }
+    // The event loop takes the termination signals, so they must be blocked
+    // before LJM starts any threads
+    if(lct_loop_block_signals()){
+        halt();
+        return -1;
+    }
     for(devnum=0; devnum<ndev; devnum++){
         printf("Setting up device %d of %d...", devnum,ndev);
         fflush(stdout);
@@ -245,19 +606,6 @@ int main(int argc, char *argv[]){
             halt();
             return -1;
         }
-        
-        // Prepare the data file
-        if(ndev == 1)
-            sprintf(data_file, "%s.dat", data_file_base, devnum);
-        else
-            sprintf(data_file, "%s_%d.dat", data_file_base, devnum);
-        dfile[devnum] = fopen(data_file,"wb");
-        if(dfile[devnum] == NULL){
-            fprintf(stderr, "LCRUN: Failed to open data file: %s\n", data_file);
-            halt();
-            return -1;
-        }
-        lc_datafile_init(&dconf[devnum], dfile[devnum]);
         printf("DONE.\n");
     }
 
@@ -274,35 +622,139 @@ int main(int argc, char *argv[]){
             halt();
             return -1;
         }
+        // Shared memory is sized from the running stream, and receivers
+        // get its start time, so the outputs open once it is running.
+        for(sinknum=0; sinknum<nsink; sinknum++){
+            if(lcsink_open(&sink[devnum][sinknum], &dconf[devnum], devnum, ndev)){
+                fprintf(stderr, "LCRUN: Failed to open output %s for device %d of %d.\n", 
+                        sink[devnum][sinknum].name, devnum, ndev);
+                halt();
+                return -1;
+            }
+        }
+        if(resample && lct_drift_init(&drift[devnum], &dconf[devnum])){
+            fprintf(stderr, "LCRUN: Failed to set up the clock correction for device %d of %d.\n", devnum, ndev);
+            halt();
+            return -1;
+        }
     }
 
+    // Sleep until a device has a block ready, the user presses a key, or
+    // we are signaled to quit.
+    if(lct_loop_init(&loop, dconf, ndev, LCT_LOOP_STDIN | LCT_LOOP_SIGNAL)){
+        fprintf(stderr, "LCRUN: Failed to initialize the event loop.\n");
+        lct_finish_keypress();
+        halt();
+        return -1;
+    }
     go = 1;
-    lct_idle_init(&idle, 1000, 50);
+    clock_gettime(CLOCK_MONOTONIC, &then);
     while(go){
+        // Wake up for the monitor even if the devices are quiet
+        events = lct_loop_wait(&loop, monitor_sec > 0 ? (int)(monitor_sec * 1000) : -1);
+        if(events < 0){
+            fprintf(stderr, "LCRUN: failed while waiting for the devices.\n");
+            lct_loop_close(&loop);
+            lct_finish_keypress();
+            halt();
+            return -1;
+        }
         for(devnum=0; devnum<ndev; devnum++){
-            if(lc_stream_service(&dconf[devnum])){
+            if(lct_loop_service(&loop, devnum)){
                 fprintf(stderr, "LCRUN: failed while trying to service device %d of %d\n", devnum, ndev);
+                lct_loop_close(&loop);
                 lct_finish_keypress();
                 halt();
                 return -1;
             }
-            // If data came in
-            if(!lc_stream_isempty(&dconf[devnum])){
-                fflush(stdout);
-                lc_stream_read(&dconf[devnum], &data, &channels, &samples_per_read);
-                lc_stream_downsample(&dconf[devnum], data, channels, &samples_per_read);
-                lc_datafile_write(&dconf[devnum], dfile[devnum], data, channels, samples_per_read);
+            // If data came in, write all of it at once
+            while(!lc_stream_read_bulk(&dconf[devnum], &data, &channels, &samples_per_read)){
+                samples_read = samples_per_read;
+                // Publish the raw data before they are downsampled in place
+                for(sinknum=0; sinknum<nsink; sinknum++)
+                    lcsink_raw(&sink[devnum][sinknum], data, samples_read);
+                // The monitor peeks at scans that have already been read, so
+                // they must not be compacted in place while it is running.
+                if(monitor_sec > 0 && dconf[devnum].downsample > 0){
+                    if((size_t) channels * samples_per_read > nwork){
+                        free(work);
+                        nwork = (size_t) channels * samples_per_read;
+                        work = malloc(nwork * sizeof(double));
+                        if(work == NULL){
+                            fprintf(stderr, "LCRUN: Failed to allocate a copy of the data for the monitor.\n");
+                            lct_loop_close(&loop);
+                            lct_finish_keypress();
+                            halt();
+                            return -1;
+                        }
+                    }
+                    memcpy(work, data, (size_t) channels * samples_per_read * sizeof(double));
+                    data = work;
+                }
+                lct_pipeline(&dconf[devnum], data, channels, &samples_per_read, 0, NULL, 0);
+                rdata = data;
+                rsamples = samples_per_read;
+                if(resample && lct_drift_apply(&drift[devnum], &dconf[devnum], 
+                        data, channels, samples_per_read, &rdata, &rsamples)){
+                    fprintf(stderr, "LCRUN: Failed to correct the clock of device %d of %d\n", devnum, ndev);
+                    lct_loop_close(&loop);
+                    lct_finish_keypress();
+                    halt();
+                    return -1;
+                }
+                // Every output reads the same block in place
+                for(sinknum=0; sinknum<nsink; sinknum++){
+                    if(lcsink_write(&sink[devnum][sinknum], rdata, channels, rsamples)){
+                        lct_loop_close(&loop);
+                        lct_finish_keypress();
+                        halt();
+                        return -1;
+                    }
+                }
+                lc_stream_release_bulk(&dconf[devnum], samples_read);
+            }
+        }
+        // Update the live monitor
+        if(monitor_sec > 0){
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if((now.tv_sec - then.tv_sec) + 1e-9*(now.tv_nsec - then.tv_nsec) >= monitor_sec){
+                then = now;
+                monitor(dconf, ndev);
             }
         }
         // Test for exit conditions
-        if(lct_is_keypress() && getchar() == 'Q')
+        if(events & LCT_EV_KEY && getchar() == 'Q')
+            go = 0;
+        if(events & LCT_EV_SIGNAL)
             go = 0;
-        fflush(stdout);
-        lct_idle(&idle);
     }
+    lct_loop_close(&loop);
     lct_finish_keypress();
 
+    for(devnum=0; devnum<ndev; devnum++){
+        for(sinknum=0; sinknum<nsink; sinknum++){
+            if(sink[devnum][sinknum].net.dropped)
+                fprintf(stderr, "LCRUN: %llu blocks from device %d were not sent because the receiver fell behind.\n",
+                        (unsigned long long) sink[devnum][sinknum].net.dropped, devnum);
+            if(sink[devnum][sinknum].type == LCSINK_GATED)
+                fprintf(stderr, "LCRUN: Device %d recorded %u events in %llu scans (%s).\n", devnum,
+                        sink[devnum][sinknum].events, 
+                        (unsigned long long) sink[devnum][sinknum].gate_scan,
+                        sink[devnum][sinknum].name);
+            if(sink[devnum][sinknum].aio.fd >= 0 && sink[devnum][sinknum].aio.stalls)
+                fprintf(stderr, "LCRUN: Device %d waited on the disk %llu times (%s).\n", devnum,
+                        (unsigned long long) sink[devnum][sinknum].aio.stalls, 
+                        sink[devnum][sinknum].name);
+        }
+    }
+    if(resample)
+        printf("\n");
+    for(devnum=0; devnum<ndev && resample; devnum++)
+        printf("Device %d clock: %+.1f ppm\n", devnum, 
+                drift[devnum].valid ? 1e6 * (drift[devnum].rate / drift[devnum].nominal - 1.) : 0.);
     halt();
+    if(monitor_sec > 0)
+        printf("\n");
     printf("Exited successfully.\n");
     return 0;
 }
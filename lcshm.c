@@ -0,0 +1,281 @@
+/*
+  This file is part of the LCONFIG laboratory configuration system.
+
+    LCONFIG is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    LCONFIG is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with LCONFIG.  If not, see <https://www.gnu.org/licenses/>.
+
+    Authored by C.Martin crm28@psu.edu
+*/
+
+#include "lcshm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+// Round X up to the next multiple of LCSHM_ALIGN
+#define align(X)    ((((X) + LCSHM_ALIGN - 1) / LCSHM_ALIGN) * LCSHM_ALIGN)
+
+
+// Copy NAME into the handle with a leading '/'
+void name_segment(lcshm_t *shm, const char *name){
+    if(name[0] == '/')
+        snprintf(shm->name, LC_MAX_STR, "%s", name);
+    else
+        snprintf(shm->name, LC_MAX_STR, "/%s", name);
+}
+
+// Point to the sequence number at the start of a slot
+uint64_t* slot_seq(lcshm_t *shm, uint64_t block){
+    lcshm_header_t *H = shm->header;
+    return (uint64_t*) ((char*) H + H->block_offset +
+            (block % H->nblocks) * H->block_bytes);
+}
+
+
+int lcshm_create(lcshm_t *shm, const char *name, lc_devconf_t *dconf,
+        unsigned int nblocks){
+    lcshm_header_t *H;
+    char *config = NULL;
+    size_t config_bytes = 0;
+    uint64_t block_bytes, config_offset, block_offset;
+    unsigned int channels, samples_per_read;
+    FILE *ff;
+    int fd;
+
+    shm->header = NULL;
+    shm->writer = 1;
+    shm->next = 0;
+    shm->dropped = 0;
+    name_segment(shm, name);
+
+    // The block size comes from the running stream, since it may have
+    // been tuned (see LC_STREAM_AUTOTUNE())
+    channels = dconf->RB.channels;
+    samples_per_read = dconf->RB.samples_per_read;
+    if(!dconf->RB.buffer || channels == 0 || samples_per_read == 0){
+        fprintf(stderr, "LCSHM: The device stream must be started before it is published.\n");
+        return LC_ERROR;
+    }
+    if(nblocks == 0)
+        nblocks = ceil(LCSHM_SECONDS * dconf->samplehz / samples_per_read);
+    if(nblocks < LCSHM_MIN_BLOCKS)
+        nblocks = LCSHM_MIN_BLOCKS;
+
+    // Render the configuration
+    ff = open_memstream(&config, &config_bytes);
+    if(ff == NULL){
+        fprintf(stderr, "LCSHM: Failed to render the configuration.\n");
+        return LC_ERROR;
+    }
+    lc_write(dconf, ff);
+    fclose(ff);
+
+    // Lay out the segment
+    config_offset = align(sizeof(lcshm_header_t));
+    block_offset = align(config_offset + config_bytes + 1);
+    block_bytes = sizeof(uint64_t) +
+            (uint64_t) channels * samples_per_read * sizeof(double);
+    shm->bytes = block_offset + nblocks * block_bytes;
+
+    // Replace any stale segment left over from a crash
+    shm_unlink(shm->name);
+    fd = shm_open(shm->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if(fd < 0){
+        fprintf(stderr, "LCSHM: Failed to create shared memory segment %s\n", shm->name);
+        free(config);
+        return LC_ERROR;
+    }
+    if(ftruncate(fd, shm->bytes)){
+        fprintf(stderr, "LCSHM: Failed to allocate %zu bytes for segment %s\n",
+                shm->bytes, shm->name);
+        close(fd);
+        shm_unlink(shm->name);
+        free(config);
+        return LC_ERROR;
+    }
+    H = mmap(NULL, shm->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(H == MAP_FAILED){
+        fprintf(stderr, "LCSHM: Failed to map segment %s\n", shm->name);
+        shm_unlink(shm->name);
+        free(config);
+        return LC_ERROR;
+    }
+
+    // The new segment is already zeroed, so every slot is marked invalid.
+    H->version = LCSHM_VERSION;
+    H->channels = channels;
+    H->samples_per_read = samples_per_read;
+    H->nblocks = nblocks;
+    H->closed = 0;
+    H->config_offset = config_offset;
+    H->config_bytes = config_bytes;
+    H->block_offset = block_offset;
+    H->block_bytes = block_bytes;
+    H->samplehz = dconf->samplehz;
+    H->head = 0;
+    memcpy((char*) H + config_offset, config, config_bytes);
+    free(config);
+    // Readers ignore the segment until the magic number appears
+    __atomic_store_n(&H->magic, LCSHM_MAGIC, __ATOMIC_RELEASE);
+
+    shm->header = H;
+    return LC_NOERR;
+}
+
+
+int lcshm_publish(lcshm_t *shm, const double *data, unsigned int samples){
+    lcshm_header_t *H = shm->header;
+    uint64_t *seq, head;
+    size_t values;
+    unsigned int ii;
+
+    if(!H || !shm->writer || samples % H->samples_per_read)
+        return LC_ERROR;
+
+    values = (size_t) H->channels * H->samples_per_read;
+    head = H->head;
+    for(ii=0; ii<samples; ii+=H->samples_per_read){
+        seq = slot_seq(shm, head);
+        // Mark the slot invalid before any of the data change
+        __atomic_store_n(seq, 0, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        memcpy(seq + 1, data, values * sizeof(double));
+        data += values;
+        head++;
+        // Then make the data visible before the sequence number
+        __atomic_store_n(seq, head, __ATOMIC_RELEASE);
+        __atomic_store_n(&H->head, head, __ATOMIC_RELEASE);
+    }
+    return LC_NOERR;
+}
+
+
+int lcshm_attach(lcshm_t *shm, const char *name){
+    lcshm_header_t *H;
+    struct stat st;
+    int fd;
+
+    shm->header = NULL;
+    shm->writer = 0;
+    shm->dropped = 0;
+    name_segment(shm, name);
+
+    fd = shm_open(shm->name, O_RDONLY, 0);
+    if(fd < 0)
+        return LC_ERROR;
+    if(fstat(fd, &st) || st.st_size < sizeof(lcshm_header_t)){
+        close(fd);
+        return LC_ERROR;
+    }
+    shm->bytes = st.st_size;
+    H = mmap(NULL, shm->bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(H == MAP_FAILED)
+        return LC_ERROR;
+
+    // Check the header before trusting any of the offsets
+    if(__atomic_load_n(&H->magic, __ATOMIC_ACQUIRE) != LCSHM_MAGIC
+            || H->version != LCSHM_VERSION
+            || H->block_offset + (uint64_t) H->nblocks * H->block_bytes > shm->bytes
+            || H->config_offset + H->config_bytes >= H->block_offset){
+        fprintf(stderr, "LCSHM: %s is not a valid stream segment.\n", shm->name);
+        munmap(H, shm->bytes);
+        return LC_ERROR;
+    }
+    shm->header = H;
+    shm->next = __atomic_load_n(&H->head, __ATOMIC_ACQUIRE);
+    return LC_NOERR;
+}
+
+
+const char* lcshm_config(lcshm_t *shm){
+    if(!shm->header)
+        return NULL;
+    return (const char*) shm->header + shm->header->config_offset;
+}
+
+
+int lcshm_read(lcshm_t *shm, const double **data, unsigned int *channels,
+        unsigned int *samples){
+    lcshm_header_t *H = shm->header;
+    uint64_t head;
+
+    *data = NULL;
+    *samples = 0;
+    if(!H)
+        return LC_ERROR;
+    *channels = H->channels;
+
+    head = __atomic_load_n(&H->head, __ATOMIC_ACQUIRE);
+    // The slot after head may be in the middle of a write, so only N-1
+    // blocks are safe.  Skip ahead if we have been lapped.
+    if(head - shm->next >= H->nblocks){
+        shm->dropped += head - shm->next - (H->nblocks - 1);
+        shm->next = head - (H->nblocks - 1);
+    }
+    if(shm->next >= head)
+        return LC_ERROR;
+    // The writer could have lapped us since we read head
+    if(__atomic_load_n(slot_seq(shm, shm->next), __ATOMIC_ACQUIRE) != shm->next + 1){
+        shm->dropped ++;
+        shm->next ++;
+        return LCSHM_LAPPED;
+    }
+    *data = (const double*) (slot_seq(shm, shm->next) + 1);
+    *samples = H->samples_per_read;
+    return LC_NOERR;
+}
+
+
+int lcshm_release(lcshm_t *shm){
+    uint64_t seq;
+
+    if(!shm->header)
+        return LC_ERROR;
+    // All of the reader's loads from the block must be complete before the
+    // sequence number is checked again.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    seq = __atomic_load_n(slot_seq(shm, shm->next), __ATOMIC_RELAXED);
+    shm->next ++;
+    if(seq != shm->next){
+        shm->dropped ++;
+        return LC_ERROR;
+    }
+    return LC_NOERR;
+}
+
+
+int lcshm_isclosed(lcshm_t *shm){
+    if(!shm->header)
+        return 1;
+    return __atomic_load_n(&shm->header->closed, __ATOMIC_ACQUIRE) != 0;
+}
+
+
+void lcshm_close(lcshm_t *shm){
+    if(!shm->header)
+        return;
+    if(shm->writer){
+        __atomic_store_n(&shm->header->closed, 1, __ATOMIC_RELEASE);
+        shm_unlink(shm->name);
+    }
+    munmap(shm->header, shm->bytes);
+    shm->header = NULL;
+}
@@ -0,0 +1,183 @@
+/*
+  This file is part of the LCONFIG laboratory configuration system.
+
+    LCONFIG is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    LCONFIG is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with LCONFIG.  If not, see <https://www.gnu.org/licenses/>.
+
+    Authored by C.Martin crm28@psu.edu
+*/
+
+/*  The LCSHM header exposes a live stream to other processes through a named
+POSIX shared memory segment.  One process (the writer) owns the device and
+publishes every block it reads.  Any number of readers may attach to the
+segment by name, recover the device configuration, and process the blocks
+in place without copying them and without any way to slow down the writer.
+
+The segment is laid out as
+
+    [lcshm_header_t][configuration text][slot 0][slot 1]...[slot N-1]
+
+The configuration text is exactly what LC_WRITE() would produce for the
+device, so readers can rebuild the device configuration with
+LC_LOAD_STRING().  Each slot holds one block of SAMPLES_PER_READ scans
+preceded by a 64-bit sequence number.  The block size matches the writer's
+ring buffer (RB.SAMPLES_PER_READ), which may differ from NSAMPLE when the
+block size was tuned automatically.  Block number K is always written to
+slot K % N.  While the writer is changing a slot, its sequence number is
+zero.  Once the block is complete, the sequence number is set to K+1.
+Readers check the sequence number before and after they use a block, so a
+block that was overwritten while it was being read is detected and
+discarded.  Readers that fall more than N-1 blocks behind skip ahead and
+count the blocks they missed.
+
+CHANGELOG
+
+v1.1    10/2026
+- LCSHM_READ() returns LCSHM_LAPPED instead of LC_ERROR when a block was 
+  lost, so readers can tell lost data from an idle stream.
+
+v1.0    10/2026     ORIGINAL RELEASE
+*/
+
+#ifndef __LCSHM
+#define __LCSHM
+
+#include "lconfig.h"
+#include <stdint.h>
+
+#define LCSHM_MAGIC     0x4c43534dU     // "LCSM"
+#define LCSHM_VERSION   1
+#define LCSHM_SECONDS   2.0     // Seconds of data kept in a segment by default
+#define LCSHM_MIN_BLOCKS 16     // Fewest slots allowed in a segment
+#define LCSHM_ALIGN     64      // Alignment of the segment regions
+#define LCSHM_LAPPED    1       // LCSHM_READ() lost a block to the writer
+
+
+/* LCSHM_HEADER_T
+The header at the start of every shared memory segment.  The writer sets
+MAGIC last, so readers that see a valid MAGIC can trust the rest of the
+header.  HEAD is the number of blocks that have been completely written.
+*/
+typedef struct __lcshm_header_t__ {
+    uint32_t magic;             // LCSHM_MAGIC once the segment is ready
+    uint32_t version;           // LCSHM_VERSION
+    uint32_t channels;          // Channels per scan
+    uint32_t samples_per_read;  // Scans per block
+    uint32_t nblocks;           // Number of block slots
+    uint32_t closed;            // Set when the writer is finished
+    uint64_t config_offset;     // Byte offset of the configuration text
+    uint64_t config_bytes;      // Length of the configuration text
+    uint64_t block_offset;      // Byte offset of slot 0
+    uint64_t block_bytes;       // Bytes in each slot including its sequence
+    double samplehz;            // Scan rate in Hz
+    uint64_t head;              // Number of blocks published
+} lcshm_header_t;
+
+
+/* LCSHM_T
+The handle for one end of a shared memory segment.  The same struct is used
+by writers and readers.  NEXT is the next block a reader expects, and
+DROPPED counts the blocks a reader missed because the writer lapped it.
+*/
+typedef struct __lcshm_t__ {
+    int writer;                 // Nonzero if this handle created the segment
+    size_t bytes;               // Size of the mapping
+    char name[LC_MAX_STR];      // Name of the segment
+    lcshm_header_t *header;     // The mapped segment or NULL
+    uint64_t next;              // The next block to read
+    uint64_t dropped;           // Blocks missed by this reader
+} lcshm_t;
+
+
+/* LCSHM_CREATE
+Create a new shared memory segment called NAME for the device configured in
+DCONF and map it into memory.  The segment has room for NBLOCKS blocks, each
+the size of the blocks in the device's ring buffer.  If NBLOCKS is zero, 
+enough blocks are allocated for about LCSHM_SECONDS of data (never fewer than
+LCSHM_MIN_BLOCKS).  A leading
+'/' is added to NAME if it is missing.  Any stale segment by the same name
+is removed first.
+
+The stream must already be started with LC_STREAM_START(), and the block size
+must not change while the segment is in use.
+
+Returns LC_NOERR on success and LC_ERROR on failure.
+*/
+int lcshm_create(lcshm_t *shm, const char *name, lc_devconf_t *dconf,
+        unsigned int nblocks);
+
+/* LCSHM_PUBLISH
+Publish SAMPLES scans from DATA to readers.  DATA must be in the same order
+as the stream data (see LC_STREAM_READ_BULK()), and SAMPLES must be a whole
+number of blocks.  Blocks are copied into the segment one at a time, so
+readers may begin working on the first block before the last is written.
+
+Returns LC_NOERR on success and LC_ERROR if SAMPLES is not a whole number
+of blocks.
+*/
+int lcshm_publish(lcshm_t *shm, const double *data, unsigned int samples);
+
+/* LCSHM_ATTACH
+Attach to an existing shared memory segment called NAME for reading.  The
+reader starts with the next block published, so old data in the segment
+are ignored.
+
+Returns LC_NOERR on success and LC_ERROR if the segment does not exist or is
+not a valid LCONFIG stream.
+*/
+int lcshm_attach(lcshm_t *shm, const char *name);
+
+/* LCSHM_CONFIG
+Returns a pointer to the NUL-terminated configuration text stored in the
+segment.  This may be passed directly to LC_LOAD_STRING().
+*/
+const char* lcshm_config(lcshm_t *shm);
+
+/* LCSHM_READ
+LCSHM_RELEASE
+Get a pointer to the next block in the segment without copying it.  DATA is
+pointed to the block, CHANNELS is set to the number of channels, and SAMPLES
+is set to the number of scans in the block.  If no new block is available,
+DATA is set to NULL, SAMPLES is set to zero, and LC_ERROR is returned.  If 
+the next block was overwritten by the writer before it could be read, it is
+counted in DROPPED, DATA is set to NULL, and LCSHM_LAPPED is returned; the 
+reader should call LCSHM_READ() again for the block after it.  Blocks 
+skipped because the reader fell a whole segment behind are also counted in
+DROPPED, so an idle stream never changes DROPPED, and lost data always do.
+
+The block belongs to the writer, so it must not be modified, and it may be
+overwritten at any time if the reader falls behind.  Once the reader is
+finished with the block, LCSHM_RELEASE() checks whether that happened and
+advances to the next block.  LCSHM_RELEASE() returns LC_NOERR if the block
+was intact and LC_ERROR if it was overwritten while in use, in which case
+any results computed from it should be discarded.
+*/
+int lcshm_read(lcshm_t *shm, const double **data, unsigned int *channels,
+        unsigned int *samples);
+
+int lcshm_release(lcshm_t *shm);
+
+/* LCSHM_ISCLOSED
+Returns 1 if the writer has closed the segment and 0 otherwise.  Blocks that
+were published before the writer closed may still be read.
+*/
+int lcshm_isclosed(lcshm_t *shm);
+
+/* LCSHM_CLOSE
+Unmap the segment.  When called by the writer, readers are notified that the
+stream has ended and the segment name is removed.  The memory is freed once
+the last reader closes.
+*/
+void lcshm_close(lcshm_t *shm);
+
+#endif
@@ -0,0 +1,524 @@
+/*
+  This file is part of the LCONFIG laboratory configuration system.
+
+    LCONFIG is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    LCONFIG is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with LCONFIG.  If not, see <https://www.gnu.org/licenses/>.
+
+    Authored by C.Martin crm28@psu.edu
+*/
+
+#include "lcsink.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+
+// Open the data file (or the next segment) and write its header
+int open_file(lcsink_t *sink){
+    char filename[LCSINK_MAX_NAME + 32];
+
+    clock_gettime(CLOCK_MONOTONIC, &sink->segment_start);
+    if(sink->mode == LCSINK_PIPE){
+        if(lcaio_open_fd(&sink->aio, sink->fd))
+            return LC_ERROR;
+        // The writer owns the descriptor now
+        sink->fd = -1;
+        return lcaio_datafile_init(&sink->conf, &sink->aio);
+    }
+
+    if(sink->segment < 0 && sink->ndev == 1)
+        sprintf(filename, "%s.dat", sink->name);
+    else if(sink->segment < 0)
+        sprintf(filename, "%s_%u.dat", sink->name, sink->device);
+    else if(sink->ndev == 1)
+        sprintf(filename, "%s.%04d.dat", sink->name, sink->segment);
+    else
+        sprintf(filename, "%s_%u.%04d.dat", sink->name, sink->device, sink->segment);
+
+    if(sink->mode != LCSINK_STDIO){
+        if(lcaio_open(&sink->aio, filename, sink->mode == LCSINK_DIRECT ? LCAIO_DIRECT : 0)){
+            fprintf(stderr, "LCSINK: Failed to open data file: %s\n", filename);
+            return LC_ERROR;
+        }
+        if(sink->segment < 0)
+            return lcaio_datafile_init(&sink->conf, &sink->aio);
+        return lcaio_datafile_segment(&sink->conf, &sink->aio, sink->segment, sink->scans);
+    }
+    sink->ff = fopen(filename, "wb");
+    if(sink->ff == NULL){
+        fprintf(stderr, "LCSINK: Failed to open data file: %s\n", filename);
+        return LC_ERROR;
+    }
+    if(sink->segment < 0)
+        lc_datafile_init(&sink->conf, sink->ff);
+    else
+        lc_datafile_segment(&sink->conf, sink->ff, sink->segment, sink->scans);
+    return LC_NOERR;
+}
+
+
+// Write the final index and close the data file.  Safe to call twice.
+void close_file(lcsink_t *sink){
+    if(sink->ff){
+        lc_datafile_checkpoint(&sink->conf, sink->ff);
+        fclose(sink->ff);
+        sink->ff = NULL;
+    }
+    if(sink->aio.fd >= 0)
+        lcaio_datafile_checkpoint(&sink->conf, &sink->aio);
+    lcaio_close(&sink->aio);
+}
+
+
+// Bytes written to the current data file so far
+uint64_t tell_file(lcsink_t *sink){
+    if(sink->ff)
+        return ftell(sink->ff);
+    return lcaio_tell(&sink->aio);
+}
+
+
+// Make sure the sink's buffer holds at least NEED doubles
+int reserve(lcsink_t *sink, size_t need){
+    if(need > sink->size){
+        free(sink->buffer);
+        sink->buffer = malloc(need * sizeof(double));
+        sink->size = sink->buffer ? need : 0;
+        if(sink->buffer == NULL)
+            return LC_ERROR;
+    }
+    return LC_NOERR;
+}
+
+
+// Average every DECIMATE scans into the sink's buffer.  A partial group is
+// carried over to the next block.  Returns the number of averaged scans.
+unsigned int decimate(lcsink_t *sink, const double *data, unsigned int channels,
+        unsigned int samples){
+    double *dest, scale;
+    unsigned int ii, ch, out = 0;
+
+    if(reserve(sink, ((size_t) samples / sink->decimate + 1) * channels))
+        return 0;
+    if(sink->acc == NULL){
+        sink->acc = calloc(channels, sizeof(double));
+        if(sink->acc == NULL)
+            return 0;
+    }
+    scale = 1. / sink->decimate;
+    for(ii=0; ii<samples; ii++, data+=channels){
+        for(ch=0; ch<channels; ch++)
+            sink->acc[ch] += data[ch];
+        if(++sink->count == sink->decimate){
+            dest = &sink->buffer[(size_t) out * channels];
+            for(ch=0; ch<channels; ch++){
+                dest[ch] = sink->acc[ch] * scale;
+                sink->acc[ch] = 0.;
+            }
+            sink->count = 0;
+            out++;
+        }
+    }
+    return out;
+}
+
+
+// Keep the minimum and maximum of every DECIMATE scans in the sink's 
+// buffer as two scans.  A partial group is carried over to the next block.
+// Returns the number of scans in the buffer.
+unsigned int envelope(lcsink_t *sink, const double *data, unsigned int channels,
+        unsigned int samples){
+    double *lo, *hi, *dest;
+    unsigned int ii, ch, out = 0;
+
+    if(reserve(sink, ((size_t) samples / sink->decimate + 1) * 2 * channels))
+        return 0;
+    if(sink->acc == NULL){
+        sink->acc = malloc(2 * channels * sizeof(double));
+        if(sink->acc == NULL)
+            return 0;
+    }
+    lo = sink->acc;
+    hi = sink->acc + channels;
+    for(ii=0; ii<samples; ii++, data+=channels){
+        if(sink->count == 0){
+            memcpy(lo, data, channels * sizeof(double));
+            memcpy(hi, data, channels * sizeof(double));
+        }else{
+            for(ch=0; ch<channels; ch++){
+                lo[ch] = data[ch] < lo[ch] ? data[ch] : lo[ch];
+                hi[ch] = data[ch] > hi[ch] ? data[ch] : hi[ch];
+            }
+        }
+        if(++sink->count == sink->decimate){
+            dest = &sink->buffer[(size_t) out * channels];
+            memcpy(dest, lo, channels * sizeof(double));
+            memcpy(dest + channels, hi, channels * sizeof(double));
+            sink->count = 0;
+            out += 2;
+        }
+    }
+    return out;
+}
+
+
+// Write SAMPLES scans to the data file and start the next segment if it
+// is due
+int write_file(lcsink_t *sink, const double *data, unsigned int channels,
+        unsigned int samples){
+    struct timespec now;
+    int err;
+
+    if(sink->ff)
+        err = lc_datafile_write(&sink->conf, sink->ff, (double*) data, channels, samples);
+    else
+        err = lcaio_datafile_write(&sink->conf, &sink->aio, data, channels, samples);
+    if(err){
+        fprintf(stderr, "LCSINK: Failed to write the data file for device %u (%s).\n",
+                sink->device, sink->name);
+        return LC_ERROR;
+    }
+    sink->scans += samples;
+    // Start the next segment between writes so nothing is lost
+    if(sink->segment >= 0){
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if((sink->segment_bytes > 0 && tell_file(sink) >= sink->segment_bytes) ||
+                (sink->segment_sec > 0 && (now.tv_sec - sink->segment_start.tv_sec) +
+                1e-9*(now.tv_nsec - sink->segment_start.tv_nsec) >= sink->segment_sec)){
+            close_file(sink);
+            sink->segment++;
+            return open_file(sink);
+        }
+    }
+    return LC_NOERR;
+}
+
+
+// Write the average spectrum so far as BINS rows of RMS amplitudes and 
+// start the next one
+int write_spectrum(lcsink_t *sink){
+    unsigned int k, ch, bins = sink->welch.bins, channels = sink->welch.channels;
+
+    if(lcfft_welch_update(&sink->welch, 1) == 0)
+        return LC_NOERR;
+    for(k=0; k<bins; k++)
+        for(ch=0; ch<channels; ch++)
+            sink->spectrum[k * channels + ch] = 
+                    sqrt(sink->welch.psd[ch * bins + k] * sink->welch.df);
+    return write_file(sink, sink->spectrum, channels, bins);
+}
+
+
+// Prepare the spectrum and describe it in the header
+int open_spectrum(lcsink_t *sink){
+    unsigned int ch;
+    double samplehz;
+
+    if(lcfft_welch_init(&sink->welch, &sink->conf, lc_nistream(&sink->conf), 
+            sink->nfft, 0, 1))
+        return LC_ERROR;
+    // The amplitudes are in volts, so only the slope of the calibration
+    // applies to them
+    for(ch=0; ch<sink->welch.channels; ch++){
+        sink->welch.slope[ch] = 1.;
+        sink->welch.zero[ch] = 0.;
+        if(ch < sink->conf.naich)
+            sink->conf.aich[ch].calzero = 0.;
+    }
+    sink->spectrum = malloc((size_t) sink->welch.bins * sink->welch.channels * sizeof(double));
+    if(sink->spectrum == NULL){
+        fprintf(stderr, "LCSINK: Failed to allocate the spectrum for %s.\n", sink->name);
+        return LC_ERROR;
+    }
+    samplehz = sink->conf.samplehz / (sink->conf.downsample + 1);
+    sink->interval = sink->spectrum_sec * samplehz;
+    if(sink->interval < sink->nfft)
+        sink->interval = sink->nfft;
+    sink->counted = 0;
+    lc_meta_put_int(&sink->conf, "spectrum_nfft", sink->nfft);
+    lc_meta_put_int(&sink->conf, "spectrum_bins", sink->welch.bins);
+    lc_meta_put_flt(&sink->conf, "spectrum_df", sink->welch.df);
+    lc_meta_put_flt(&sink->conf, "spectrum_sec", sink->interval / samplehz);
+    return LC_NOERR;
+}
+
+
+// Describe the gate in the header.  The first event is segment zero.
+int open_gate(lcsink_t *sink){
+    const char *edge;
+
+    if(sink->mode == LCSINK_PIPE){
+        fprintf(stderr, "LCSINK: Events are written to separate files, so %s can't be a pipe.\n",
+                sink->name);
+        return LC_ERROR;
+    }
+    if(sink->segment_bytes > 0 || sink->segment_sec > 0){
+        fprintf(stderr, "LCSINK: Events are their own segments, so %s can't also be segmented by size or time.\n",
+                sink->name);
+        return LC_ERROR;
+    }
+    if(sink->gate_channel >= (int) sink->conf.naich){
+        fprintf(stderr, "LCSINK: The gate channel %d is not one of the %d analog inputs.\n",
+                sink->gate_channel, sink->conf.naich);
+        return LC_ERROR;
+    }
+    memset(sink->gate_above, -1, sizeof(sink->gate_above));
+    sink->hist_head = sink->hist_fill = 0;
+    sink->gate_scan = 0;
+    sink->gate_left = 0;
+    sink->events = 0;
+    sink->segment = 0;
+    edge = sink->gate_edge == LC_EDGE_RISING ? "rising" : 
+            (sink->gate_edge == LC_EDGE_FALLING ? "falling" : "all");
+    lc_meta_put_int(&sink->conf, "gate_channel", sink->gate_channel);
+    lc_meta_put_flt(&sink->conf, "gate_level", sink->gate_level);
+    lc_meta_put_str(&sink->conf, "gate_edge", (char*) edge);
+    lc_meta_put_int(&sink->conf, "gate_pre", sink->gate_pre);
+    lc_meta_put_int(&sink->conf, "gate_post", sink->gate_post);
+    return LC_NOERR;
+}
+
+
+// Returns 1 if the scan at DATA is active
+int gate_test(lcsink_t *sink, const double *data, unsigned int channels){
+    unsigned int ch, first, last;
+    int above, active = 0;
+
+    first = sink->gate_channel < 0 ? 0 : sink->gate_channel;
+    last = sink->gate_channel < 0 ? sink->conf.naich : first + 1;
+    last = last < channels ? last : channels;
+    for(ch=first; ch<last; ch++){
+        above = data[ch] > sink->gate_level;
+        if(sink->gate_edge == LC_EDGE_RISING)
+            active |= above;
+        else if(sink->gate_edge == LC_EDGE_FALLING)
+            active |= !above;
+        else
+            active |= sink->gate_above[ch] >= 0 && above != sink->gate_above[ch];
+        sink->gate_above[ch] = above;
+    }
+    return active;
+}
+
+
+// Open the next event's segment and write the scans that led up to it,
+// oldest first
+int open_event(lcsink_t *sink, unsigned int channels){
+    unsigned int oldest, count;
+
+    sink->scans = sink->gate_scan - sink->hist_fill;
+    if(open_file(sink))
+        return LC_ERROR;
+    sink->events ++;
+    if(sink->hist_fill == 0)
+        return LC_NOERR;
+    oldest = (sink->hist_head + sink->gate_pre - sink->hist_fill) % sink->gate_pre;
+    count = sink->gate_pre - oldest < sink->hist_fill ? 
+            sink->gate_pre - oldest : sink->hist_fill;
+    if(write_file(sink, &sink->history[(size_t) oldest * channels], channels, count))
+        return LC_ERROR;
+    if(count < sink->hist_fill && 
+            write_file(sink, sink->history, channels, sink->hist_fill - count))
+        return LC_ERROR;
+    sink->hist_fill = 0;
+    return LC_NOERR;
+}
+
+
+// Write the scans that belong to events and keep the rest in the history.
+// Runs of event scans are written in one piece.
+int write_gated(lcsink_t *sink, const double *data, unsigned int channels,
+        unsigned int samples){
+    unsigned int ii, start = 0;
+    int recording = sink->ff || sink->aio.fd >= 0;
+    const double *scan;
+
+    if(sink->history == NULL && sink->gate_pre > 0){
+        sink->history = malloc((size_t) sink->gate_pre * channels * sizeof(double));
+        if(sink->history == NULL){
+            fprintf(stderr, "LCSINK: Failed to allocate %u scans of history for %s.\n",
+                    sink->gate_pre, sink->name);
+            return LC_ERROR;
+        }
+    }
+    for(ii=0, scan=data; ii<samples; ii++, scan+=channels, sink->gate_scan++){
+        if(gate_test(sink, scan, channels)){
+            if(!recording){
+                if(open_event(sink, channels))
+                    return LC_ERROR;
+                recording = 1;
+                start = ii;
+            }
+            sink->gate_left = sink->gate_post;
+        }else if(recording && sink->gate_left-- == 0){
+            // The tail is over, and this scan is not part of the event
+            if(ii > start && write_file(sink, &data[(size_t) start * channels], 
+                    channels, ii - start))
+                return LC_ERROR;
+            close_file(sink);
+            sink->segment++;
+            recording = 0;
+        }
+        if(!recording && sink->gate_pre > 0){
+            memcpy(&sink->history[(size_t) sink->hist_head * channels], scan, 
+                    channels * sizeof(double));
+            sink->hist_head = (sink->hist_head + 1) % sink->gate_pre;
+            if(sink->hist_fill < sink->gate_pre)
+                sink->hist_fill ++;
+        }
+    }
+    if(recording && samples > start)
+        return write_file(sink, &data[(size_t) start * channels], channels, samples - start);
+    return LC_NOERR;
+}
+
+
+void lcsink_init(lcsink_t *sink, int type, const char *name){
+    memset(sink, 0, sizeof(lcsink_t));
+    sink->type = type;
+    snprintf(sink->name, LCSINK_MAX_NAME, "%s", name);
+    sink->format = -1;
+    sink->decimate = 1;
+    sink->mode = LCSINK_STDIO;
+    sink->fd = -1;
+    sink->segment = -1;
+    sink->nfft = LCSINK_DEF_NFFT;
+    sink->spectrum_sec = LCSINK_DEF_SPECTRUM;
+    sink->gate_channel = -1;
+    sink->gate_edge = LC_EDGE_RISING;
+    sink->aio.fd = -1;
+    sink->aio.ring = -1;
+    sink->net.fd = -1;
+}
+
+
+int lcsink_open(lcsink_t *sink, lc_devconf_t *dconf, unsigned int device,
+        unsigned int ndev){
+    sink->conf = *dconf;
+    sink->device = device;
+    sink->ndev = ndev;
+    if(sink->decimate < 1)
+        sink->decimate = 1;
+    sink->conf.downsample = (dconf->downsample + 1) * sink->decimate - 1;
+    if(sink->envelope){
+        // Two scans for every group keep the time line right
+        if(sink->decimate % 2){
+            fprintf(stderr, "LCSINK: An envelope needs an even DECIMATE, but %s has %u.\n",
+                    sink->name, sink->decimate);
+            return LC_ERROR;
+        }
+        sink->conf.downsample = (dconf->downsample + 1) * (sink->decimate / 2) - 1;
+        lc_meta_put_int(&sink->conf, "envelope", sink->decimate);
+    }
+    if(sink->format >= 0)
+        sink->conf.dataformat = sink->format;
+
+    switch(sink->type){
+    case LCSINK_SPECTRUM:
+        if(open_spectrum(sink))
+            return LC_ERROR;
+        // The spectra go to a data file like any other
+    case LCSINK_FILE:
+        if(sink->mode != LCSINK_PIPE && (sink->segment_bytes > 0 || sink->segment_sec > 0))
+            sink->segment = 0;
+        return open_file(sink);
+    case LCSINK_GATED:
+        // The files are opened by the events
+        return open_gate(sink);
+    case LCSINK_SHM:
+        // Shared memory always carries the raw stream
+        if(lcshm_create(&sink->shm, sink->name, dconf, 0)){
+            fprintf(stderr, "LCSINK: Failed to publish %s.\n", sink->name);
+            return LC_ERROR;
+        }
+        return LC_NOERR;
+    case LCSINK_NET:
+        return lcnet_open(&sink->net, sink->name, &sink->conf, device, ndev, 0);
+    }
+    fprintf(stderr, "LCSINK: Unknown sink type: %d\n", sink->type);
+    return LC_ERROR;
+}
+
+
+int lcsink_raw(lcsink_t *sink, const double *data, unsigned int samples){
+    if(sink->type == LCSINK_SHM && sink->shm.header)
+        lcshm_publish(&sink->shm, data, samples);
+    return LC_NOERR;
+}
+
+
+int lcsink_write(lcsink_t *sink, const double *data, unsigned int channels,
+        unsigned int samples){
+    unsigned int count;
+
+    if(sink->type == LCSINK_SHM)
+        return LC_NOERR;
+    if(sink->decimate > 1){
+        samples = sink->envelope ? envelope(sink, data, channels, samples) : 
+                decimate(sink, data, channels, samples);
+        data = sink->buffer;
+    }
+    if(samples == 0)
+        return LC_NOERR;
+
+    // A failed receiver only ends this copy
+    if(sink->type == LCSINK_NET){
+        if(sink->net.fd >= 0 && lcnet_send(&sink->net, data, channels, samples))
+            fprintf(stderr, "LCSINK: Stopped sending device %u to %s.\n", sink->device, sink->name);
+        return LC_NOERR;
+    }
+
+    if(sink->type == LCSINK_GATED)
+        return write_gated(sink, data, channels, samples);
+    if(sink->type != LCSINK_SPECTRUM)
+        return write_file(sink, data, channels, samples);
+    // Spectra end exactly at the interval, even in the middle of a block
+    while(samples > 0){
+        count = sink->interval - sink->counted < samples ? 
+                sink->interval - sink->counted : samples;
+        lcfft_welch_block(&sink->welch, data, channels, count);
+        sink->counted += count;
+        samples -= count;
+        data += (size_t) count * channels;
+        if(sink->counted >= sink->interval){
+            sink->counted = 0;
+            if(write_spectrum(sink))
+                return LC_ERROR;
+        }
+    }
+    return LC_NOERR;
+}
+
+
+void lcsink_close(lcsink_t *sink){
+    if(sink->type == LCSINK_SPECTRUM && sink->spectrum && (sink->ff || sink->aio.fd >= 0))
+        write_spectrum(sink);
+    close_file(sink);
+    if(sink->fd >= 0)
+        close(sink->fd);
+    sink->fd = -1;
+    lcshm_close(&sink->shm);
+    lcnet_close(&sink->net);
+    free(sink->acc);
+    free(sink->buffer);
+    free(sink->spectrum);
+    free(sink->history);
+    lcfft_welch_free(&sink->welch);
+    sink->spectrum = NULL;
+    sink->history = NULL;
+    sink->acc = NULL;
+    sink->buffer = NULL;
+    sink->size = 0;
+}
@@ -0,0 +1,237 @@
+/*
+  This file is part of the LCONFIG laboratory configuration system.
+
+    LCONFIG is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    LCONFIG is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with LCONFIG.  If not, see <https://www.gnu.org/licenses/>.
+
+    Authored by C.Martin crm28@psu.edu
+*/
+
+/*  The LCSINK header lets one acquisition feed several outputs at once.  A
+sink is a data file, a shared memory segment (lcshm.h), a network
+receiver (lcnet.h), a file of averaged spectra (lcfft.h), or a set of
+files that only hold events.  The application keeps an array of sinks for each
+device and hands every block to each of them in turn.  Each sink has its
+own data format, its own rate, and its own queue (the LCAIO buffer pool,
+the network send queue, or the shared memory ring), so a slow output
+never holds up the others any longer than its own queue allows.
+
+The blocks are never copied for a sink.  Every sink reads the same block
+in place, and only writes what it needs into its own queue.  Sinks with a
+DECIMATE factor keep the mean of every DECIMATE scans, so they only hold
+the (much smaller) averaged scans.  With ENVELOPE set, they keep the 
+minimum and the maximum of every DECIMATE scans instead, as two scans in
+that order, so a preview still shows the transients that a mean would 
+hide.  Their headers have the meta parameter envelope (the DECIMATE 
+factor), and their DOWNSAMPLE counts both scans, so the times are right.
+
+Each sink keeps CONF, a shallow copy of the device configuration that
+describes exactly what it writes.  Its DATAFORMAT is the sink's format,
+and its DOWNSAMPLE includes the sink's decimation, so the headers (and
+the Python loader) get the sink's data rate right.  CONF shares memory
+with the original, so it must never be passed to LC_CLEAN().
+
+A typical application looks like this:
+
+    lcsink_t sink[2];
+    lcsink_init(&sink[0], LCSINK_FILE, "test");
+    lcsink_init(&sink[1], LCSINK_FILE, "test_preview");
+    sink[1].decimate = 100;
+    lc_stream_start(&dconf, -1);
+    lcsink_open(&sink[0], &dconf, 0, 1);
+    lcsink_open(&sink[1], &dconf, 0, 1);
+    while( ... ){
+        lc_stream_read(&dconf, &data, &channels, &samples);
+        for(ii=0; ii<2; ii++)
+            lcsink_raw(&sink[ii], data, samples);
+        lc_stream_downsample(&dconf, data, channels, &samples);
+        for(ii=0; ii<2; ii++)
+            lcsink_write(&sink[ii], data, channels, samples);
+    }
+    for(ii=0; ii<2; ii++)
+        lcsink_close(&sink[ii]);
+
+Spectrum sinks (LCSINK_SPECTRUM) write a data file with the usual header,
+but instead of the samples, each interval of SPECTRUM_SEC seconds is
+written as NFFT/2+1 rows: row K holds the RMS amplitude of each channel
+in the band around K*DF Hz, averaged over the interval with Welch's 
+method.  The header carries the meta parameters spectrum_nfft, 
+spectrum_bins, spectrum_df, and spectrum_sec, and the calibration zeros 
+are cleared so that the usual calibration scales the amplitudes into the
+channels' units.  A month of one-minute spectra is a tiny fraction of 
+the raw data.
+
+Gated sinks (LCSINK_GATED) only write when something is happening.  The
+analog input GATE_CHANNEL (or every analog input when it is negative) is
+compared with GATE_LEVEL in volts.  With LC_EDGE_RISING, a scan is active
+when a channel is above the level; with LC_EDGE_FALLING, when one is 
+below it; and with LC_EDGE_ANY, when one has just crossed it.  The first
+active scan opens a new segment file (see LC_DATAFILE_SEGMENT()) that 
+begins with the GATE_PRE scans before it, and the segment is closed once
+GATE_POST scans have passed without another active scan.  The segment 
+line in each header gives the absolute index of its first scan, so the 
+events can be placed on the stream's time line.  Only the last GATE_PRE
+scans are kept between events, so the disk only sees the activity.
+SEGMENT_BYTES and SEGMENT_SEC must be zero; an event is never split.
+
+CHANGELOG
+
+v1.1    10/2026
+- Added LCSINK_SPECTRUM
+- Added LCSINK_GATED
+- Added ENVELOPE decimation
+
+v1.0    10/2026     ORIGINAL RELEASE
+*/
+
+#ifndef __LCSINK
+#define __LCSINK
+
+#include "lconfig.h"
+#include "lcaio.h"
+#include "lcshm.h"
+#include "lcnet.h"
+#include "lcfft.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#define LCSINK_MAX          8           // Most sinks an application should need per device
+#define LCSINK_MAX_NAME     128         // Longest file name, segment name, or address
+#define LCSINK_DEF_NFFT     4096        // Default NFFT of a spectrum sink
+#define LCSINK_DEF_SPECTRUM 60.         // Default seconds averaged in each spectrum
+
+// Sink types
+#define LCSINK_FILE         1           // A data file
+#define LCSINK_SHM          2           // A shared memory segment (raw data)
+#define LCSINK_NET          3           // A network receiver
+#define LCSINK_SPECTRUM     4           // A data file of averaged spectra
+#define LCSINK_GATED        5           // Segment files of the events only
+
+// How file sinks are written
+#define LCSINK_STDIO        0           // stdio
+#define LCSINK_URING        1           // LCAIO with io_uring
+#define LCSINK_DIRECT       2           // LCAIO with O_DIRECT
+#define LCSINK_PIPE         3           // LCAIO to the descriptor in FD
+
+
+/* LCSINK_T
+One output.  The members above the line are set by LCSINK_INIT() and may
+be changed before LCSINK_OPEN().  The rest are managed by the sink.
+
+NAME is the base of the file name (".dat" is added, with the device number
+and segment number when needed), the shared memory segment name, or the
+receiver's address.  FORMAT overrides the configured DATAFORMAT of a file
+if it is not negative.  A file is split into segments when SEGMENT_BYTES or
+SEGMENT_SEC is positive (see LC_DATAFILE_SEGMENT()).  Spectrum sinks 
+average SPECTRUM_SEC seconds of segments of NFFT samples in each spectrum.
+Gated sinks watch GATE_CHANNEL with GATE_LEVEL and GATE_EDGE, and keep
+GATE_PRE scans before and GATE_POST scans after each event.  Their scans
+are counted after downsampling and decimation.
+*/
+typedef struct __lcsink_t__ {
+    int type;                       // LCSINK_FILE, LCSINK_SHM, LCSINK_NET, ...
+    char name[LCSINK_MAX_NAME];     // File base name, segment name, or address
+    int format;                     // LC_DF_XXX or -1 to use the configuration
+    unsigned int decimate;          // Keep the mean of this many scans (1 for all)
+    int envelope;                   // Keep their minimum and maximum instead
+    int mode;                       // LCSINK_STDIO, LCSINK_URING, ...
+    int fd;                         // Descriptor for LCSINK_PIPE
+    double segment_bytes;           // Start a new file after this many bytes
+    double segment_sec;             // ... or after this many seconds
+    unsigned int nfft;              // Samples in each spectrum segment
+    double spectrum_sec;            // Seconds averaged in each spectrum
+    int gate_channel;               // Analog input to watch or -1 for all
+    double gate_level;              // Threshold in volts
+    lc_edge_t gate_edge;            // LC_EDGE_RISING, LC_EDGE_FALLING, or LC_EDGE_ANY
+    unsigned int gate_pre;          // Scans kept before each event
+    unsigned int gate_post;         // Scans kept after the last active scan
+    //-----------------------------------------------------------------
+    lc_devconf_t conf;              // Shallow copy describing the output
+    unsigned int device, ndev;      // Device number and count for file names
+    // Decimation
+    double *acc;                    // Sum (or minimum and maximum) of each channel so far
+    unsigned int count;             // Scans in ACC
+    double *buffer;                 // Averaged scans
+    size_t size;                    // Capacity of BUFFER in doubles
+    // Files
+    FILE *ff;                       // stdio file or NULL
+    lcaio_t aio;                    // LCAIO writer when AIO.FD >= 0
+    int segment;                    // Segment number or -1
+    uint64_t scans;                 // Scans written to the file(s)
+    struct timespec segment_start;  // When the current segment began
+    // Spectra
+    lcfft_welch_t welch;            // The spectrum being averaged
+    double *spectrum;               // One spectrum, BINS rows x CHANNELS
+    uint64_t interval;              // Scans in each spectrum
+    uint64_t counted;               // Scans in the current spectrum so far
+    // Events
+    double *history;                // The last GATE_PRE scans (a ring)
+    unsigned int hist_head;         // Where the next scan goes in HISTORY
+    unsigned int hist_fill;         // Scans in HISTORY
+    uint64_t gate_scan;             // Absolute index of the next scan offered
+    unsigned int gate_left;         // Scans left in the current event's tail
+    signed char gate_above[LC_MAX_STCH];    // Last side of the level or -1
+    unsigned int events;            // Events written so far
+    // Live outputs
+    lcshm_t shm;
+    lcnet_t net;
+} lcsink_t;
+
+
+/* LCSINK_INIT
+Prepare SINK of type TYPE with the default settings: the configured data
+format, full rate, stdio, one file, one-minute spectra of 
+LCSINK_DEF_NFFT points, and events on any analog input rising above 0V
+with no scans before or after.  NAME is copied.  It is safe to
+call LCSINK_CLOSE() on a sink that was initialized but never opened.
+*/
+void lcsink_init(lcsink_t *sink, int type, const char *name);
+
+/* LCSINK_OPEN
+Open the output for device DEVICE of NDEV in the configuration DCONF.  The
+stream should already be started, since shared memory segments are sized
+from the running stream and receivers are sent its start time.
+
+Returns LC_NOERR on success and LC_ERROR on failure.
+*/
+int lcsink_open(lcsink_t *sink, lc_devconf_t *dconf, unsigned int device,
+        unsigned int ndev);
+
+/* LCSINK_RAW
+Offer SAMPLES raw scans (before downsampling) to the sink.  Only shared
+memory segments use them.  Always returns LC_NOERR.
+*/
+int lcsink_raw(lcsink_t *sink, const double *data, unsigned int samples);
+
+/* LCSINK_WRITE
+Offer SAMPLES scans of CHANNELS channels (after downsampling) to the sink.
+Files start a new segment when their limit is reached.  Spectrum sinks
+write a spectrum each time an interval is complete.  Gated sinks open 
+and close a segment for each event.  When a network
+receiver fails, the sink stops sending and says so, but the application
+is not interrupted.
+
+Returns LC_ERROR only when a data file could not be written.
+*/
+int lcsink_write(lcsink_t *sink, const double *data, unsigned int channels,
+        unsigned int samples);
+
+/* LCSINK_CLOSE
+Finish the output.  Data files get their final index checkpoint (see
+LC_DATAFILE_CHECKPOINT()) and any queued data are written.  A spectrum 
+sink writes its partial interval first if it has averaged any segments.
+*/
+void lcsink_close(lcsink_t *sink);
+
+#endif
@@ -21,6 +21,8 @@
 #include "lconfig.h"
 #include "lctools.h"
 #include "lcmap.h"
+#include "lcshm.h"
+#include "lcfft.h"
 #include <string.h>     // duh
 #include <unistd.h>     // for system calls
 #include <stdlib.h>     // for malloc and free
@@ -39,13 +41,29 @@
 #define FMT_NHEAD       "\x1B[4m%18s\x1B[0m"
 #define FMT_UNITS       "%8s"
 #define FMT_UHEAD       "\x1B[4m%8s\x1B[0m"
+// Percentiles shown by -q
+#define NQUANT          3
+const double quantile[NQUANT] = {0.01, 0.50, 0.99};
+const char *quantile_head[NQUANT] = {"P1", "Median", "P99"};
+// Spectra shown by -f and -b
+#define DEF_NFFT        1024
+#define NPEAK           3
+#define MAXBAND         4
 
 
 #define destruct(){\
-    for(ii=0;ii<ndev;ii++){lc_stream_stop(&dconf[ii]);lc_close(&dconf[ii]);lc_clean(&dconf[ii]);}\
+    for(ii=0;ii<ndev;ii++){\
+        if(attach){lcshm_close(&shm[ii]);lc_clean(&dconf[ii]);}\
+        else{lc_stream_stop(&dconf[ii]);lc_close(&dconf[ii]);lc_clean(&dconf[ii]);}\
+    }\
     lct_finish_keypress();\
     if(working){free(working); working=NULL;}\
     if(values){free(values); values=NULL;}\
+    if(hist){free(hist); hist=NULL;}\
+    if(quant){free(quant); quant=NULL;}\
+    if(scratch){free(scratch); scratch=NULL;}\
+    for(ii=0;ii<MAXDEV;ii++) lct_window_free(&window[ii]);\
+    for(ii=0;ii<MAXDEV;ii++) lcfft_welch_free(&welch[ii]);\
 }
 
 /*...................
@@ -58,7 +76,8 @@
 . Help text
 .....................*/
 const char help_text[] = \
-"lcstat [-dhmpr] [-c CONFIGFILE] [-n SAMPLES] [-u UPDATE_SEC]\n"\
+"lcstat [-dhmpqr] [-c CONFIGFILE] [-a NAME] [-n SAMPLES] [-u UPDATE_SEC]\n"\
+"       [-w WINDOW] [-f NFFT] [-b F1:F2]\n"\
 "  LCSTAT is a utility that shows the status of the configured channels\n"\
 "  in real time.  The intent is that it be used to aid with debugging and\n"\
 "  setup of experiments from the command line.\n"
@@ -74,6 +93,15 @@ const char help_text[] = \
 "  Specifies the LCONFIG configuration file to be used to configure the\n"\
 "  LabJack.  By default, LCSTAT will look for lcstat.conf\n"\
 "\n"\
+"-a NAME\n"\
+"  Instead of opening the devices, attach to the live stream published by\n"\
+"  another process (see lcrun -p).  The configuration is read from the\n"\
+"  stream, so -c is ignored.  If NAME is not found, LCSTAT looks for\n"\
+"  NAME_0, NAME_1, ... to attach to every device published by LCRUN.\n"\
+"  The devices are not touched, so the other process is unaffected.\n"\
+"    $ lcrun -p mytest &\n"\
+"    $ lcstat -a mytest -r\n"\
+"\n"\
 "-n SAMPLES\n"\
 "  Specifies the minimum integer number of samples per channel to be \n"\
 "  included in the statistics on each channel.  \n"\
@@ -92,15 +120,34 @@ const char help_text[] = \
 "  which ever results in the longest test will be used.  If neither is\n"\
 "  specified, then LCSTAT will collect one packet worth of data.\n"\
 "\n"\
+"-b F1:F2\n"\
+"  Display the RMS of each signal between F1 and F2 Hz, found from its\n"\
+"  power spectral density (see -f).  Up to 4 bands may be given.\n"\
+"    $ lcstat -f 4096 -b 55:65 -b 1000:2000\n"\
+"\n"\
 "-d\n"\
 "  Display standard deviation of the signal in the results table.\n"\
 "\n"\
+"-f NFFT\n"\
+"  Display the frequencies and RMS amplitudes of the three largest peaks\n"\
+"  in the spectrum of each signal.  The power spectral density is found\n"\
+"  with Welch's method from segments of NFFT samples (a power of two) that\n"\
+"  overlap by half, and it is averaged over at least NSAMPLE samples.  The\n"\
+"  frequency resolution is the sample rate divided by NFFT.  The default \n"\
+"  with -b is 1024.\n"\
+"\n"\
 "-m\n"\
 "  Display the maximum and minimum of each signal in the results table.\n"\
 "\n"\
 "-p\n"\
 "  Display peak-to-peak values in the results table.\n"\
 "\n"\
+"-q\n"\
+"  Display the 1st, 50th (median), and 99th percentiles of each signal in\n"\
+"  the results table.  They are estimated from a histogram of each channel\n"\
+"  over its full input range, with 16384 bins, so the resolution is about\n"\
+"  1/8000 of the AIRANGE setting.\n"\
+"\n"\
 "-r\n"\
 "  Display rms values in the results table.\n"\
 "\n"\
@@ -108,6 +155,15 @@ const char help_text[] = \
 "  Accepts a floating point indicating the approximate time in seconds between\n"\
 "  display updates.\n"\
 "\n"\
+"-w WINDOW\n"\
+"  Show the statistics on the most recent WINDOW of data instead of on\n"\
+"  blocks of NSAMPLE samples.  The window is updated with every block, so\n"\
+"  the table follows changes in the signals while still averaging over \n"\
+"  the whole window.  Suffixes ms, s, m, and h are recognized, and seconds\n"\
+"  are assumed without one.  Percentiles (-q) are still found on blocks of\n"\
+"  NSAMPLE samples.\n"\
+"    $ lcstat -w 10s -d   # mean and standard deviation over 10 seconds\n"\
+"\n"\
 "GPLv3\n"\
 "(c)2020-2025 C.Martin\n";
 
@@ -136,18 +192,42 @@ int main(int argc, char *argv[]){
         unsigned int rms:1;
         unsigned int std:1;
         unsigned int maxmin:1;
+        unsigned int quant:1;
         unsigned int run:1;
         unsigned int redraw:1;
     } state;
     time_t now, then;
     // Command-line options
-    double update_sec = UPDATE_SEC;
+    double update_sec = UPDATE_SEC,
+            window_sec = 0.;
 
     // Finally, the essentials
     lc_devconf_t dconf[MAXDEV];     // device configuration array
     lct_stat_t  * values = NULL,    // Live arrays of channel statistics
                 * working = NULL;   // working arrays of channel statistics
-    lct_idle_t  idle;
+    lct_hist_t  * hist = NULL;      // Working histograms for -q
+    double      * quant = NULL,     // Live percentiles (NQUANT per channel)
+                * scratch = NULL;   // Copy of a shared memory block
+    size_t      scratch_size = 0;
+    lct_window_t window[MAXDEV];    // Sliding windows for -w
+    lct_stat_t  wstat[LC_MAX_STCH];
+    unsigned int nfft = 0;          // Spectra for -f and -b
+    int         nband = 0;
+    double      band[MAXBAND][2],
+                pkfreq[NPEAK], pkrms[NPEAK];
+    lcfft_welch_t welch[MAXDEV];
+    double      * data;
+    lct_loop_t  loop;
+    int         events;
+    // Shared memory attachment
+    char        shm_name[MAXSTR] = "";
+    int         attach = 0,     // Attach to shared memory instead of devices?
+                wait_ms,        // Longest time to wait for new data
+                got;            // What LCSHM_READ() found
+    lcshm_t     shm[MAXDEV];
+    lct_stat_t  stage[LC_MAX_NAICH];    // Statistics on an unverified block
+    const double * sdata;
+    unsigned int channels, samples_per_read;
     
 
     // Initialize the state
@@ -155,14 +235,19 @@ int main(int argc, char *argv[]){
     state.rms = 0;
     state.std = 0;
     state.maxmin = 0;
+    state.quant = 0;
     state.run = 1;
+    for(ii=0; ii<MAXDEV; ii++){
+        window[ii].ring = NULL;
+        memset(&welch[ii], 0, sizeof(lcfft_welch_t));
+    }
     
     
     
     // Parse the command-line options
     // use an outer foor loop as a catch-all safety
     for(ii=0; ii<argc; ii++){
-        switch(getopt(argc, argv, "hprdmc:n:u:")){
+        switch(getopt(argc, argv, "hpqrdmc:a:n:u:w:f:b:")){
         // Help text
         case 'h':
             printf(help_text);
@@ -173,6 +258,9 @@ int main(int argc, char *argv[]){
         case 'm':
             state.maxmin = 1;
             break;
+        case 'q':
+            state.quant = 1;
+            break;
         case 'd':
             state.std = 1;
             break;
@@ -183,6 +271,11 @@ int main(int argc, char *argv[]){
         case 'c':
             strcpy(config_file, optarg);
             break;
+        // Shared memory stream
+        case 'a':
+            strcpy(shm_name, optarg);
+            attach = 1;
+            break;
         // Sample count
         case 'n':
             optchar = 0;
@@ -211,6 +304,45 @@ int main(int argc, char *argv[]){
                 return -1;
             }
         break;
+        case 'w':
+            stemp[0] = 0;
+            if(sscanf(optarg, "%lf%3s", &window_sec, stemp) < 1 || window_sec <= 0){
+                fprintf(stderr, "LCSTAT: -w expects a positive time, but got: %s\n", optarg);
+                return -1;
+            }
+            if(strcmp(stemp, "ms") == 0)
+                window_sec *= 0.001;
+            else if(strcmp(stemp, "m") == 0)
+                window_sec *= 60.;
+            else if(strcmp(stemp, "h") == 0)
+                window_sec *= 3600.;
+            else if(stemp[0] && strcmp(stemp, "s")){
+                fprintf(stderr, "LCSTAT: Unexpected window unit: %s\n", stemp);
+                return -1;
+            }
+        break;
+        case 'f':
+            if(sscanf(optarg, "%u", &nfft) != 1 || nfft < LCFFT_MIN_N 
+                    || nfft > LCFFT_MAX_N || (nfft & (nfft-1))){
+                fprintf(stderr, "LCSTAT: -f expects a power of two from %d to %d, but got: %s\n",
+                        LCFFT_MIN_N, LCFFT_MAX_N, optarg);
+                return -1;
+            }
+        break;
+        case 'b':
+            if(nband >= MAXBAND){
+                fprintf(stderr, "LCSTAT: No more than %d bands are allowed.\n", MAXBAND);
+                return -1;
+            }
+            if(sscanf(optarg, "%lf:%lf", &band[nband][0], &band[nband][1]) != 2
+                    || band[nband][1] <= band[nband][0]){
+                fprintf(stderr, "LCSTAT: -b expects a band F1:F2 in Hz, but got: %s\n", optarg);
+                return -1;
+            }
+            nband ++;
+            if(nfft == 0)
+                nfft = DEF_NFFT;
+        break;
         case -1:    // What if we're out of switch options?
             // Force the loop to exit.
             ii = argc;
@@ -223,17 +355,44 @@ int main(int argc, char *argv[]){
         }
     }
 
-    // Load the configuration
-    // This will also enforce that no more than MAXDEV devices are configured
-    printf("Loading configuration file...\n");
-    if(lc_load(dconf, MAXDEV, config_file)){
-        fprintf(stderr, "LCSTAT failed while loading the configuration file \"%s\"\n", config_file);
-        return -1;
-    }else
-        printf("DONE\n");
+    // Attach to a stream published in shared memory
+    if(attach){
+        ndev = 0;
+        // Try NAME, and then the names LCRUN uses for multiple devices
+        if(!lcshm_attach(&shm[0], shm_name))
+            ndev = 1;
+        else
+            for(ndev=0; ndev<MAXDEV; ndev++){
+                snprintf(stemp, MAXSTR, "%s_%d", shm_name, ndev);
+                if(lcshm_attach(&shm[ndev], stemp))
+                    break;
+            }
+        if(!ndev){
+            fprintf(stderr, "LCSTAT could not find a stream published as \"%s\"\n", shm_name);
+            return -1;
+        }
+        // Recover the configurations from the streams
+        for(ii=0; ii<ndev; ii++){
+            if(lc_load_string(&dconf[ii], 1, lcshm_config(&shm[ii]))){
+                fprintf(stderr, "LCSTAT failed to read the configuration from stream %s\n", shm[ii].name);
+                for(jj=0; jj<ndev; jj++)
+                    lcshm_close(&shm[jj]);
+                return -1;
+            }
+        }
+    }else{
+        // Load the configuration
+        // This will also enforce that no more than MAXDEV devices are configured
+        printf("Loading configuration file...\n");
+        if(lc_load(dconf, MAXDEV, config_file)){
+            fprintf(stderr, "LCSTAT failed while loading the configuration file \"%s\"\n", config_file);
+            return -1;
+        }else
+            printf("DONE\n");
 
-    // Detect the number of configured device connections
-    ndev = lc_ndev(dconf, MAXDEV);
+        // Detect the number of configured device connections
+        ndev = lc_ndev(dconf, MAXDEV);
+    }
     if(!ndev){
         fprintf(stderr,"LCSTAT did not detect any valid devices for data acquisition.\n");
         return -1;
@@ -242,19 +401,41 @@ int main(int argc, char *argv[]){
     // Declare memory for the working and active channel statistics
     values = malloc(ndev * LC_MAX_NAICH * sizeof(lct_stat_t));
     working = malloc(ndev * LC_MAX_NAICH * sizeof(lct_stat_t));
+    if(state.quant){
+        hist = malloc(ndev * LC_MAX_NAICH * sizeof(lct_hist_t));
+        quant = malloc(ndev * LC_MAX_NAICH * NQUANT * sizeof(double));
+        if(hist == NULL || quant == NULL){
+            fprintf(stderr, "LCSTAT: Failed to allocate the histograms.\n");
+            destruct();
+            return -1;
+        }
+    }
 
     // Initialize the terminal
     lct_clear_terminal();
     lct_setup_keypress();
 
+    // The event loop takes the termination signals, so they must be blocked
+    // before LJM starts any threads
+    if(lct_loop_block_signals()){
+        destruct();
+        return -1;
+    }
+
     // Open the device connections and upload the configuration
+    // Streams in shared memory are already running; the shortest block 
+    // period sets how often we need to check them.
+    wait_ms = update_sec * 1000;
     for(ii=0; ii<ndev; ii++){
         // Override the nsample parameter?
         if(samples) 
             dconf[ii].nsample = samples;
 
+        if(attach){
+            itemp = 1000. * shm[ii].header->samples_per_read / shm[ii].header->samplehz;
+            wait_ms = itemp < wait_ms ? itemp : wait_ms;
         // Open the device connection
-        if(lc_open(&dconf[ii])){
+        }else if(lc_open(&dconf[ii])){
             fprintf(stderr, "LCSTAT failed to open the device %d in configuration file %s\n", ii, config_file);
             destruct();
             return -1;
@@ -272,31 +453,80 @@ int main(int argc, char *argv[]){
         // initialize the statistics
         lct_stat_init(&values[ii*LC_MAX_NAICH], LC_MAX_NAICH);
         lct_stat_init(&working[ii*LC_MAX_NAICH], LC_MAX_NAICH);
+        // The window is sized from the stream, so it comes after the start
+        if(window_sec > 0 && lct_window_init(&window[ii], lc_nistream(&dconf[ii]),
+                    window_sec * dconf[ii].samplehz + 1,
+                    attach ? shm[ii].header->samples_per_read : dconf[ii].RB.samples_per_read)){
+            fprintf(stderr, "LCSTAT failed to create the window for device %d\n", ii);
+            destruct();
+            return -1;
+        }
+        if(nfft && lcfft_welch_init(&welch[ii], &dconf[ii], lc_nistream(&dconf[ii]), nfft, 0, 0)){
+            fprintf(stderr, "LCSTAT failed to prepare the spectra for device %d\n", ii);
+            destruct();
+            return -1;
+        }
+        if(state.quant){
+            lct_hist_init(&hist[ii*LC_MAX_NAICH], &dconf[ii], LC_MAX_NAICH);
+            for(jj=0; jj<LC_MAX_NAICH*NQUANT; jj++)
+                quant[ii*LC_MAX_NAICH*NQUANT + jj] = NAN;
+        }
     }
     
+    // Sleep until a device has a block ready, the display is due, the user
+    // presses a key, or we are signaled to quit.
+    wait_ms = wait_ms < 1 ? 1 : (wait_ms > 100 ? 100 : wait_ms);
+    if(lct_loop_init(&loop, dconf, attach ? 0 : ndev, LCT_LOOP_STDIN | LCT_LOOP_SIGNAL)){
+        fprintf(stderr, "LCSTAT failed to initialize the event loop.\n");
+        destruct();
+        return -1;
+    }
     then = time(NULL);
-    lct_idle_init(&idle, 100, 5);
     while(state.run){
         now = time(NULL);
         // When it's time to redraw the screen
         if(difftime(now,then) > update_sec){
             then = now;
             // REFRESH CODE
+
+            // Let devices with a LATENCYMS target settle on a block size 
+            // that suits the measured service cost.  A restart only costs
+            // the statistics a few samples.
+            for(ii=0; ii<ndev && !attach; ii++){
+                if(lc_stream_retune(&dconf[ii])){
+                    fprintf(stderr, "LCSTAT: Failed to retune device %d.\n", ii);
+                    state.run = 0;
+                }
+            }
             
             // EXTENDED FEATURE DIO CHANNELS
             // If there are any extended feature channels, update them before
             // beginning the redraw
-            if(dconf[ii].nefch)
-                lc_ef_update(&dconf[ii]);
+            for(ii=0; ii<ndev && !attach; ii++){
+                if(dconf[ii].nefch)
+                    lc_ef_update(&dconf[ii]);
+            }
             
             // Start fresh
             lct_clear_terminal();
+            if(window_sec > 0)
+                printf("Statistics on the last %g seconds\n", window_sec);
             // Loop through the devices
             for(ii=0; ii<ndev; ii++){
+                if(window_sec > 0){
+                    lct_window_stat(&window[ii], wstat);
+                    for(jj=0; jj<dconf[ii].naich && jj<window[ii].channels; jj++)
+                        values[ii*LC_MAX_NAICH + jj] = wstat[jj];
+                }
                 // Print the device header
-                printf("Device %d: \x1B[1m%s\x1B[0m (%s)\n", 
-                        ii, dconf[ii].name, 
-                        lcm_get_message(lcm_connection, dconf[ii].connection_act));
+                if(attach)
+                    printf("Device %d: \x1B[1m%s\x1B[0m (shared memory %s, %lu blocks dropped)\n", 
+                            ii, dconf[ii].name, shm[ii].name, 
+                            (unsigned long) shm[ii].dropped);
+                else
+                    printf("Device %d: \x1B[1m%s\x1B[0m (%s)\n", 
+                            ii, dconf[ii].name, 
+                            lcm_get_message(lcm_connection, dconf[ii].connection_act));
                 // Print the header
                 // Start by printing a header
                 printf(FMT_CHEAD, "Channel");
@@ -312,6 +542,18 @@ int main(int argc, char *argv[]){
                     printf(FMT_NHEAD, "Max.");
                     printf(FMT_NHEAD, "Min.");
                 }
+                for(itemp=0; itemp<NQUANT && state.quant; itemp++)
+                    printf(FMT_NHEAD, quantile_head[itemp]);
+                for(itemp=0; itemp<NPEAK && nfft; itemp++){
+                    sprintf(stemp, "Peak%d (Hz)", itemp+1);
+                    printf(FMT_NHEAD, stemp);
+                    sprintf(stemp, "Peak%d (RMS)", itemp+1);
+                    printf(FMT_NHEAD, stemp);
+                }
+                for(itemp=0; itemp<nband; itemp++){
+                    sprintf(stemp, "%g-%gHz", band[itemp][0], band[itemp][1]);
+                    printf(FMT_NHEAD, stemp);
+                }
                 printf("\n");
 
                 // Loop through the channels
@@ -350,12 +592,29 @@ int main(int argc, char *argv[]){
                         printf(FMT_NUMBER, values[ii*LC_MAX_NAICH+jj].max);
                         printf(FMT_NUMBER, values[ii*LC_MAX_NAICH+jj].min);   
                     }
+                    for(itemp=0; itemp<NQUANT && state.quant; itemp++)
+                        printf(FMT_NUMBER, quant[(ii*LC_MAX_NAICH+jj)*NQUANT + itemp]);
+                    if(nfft){
+                        itemp = 0;
+                        if(jj < welch[ii].channels)
+                            itemp = lcfft_welch_peaks(&welch[ii], jj, NPEAK, pkfreq, pkrms);
+                        for(; itemp<NPEAK; itemp++)
+                            pkfreq[itemp] = pkrms[itemp] = NAN;
+                        for(itemp=0; itemp<NPEAK; itemp++){
+                            printf(FMT_NUMBER, pkfreq[itemp]);
+                            printf(FMT_NUMBER, pkrms[itemp]);
+                        }
+                    }
+                    for(itemp=0; itemp<nband && jj<welch[ii].channels; itemp++)
+                        printf(FMT_NUMBER, lcfft_welch_band(&welch[ii], jj, band[itemp][0], band[itemp][1]));
                     printf("\n");
                 }
                 
                 // Draw the EF channels
                 // Then display them
-                for(jj=0; jj<dconf[ii].nefch; jj++){
+                // Their values are only known to the process that owns
+                // the device, so there is nothing to show when attached.
+                for(jj=0; jj<dconf[ii].nefch && !attach; jj++){
                     // CHANNEL LABEL
                     // If the labe is defined, print it verbatim
                     if(dconf[ii].efch[jj].label[0])
@@ -396,27 +655,106 @@ int main(int argc, char *argv[]){
             printf("\nPress 'Q' to exit.\n");
         }
         
+        // Wait for something to do; wake at least once per update
+        events = lct_loop_wait(&loop, wait_ms);
+        if(events < 0)
+            state.run = 0;
+
         // Service the data connections
         for(ii=0;ii<ndev;ii++){
-            lc_stream_service(&dconf[ii]);
-            lct_stream_stat(&dconf[ii], &working[ii*LC_MAX_NAICH], 0);
-            // If the working array has accumulated enough samples
-            if(working[ii*LC_MAX_NAICH].n >= dconf[ii].nsample){
-                // Copy the result and clear the worker
-                for(jj=0; jj<dconf[ii].naich; jj++) 
-                    values[ii*LC_MAX_NAICH + jj] = working[ii*LC_MAX_NAICH + jj];
-                lct_stat_init(&working[ii*LC_MAX_NAICH], dconf[ii].naich);
+            if(attach){
+                // Accumulate each block on a copy until we know the 
+                // writer did not overwrite it while we were reading.
+                // The histograms and windows are too large to stage, so 
+                // they are counted from a copy of the block instead.
+                while((got = lcshm_read(&shm[ii], &sdata, &channels, &samples_per_read)) != LC_ERROR){
+                    // A lost block is counted in DROPPED; try the next one
+                    if(got == LCSHM_LAPPED)
+                        continue;
+                    memcpy(stage, &working[ii*LC_MAX_NAICH], sizeof(stage));
+                    lct_stat_block(&dconf[ii], stage, sdata, channels, 
+                            samples_per_read, LC_MAX_NAICH);
+                    if(state.quant || window_sec > 0 || nfft){
+                        if((size_t) channels * samples_per_read > scratch_size){
+                            free(scratch);
+                            scratch_size = (size_t) channels * samples_per_read;
+                            scratch = malloc(scratch_size * sizeof(double));
+                        }
+                        if(scratch)
+                            memcpy(scratch, sdata, (size_t) channels * samples_per_read * sizeof(double));
+                    }
+                    if(lcshm_release(&shm[ii]))
+                        continue;
+                    memcpy(&working[ii*LC_MAX_NAICH], stage, sizeof(stage));
+                    if(state.quant && scratch)
+                        lct_hist_block(&dconf[ii], &hist[ii*LC_MAX_NAICH], scratch, 
+                                channels, samples_per_read, LC_MAX_NAICH);
+                    if(window_sec > 0 && scratch)
+                        lct_window_block(&dconf[ii], &window[ii], scratch, 
+                                channels, samples_per_read);
+                    if(nfft && scratch)
+                        lcfft_welch_block(&welch[ii], scratch, channels, samples_per_read);
+                    if(working[ii*LC_MAX_NAICH].n >= dconf[ii].nsample){
+                        for(jj=0; jj<dconf[ii].naich; jj++){
+                            values[ii*LC_MAX_NAICH + jj] = working[ii*LC_MAX_NAICH + jj];
+                            for(itemp=0; itemp<NQUANT && state.quant; itemp++)
+                                quant[(ii*LC_MAX_NAICH+jj)*NQUANT + itemp] = 
+                                        lct_hist_quantile(&hist[ii*LC_MAX_NAICH + jj], quantile[itemp]);
+                        }
+                        lct_stat_init(&working[ii*LC_MAX_NAICH], dconf[ii].naich);
+                        if(state.quant)
+                            lct_hist_init(&hist[ii*LC_MAX_NAICH], &dconf[ii], dconf[ii].naich);
+                        if(nfft && welch[ii].segments)
+                            lcfft_welch_update(&welch[ii], 1);
+                    }
+                }
+                if(lcshm_isclosed(&shm[ii])){
+                    fprintf(stderr, "LCSTAT: The stream %s was closed.\n", shm[ii].name);
+                    state.run = 0;
+                }
+                continue;
+            }
+            lct_loop_service(&loop, ii);
+            // This is LCT_STREAM_STAT(), but the histograms need the data too
+            while(!lc_stream_read_bulk(&dconf[ii], &data, &channels, &samples_per_read)){
+                lct_stat_block(&dconf[ii], &working[ii*LC_MAX_NAICH], data, 
+                        channels, samples_per_read, 0);
+                if(state.quant)
+                    lct_hist_block(&dconf[ii], &hist[ii*LC_MAX_NAICH], data, 
+                            channels, samples_per_read, LC_MAX_NAICH);
+                if(window_sec > 0)
+                    lct_window_block(&dconf[ii], &window[ii], data, 
+                            channels, samples_per_read);
+                if(nfft)
+                    lcfft_welch_block(&welch[ii], data, channels, samples_per_read);
+                lc_stream_release_bulk(&dconf[ii], samples_per_read);
+                // If the working array has accumulated enough samples
+                if(working[ii*LC_MAX_NAICH].n >= dconf[ii].nsample){
+                    // Copy the result and clear the worker
+                    for(jj=0; jj<dconf[ii].naich; jj++){
+                        values[ii*LC_MAX_NAICH + jj] = working[ii*LC_MAX_NAICH + jj];
+                        for(itemp=0; itemp<NQUANT && state.quant; itemp++)
+                            quant[(ii*LC_MAX_NAICH+jj)*NQUANT + itemp] = 
+                                    lct_hist_quantile(&hist[ii*LC_MAX_NAICH + jj], quantile[itemp]);
+                    }
+                    lct_stat_init(&working[ii*LC_MAX_NAICH], dconf[ii].naich);
+                    if(state.quant)
+                        lct_hist_init(&hist[ii*LC_MAX_NAICH], &dconf[ii], dconf[ii].naich);
+                    // The spectra wait for at least one whole segment
+                    if(nfft && welch[ii].segments)
+                        lcfft_welch_update(&welch[ii], 1);
+                }
             }
         }
         
-        // Time for a little downtime
-        lct_idle(&idle);
-        
         // Check for the escape keypress
-        if(lct_is_keypress() && getchar()=='Q')
+        if(events & LCT_EV_KEY && getchar()=='Q')
+            state.run = 0;
+        if(events & LCT_EV_SIGNAL)
             state.run = 0;
             
     }
+    lct_loop_close(&loop);
     destruct();
     return 0;
 }
@@ -3,6 +3,15 @@
 #include "lcmap.h"
 
 #include <math.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/epoll.h>      // for the event loop
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <pthread.h>        // for the loop signal mask
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>      // for the AVX block transpose
+#endif
 
 
 /*
@@ -312,6 +321,129 @@ double * lct_data(lc_devconf_t *dconf,
     return &data[ii];
 }
 
+/* LCT_BLOCK_T
+.   Transposing interleaved blocks into per-channel runs and back
+*/
+#define LCT_BLOCK_ALIGN     64      // Alignment of the runs in bytes
+#define LCT_BLOCK_TILE      32      // Edge of the tiles in the portable transpose
+
+// Copy the ROWS x COLS matrix SRC (rows SSTRIDE apart) into DEST as its
+// transpose (rows DSTRIDE apart).  The tiles keep both sides in cache.
+void block_transpose_tiled(double *dest, size_t dstride, const double *src, 
+        size_t sstride, unsigned int rows, unsigned int cols){
+    unsigned int r0, c0, r, c, rmax, cmax;
+    for(r0=0; r0<rows; r0+=LCT_BLOCK_TILE){
+        rmax = r0 + LCT_BLOCK_TILE < rows ? r0 + LCT_BLOCK_TILE : rows;
+        for(c0=0; c0<cols; c0+=LCT_BLOCK_TILE){
+            cmax = c0 + LCT_BLOCK_TILE < cols ? c0 + LCT_BLOCK_TILE : cols;
+            for(r=r0; r<rmax; r++)
+                for(c=c0; c<cmax; c++)
+                    dest[c*dstride + r] = src[r*sstride + c];
+        }
+    }
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+// The same transpose in 4x4 tiles of AVX registers.  It is compiled for 
+// AVX regardless of the build flags and only called when the processor 
+// says it has it.
+__attribute__((target("avx")))
+void block_transpose_avx(double *dest, size_t dstride, const double *src, 
+        size_t sstride, unsigned int rows, unsigned int cols){
+    unsigned int r, c;
+    __m256d a, b, x, y, t0, t1, t2, t3;
+    const double *in;
+    for(r=0; r+4<=rows; r+=4){
+        in = &src[r*sstride];
+        for(c=0; c+4<=cols; c+=4){
+            a = _mm256_loadu_pd(&in[c]);
+            b = _mm256_loadu_pd(&in[sstride + c]);
+            x = _mm256_loadu_pd(&in[2*sstride + c]);
+            y = _mm256_loadu_pd(&in[3*sstride + c]);
+            t0 = _mm256_unpacklo_pd(a, b);      // a0 b0 a2 b2
+            t1 = _mm256_unpackhi_pd(a, b);      // a1 b1 a3 b3
+            t2 = _mm256_unpacklo_pd(x, y);      // x0 y0 x2 y2
+            t3 = _mm256_unpackhi_pd(x, y);      // x1 y1 x3 y3
+            _mm256_storeu_pd(&dest[c*dstride + r], _mm256_permute2f128_pd(t0, t2, 0x20));
+            _mm256_storeu_pd(&dest[(c+1)*dstride + r], _mm256_permute2f128_pd(t1, t3, 0x20));
+            _mm256_storeu_pd(&dest[(c+2)*dstride + r], _mm256_permute2f128_pd(t0, t2, 0x31));
+            _mm256_storeu_pd(&dest[(c+3)*dstride + r], _mm256_permute2f128_pd(t1, t3, 0x31));
+        }
+        // Columns left over from the tiles
+        for(; c<cols; c++){
+            dest[c*dstride + r] = in[c];
+            dest[c*dstride + r + 1] = in[sstride + c];
+            dest[c*dstride + r + 2] = in[2*sstride + c];
+            dest[c*dstride + r + 3] = in[3*sstride + c];
+        }
+    }
+    // Rows left over from the tiles
+    if(r < rows)
+        block_transpose_tiled(&dest[r], dstride, &src[r*sstride], sstride, rows - r, cols);
+}
+#endif
+
+// Pick the fastest transpose this processor supports
+void block_transpose(double *dest, size_t dstride, const double *src, 
+        size_t sstride, unsigned int rows, unsigned int cols){
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    if(__builtin_cpu_supports("avx")){
+        block_transpose_avx(dest, dstride, src, sstride, rows, cols);
+        return;
+    }
+#endif
+    block_transpose_tiled(dest, dstride, src, sstride, rows, cols);
+}
+
+
+int lct_block_split(lct_block_t *block, const double *data, 
+        unsigned int channels, unsigned int samples){
+    size_t stride, need;
+    // Round the runs up to whole cache lines so each one is aligned
+    stride = ((size_t) samples * sizeof(double) + LCT_BLOCK_ALIGN - 1) 
+            / LCT_BLOCK_ALIGN * LCT_BLOCK_ALIGN / sizeof(double);
+    need = stride * channels;
+    if(need > block->size){
+        free(block->data);
+        block->data = NULL;
+        block->size = 0;
+        if(posix_memalign((void**) &block->data, LCT_BLOCK_ALIGN, need * sizeof(double))){
+            block->data = NULL;
+            fprintf(stderr, "LCT_BLOCK_SPLIT: Failed to allocate %zu bytes.\n", need * sizeof(double));
+            return LC_ERROR;
+        }
+        block->size = need;
+    }
+    block->channels = channels;
+    block->samples = samples;
+    block->stride = stride;
+    block_transpose(block->data, stride, data, channels, samples, channels);
+    return LC_NOERR;
+}
+
+
+double * lct_block_channel(lct_block_t *block, unsigned int channel){
+    if(channel >= block->channels)
+        return NULL;
+    return &block->data[channel * block->stride];
+}
+
+
+void lct_block_join(const lct_block_t *block, double *data){
+    block_transpose(data, block->channels, block->data, block->stride, 
+            block->channels, block->samples);
+}
+
+
+void lct_block_free(lct_block_t *block){
+    free(block->data);
+    block->data = NULL;
+    block->size = 0;
+    block->channels = 0;
+    block->samples = 0;
+}
+
+
 /* LCT_CAL_INPLACE
 .   Apply the channel calibrations in-place on the target array.  The contents
 .   of the data array are presumed to be raw voltages as returned by the 
@@ -321,20 +453,21 @@ double * lct_data(lc_devconf_t *dconf,
 */
 void lct_cal_inplace(lc_devconf_t *dconf, 
                 double data[], unsigned int data_size){
-    lct_diter_t diter;
-    double *this;
-    unsigned int ii;
-    // Loop through the analog channels
-    for(ii = 0; ii<dconf->naich; ii++){
-        // Initialize the iteration
-        if(lct_diter_init(dconf,&diter,data,data_size,ii)){
-            fprintf(stderr, "LCT_CAL_INPLACE: This error should never happen!  Calibration failed.\n"\
-                    "    We sincerely apologize.\n");
-            return;
-        }
-        while(this = lct_diter_next(&diter))
-            *this = dconf->aich[ii].calslope * ((*this) - dconf->aich[ii].calzero);
+    double slope[LC_MAX_NAICH], zero[LC_MAX_NAICH];
+    unsigned int ii, ch, nch, ncal;
+
+    nch = lc_nistream(dconf);
+    if(nch == 0)
+        return;
+    ncal = dconf->naich < nch ? dconf->naich : nch;
+    for(ch=0; ch<ncal; ch++){
+        slope[ch] = dconf->aich[ch].calslope;
+        zero[ch] = dconf->aich[ch].calzero;
     }
+    // One pass over the scans; the analog inputs lead each one
+    for(ii=0; ii<data_size; ii+=nch)
+        for(ch=0; ch<ncal && ii+ch<data_size; ch++)
+            data[ii+ch] = slope[ch] * (data[ii+ch] - zero[ch]);
     return;
 }
 
@@ -384,62 +517,427 @@ void lct_stat_init(lct_stat_t stat[], unsigned int channels){
     }
 }
 
+void lct_stat_merge(lct_stat_t *stat, const lct_stat_t *other){
+    uint64_t n;
+    double delta;
+    if(other->n == 0)
+        return;
+    if(stat->n == 0){
+        *stat = *other;
+        return;
+    }
+    // Chan et al.; the variances are scaled to sums of squared deviations
+    n = stat->n + other->n;
+    delta = other->mean - stat->mean;
+    stat->var = (stat->var * stat->n + other->var * other->n
+            + delta * delta * ((double) stat->n * other->n / n)) / n;
+    stat->mean += delta * ((double) other->n / n);
+    stat->n = n;
+    stat->max = other->max > stat->max ? other->max : stat->max;
+    stat->min = other->min < stat->min ? other->min : stat->min;
+}
+
+
+// Sum, max, and min of the N samples in RUN
+void run_sums(const double *run, unsigned int n, double *sum, double *max, double *min){
+    unsigned int ii;
+    double s = 0., hi = -INFINITY, lo = INFINITY;
+    for(ii=0; ii<n; ii++){
+        s += run[ii];
+        hi = run[ii] > hi ? run[ii] : hi;
+        lo = run[ii] < lo ? run[ii] : lo;
+    }
+    *sum = s;
+    *max = hi;
+    *min = lo;
+}
+
+// Sum of the squared deviations of the N samples in RUN from MEAN
+double run_m2(const double *run, unsigned int n, double mean){
+    unsigned int ii;
+    double m2 = 0., d;
+    for(ii=0; ii<n; ii++){
+        d = run[ii] - mean;
+        m2 += d * d;
+    }
+    return m2;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+// The same in four AVX lanes.  The runs are aligned by STAT_CHUNK().
+__attribute__((target("avx")))
+void run_sums_avx(const double *run, unsigned int n, double *sum, double *max, double *min){
+    unsigned int ii;
+    __m256d s = _mm256_setzero_pd(), 
+            hi = _mm256_set1_pd(-INFINITY), 
+            lo = _mm256_set1_pd(INFINITY), x;
+    double ls[4], lhi[4], llo[4];
+    for(ii=0; ii+4<=n; ii+=4){
+        x = _mm256_load_pd(&run[ii]);
+        s = _mm256_add_pd(s, x);
+        hi = _mm256_max_pd(hi, x);
+        lo = _mm256_min_pd(lo, x);
+    }
+    _mm256_storeu_pd(ls, s);
+    _mm256_storeu_pd(lhi, hi);
+    _mm256_storeu_pd(llo, lo);
+    run_sums(&run[ii], n - ii, sum, max, min);
+    *sum += (ls[0] + ls[1]) + (ls[2] + ls[3]);
+    for(ii=0; ii<4; ii++){
+        *max = lhi[ii] > *max ? lhi[ii] : *max;
+        *min = llo[ii] < *min ? llo[ii] : *min;
+    }
+}
+
+__attribute__((target("avx")))
+double run_m2_avx(const double *run, unsigned int n, double mean){
+    unsigned int ii;
+    __m256d m2 = _mm256_setzero_pd(), m = _mm256_set1_pd(mean), d;
+    double lm2[4];
+    for(ii=0; ii+4<=n; ii+=4){
+        d = _mm256_sub_pd(_mm256_load_pd(&run[ii]), m);
+        m2 = _mm256_add_pd(m2, _mm256_mul_pd(d, d));
+    }
+    _mm256_storeu_pd(lm2, m2);
+    return run_m2(&run[ii], n - ii, mean) + (lm2[0] + lm2[1]) + (lm2[2] + lm2[3]);
+}
+#endif
+
+// Merge the statistics on up to LCT_STAT_CHUNK scans of DATA into the first
+// NSTAT elements of VALUES.  Channel CH is calibrated with SLOPE[CH] and 
+// ZERO[CH] unless they are NULL.  Calibration is linear, so it is applied
+// to the chunk's statistics instead of to every sample.
+void stat_chunk(lct_stat_t values[], const double *data, unsigned int channels,
+        unsigned int samples, unsigned int nstat, const double slope[], 
+        const double zero[]){
+    double run[(LC_MAX_STCH) * LCT_STAT_CHUNK] __attribute__((aligned(LCT_BLOCK_ALIGN)));
+    double sum, temp;
+    unsigned int ch;
+    lct_stat_t chunk;
+    int avx = 0;
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    avx = __builtin_cpu_supports("avx");
+#endif
+    if(samples == 0)
+        return;
+    block_transpose(run, LCT_STAT_CHUNK, data, channels, samples, nstat < channels ? nstat : channels);
+    for(ch=0; ch<nstat; ch++){
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+        if(avx){
+            run_sums_avx(&run[ch * LCT_STAT_CHUNK], samples, &sum, &chunk.max, &chunk.min);
+            chunk.mean = sum / samples;
+            chunk.var = run_m2_avx(&run[ch * LCT_STAT_CHUNK], samples, chunk.mean) / samples;
+        }else
+#endif
+        {
+            run_sums(&run[ch * LCT_STAT_CHUNK], samples, &sum, &chunk.max, &chunk.min);
+            chunk.mean = sum / samples;
+            chunk.var = run_m2(&run[ch * LCT_STAT_CHUNK], samples, chunk.mean) / samples;
+        }
+        chunk.n = samples;
+        if(slope){
+            chunk.mean = slope[ch] * (chunk.mean - zero[ch]);
+            chunk.var *= slope[ch] * slope[ch];
+            chunk.max = slope[ch] * (chunk.max - zero[ch]);
+            chunk.min = slope[ch] * (chunk.min - zero[ch]);
+            if(slope[ch] < 0){
+                temp = chunk.max;
+                chunk.max = chunk.min;
+                chunk.min = temp;
+            }
+        }
+        lct_stat_merge(&values[ch], &chunk);
+    }
+}
+
+// Gather the calibration of every channel; the others are left alone
+void stat_cal(lc_devconf_t *dconf, unsigned int channels, double slope[], double zero[]){
+    unsigned int ch;
+    for(ch=0; ch<channels; ch++){
+        slope[ch] = ch < dconf->naich ? dconf->aich[ch].calslope : 1.;
+        zero[ch] = ch < dconf->naich ? dconf->aich[ch].calzero : 0.;
+    }
+}
+
+
+/* LCT_STAT_BLOCK
+.   Aggregate statistics on a block of data without modifying it.
+*/
+int lct_stat_block(lc_devconf_t *dconf, lct_stat_t values[], const double *data,
+        unsigned int channels, unsigned int samples, unsigned int maxchannels){
+    double slope[LC_MAX_STCH], zero[LC_MAX_STCH];
+    unsigned int nstat, ii, count;
+
+    // Are the number of channels legal?
+    nstat = channels;
+    if(maxchannels > 0 && channels > maxchannels){
+        fprintf(stderr, "LCT_STAT_BLOCK: The device is configured with more channels than the application allows.\n");
+        nstat = maxchannels;
+    }
+    if(nstat > LC_MAX_STCH){
+        fprintf(stderr, "LCT_STAT_BLOCK: %u channels is more than the %d allowed.\n", nstat, LC_MAX_STCH);
+        return LC_ERROR;
+    }
+    stat_cal(dconf, nstat, slope, zero);
+    for(ii=0; ii<samples; ii+=count){
+        count = samples - ii < LCT_STAT_CHUNK ? samples - ii : LCT_STAT_CHUNK;
+        stat_chunk(values, &data[(size_t) ii * channels], channels, count, nstat, slope, zero);
+    }
+    return LC_NOERR;
+}
+
+
+/* LCT_PIPELINE
+.   Filter, downsample, calibrate, and aggregate statistics in one pass
+*/
+int lct_pipeline(lc_devconf_t *dconf, double *data, unsigned int channels,
+        unsigned int *samples, int options, lct_stat_t values[], 
+        unsigned int maxchannels){
+    tf_t *filter[LC_MAX_STCH];
+    double slope[LC_MAX_STCH], zero[LC_MAX_STCH];
+    unsigned int ch, nstat, nfilter, ii, next, step, out, chunk;
+    const double *in;
+    double *dest, this;
+
+    if(channels > LC_MAX_STCH){
+        fprintf(stderr, "LCT_PIPELINE: %u channels is more than the %d allowed.\n", channels, LC_MAX_STCH);
+        return LC_ERROR;
+    }
+    nstat = 0;
+    if(values){
+        nstat = channels;
+        if(maxchannels > 0 && channels > maxchannels){
+            fprintf(stderr, "LCT_PIPELINE: The device is configured with more channels than the application allows.\n");
+            nstat = maxchannels;
+        }
+    }
+    // Everything the loop needs for each channel is gathered up front.
+    // Like LC_STREAM_DOWNSAMPLE(), the filters only run when downsampling.
+    nfilter = 0;
+    for(ch=0; ch<channels; ch++){
+        filter[ch] = NULL;
+        slope[ch] = 1.;
+        zero[ch] = 0.;
+        if(ch < dconf->naich){
+            slope[ch] = dconf->aich[ch].calslope;
+            zero[ch] = dconf->aich[ch].calzero;
+            if(dconf->downsample && tf_is_ready(&dconf->aich[ch].filter)){
+                filter[ch] = &dconf->aich[ch].filter;
+                nfilter = ch + 1;
+            }
+        }
+    }
+    // NEXT is the next scan to keep; it is the last of every DOWNSAMPLE+1.
+    // DSCOUNT is the number of scans since the last one that was kept.
+    step = dconf->downsample + 1;
+    next = dconf->downsample - dconf->dscount;
+
+    // The statistics are taken on each LCT_STAT_CHUNK scans as soon as they
+    // have been written; CHUNK is the first scan that is not counted yet.
+    out = chunk = 0;
+    dest = data;
+    for(ii=0, in=data; ii<*samples; ii++, in+=channels){
+        if(ii != next){
+            // Discarded scans only advance the filters
+            for(ch=0; ch<nfilter; ch++)
+                if(filter[ch])
+                    tf_eval(filter[ch], in[ch]);
+            continue;
+        }
+        next += step;
+        for(ch=0; ch<channels; ch++){
+            this = filter[ch] ? tf_eval(filter[ch], in[ch]) : in[ch];
+            // DEST never passes IN, so the scans can be moved in place
+            dest[ch] = options & LCT_PIPE_CAL ? slope[ch] * (this - zero[ch]) : this;
+        }
+        dest += channels;
+        out ++;
+        if(nstat && out - chunk == LCT_STAT_CHUNK){
+            stat_chunk(values, &data[(size_t) chunk * channels], channels, LCT_STAT_CHUNK, nstat,
+                    options & LCT_PIPE_CAL ? NULL : slope, zero);
+            chunk = out;
+        }
+    }
+    if(nstat)
+        stat_chunk(values, &data[(size_t) chunk * channels], channels, out - chunk, nstat,
+                options & LCT_PIPE_CAL ? NULL : slope, zero);
+    if(dconf->downsample)
+        dconf->dscount = (dconf->dscount + *samples) % step;
+    *samples = out;
+    return LC_NOERR;
+}
+
+
 /* LCT_STREAM_STAT
-.   Read in a single block of data from the buffer and aggregate statistics
-.   on the data.  
+.   Read in all contiguous blocks of data from the buffer and aggregate 
+.   statistics on the data.  
 */
 int lct_stream_stat(lc_devconf_t *dconf, lct_stat_t values[], unsigned int maxchannels){
-    double *data = NULL, *this = NULL;
-    unsigned int channels, samples_per_read, err, ii;
-    lct_diter_t diter;
+    double *data = NULL;
+    unsigned int channels, samples_per_read, err;
     
-    // Get data.  Are there any?
+    // Get all the contiguous data.  Are there any?
     // If not, return with an error.
-    if(err = lc_stream_read(dconf, &data, &channels, &samples_per_read))
+    if(err = lc_stream_read_bulk(dconf, &data, &channels, &samples_per_read))
         return err;
-    else if(!data)
-        return LC_ERROR;
-        
-    // Are the number of channels legal?
-    if(maxchannels > 0 && channels > maxchannels){
-        fprintf(stderr, "LCT_STREAM_STAT: The device is configured with more channels than the application allows.\n");
-        channels = maxchannels;
-    }
-        
-    // First apply the calibration to the channels
-    lct_cal_inplace(dconf, data, channels*samples_per_read);
     
-    // Loop through the channels
-    for(ii=0; ii<channels; ii++){
-        // initialize an iterator for this channel
-        if(lct_diter_init(dconf, &diter, data, channels*samples_per_read, ii)){
-            fprintf(stderr, "LCT_STREAM_STAT: Failed to initialize the channel iterator for channel %d\n", ii);
-            return LC_ERROR;
+    err = lct_stat_block(dconf, values, data, channels, samples_per_read, maxchannels);
+    lc_stream_release_bulk(dconf, samples_per_read);
+    return err;
+}
+
+
+void lct_hist_init(lct_hist_t hist[], lc_devconf_t *dconf, unsigned int channels){
+    unsigned int ch;
+    double range;
+    for(ch=0; ch<channels; ch++){
+        range = LC_DEF_AI_RANGE;
+        hist[ch].slope = 1.;
+        hist[ch].zero = 0.;
+        if(ch < dconf->naich){
+            range = dconf->aich[ch].range > 0 ? dconf->aich[ch].range : LC_DEF_AI_RANGE;
+            hist[ch].slope = dconf->aich[ch].calslope;
+            hist[ch].zero = dconf->aich[ch].calzero;
         }
-        // Modify the prior statistics to receive in-place calculation
-        // Adjust the variance to be mean squre
-        values[ii].var += values[ii].mean*values[ii].mean;
-        // Re-scale by the number of samples so new samples can simply be added
-        values[ii].var *= values[ii].n;
-        values[ii].mean *= values[ii].n;
-
-        while(this = lct_diter_next(&diter)){
-            values[ii].n ++;
-            values[ii].mean += *this;
-            values[ii].var += (*this) * (*this);
-            values[ii].max = (*this) > values[ii].max ? (*this) : values[ii].max;
-            values[ii].min = (*this) < values[ii].min ? (*this) : values[ii].min;
+        hist[ch].n = 0;
+        hist[ch].lo = -range;
+        hist[ch].hi = range;
+        hist[ch].scale = LCT_HIST_BINS / (2 * range);
+        memset(hist[ch].bin, 0, sizeof(hist[ch].bin));
+    }
+}
+
+
+int lct_hist_block(lc_devconf_t *dconf, lct_hist_t hist[], const double *data,
+        unsigned int channels, unsigned int samples, unsigned int maxchannels){
+    double lo[LC_MAX_STCH], scale[LC_MAX_STCH], x;
+    uint64_t *bin[LC_MAX_STCH];
+    unsigned int ch, nhist, ii;
+
+    nhist = channels < dconf->naich ? channels : dconf->naich;
+    if(maxchannels > 0 && nhist > maxchannels)
+        nhist = maxchannels;
+    for(ch=0; ch<nhist; ch++){
+        lo[ch] = hist[ch].lo;
+        scale[ch] = hist[ch].scale;
+        bin[ch] = hist[ch].bin;
+    }
+    for(ii=0; ii<samples; ii++, data+=channels){
+        for(ch=0; ch<nhist; ch++){
+            // Clamp before converting; an out-of-range or NaN double has 
+            // no integer value.  NaN samples are not counted at all.
+            x = (data[ch] - lo[ch]) * scale[ch];
+            if(isnan(x))
+                continue;
+            x = x < 0. ? 0. : (x > LCT_HIST_BINS - 1 ? LCT_HIST_BINS - 1 : x);
+            bin[ch][(unsigned int) x] ++;
+            hist[ch].n ++;
         }
-        // Clean up the intermediate values struct
-        values[ii].mean /= values[ii].n;
-        values[ii].var /= values[ii].n;
-        values[ii].var = values[ii].var - values[ii].mean*values[ii].mean;
+    }
+    return LC_NOERR;
+}
 
+
+double lct_hist_quantile(const lct_hist_t *hist, double p){
+    double target, count, raw;
+    unsigned int k;
+
+    if(hist->n == 0)
+        return NAN;
+    // A negative slope reverses the order of the calibrated values
+    if(hist->slope < 0)
+        p = 1. - p;
+    p = p < 0. ? 0. : (p > 1. ? 1. : p);
+    target = p * hist->n;
+    count = 0.;
+    for(k=0; k<LCT_HIST_BINS-1; k++){
+        if(hist->bin[k] && count + hist->bin[k] >= target)
+            break;
+        count += hist->bin[k];
+    }
+    raw = hist->lo + (k + (hist->bin[k] ? (target - count) / hist->bin[k] : 0.5)) / hist->scale;
+    return hist->slope * (raw - hist->zero);
+}
+
+
+int lct_hist_merge(lct_hist_t *hist, const lct_hist_t *other){
+    unsigned int k;
+    if(hist->lo != other->lo || hist->hi != other->hi){
+        fprintf(stderr, "LCT_HIST_MERGE: The histograms do not have the same range.\n");
+        return LC_ERROR;
     }
+    for(k=0; k<LCT_HIST_BINS; k++)
+        hist->bin[k] += other->bin[k];
+    hist->n += other->n;
     return LC_NOERR;
 }
 
 
+int lct_window_init(lct_window_t *win, unsigned int channels, 
+        uint64_t window, unsigned int slot){
+    win->ring = NULL;
+    if(channels == 0 || window == 0){
+        fprintf(stderr, "LCT_WINDOW_INIT: The window must have channels and samples.\n");
+        return LC_ERROR;
+    }
+    slot = slot ? slot : 1;
+    if((window + slot - 1) / slot > LCT_WINDOW_MAXSLOT)
+        slot = (window + LCT_WINDOW_MAXSLOT - 1) / LCT_WINDOW_MAXSLOT;
+    win->channels = channels;
+    win->slot = slot;
+    // One more slot than the window needs is always being filled
+    win->nslot = (window + slot - 1) / slot + 1;
+    win->head = 0;
+    win->fill = 0;
+    win->ring = malloc((size_t) win->nslot * channels * sizeof(lct_stat_t));
+    if(win->ring == NULL){
+        fprintf(stderr, "LCT_WINDOW_INIT: Failed to allocate %u slots.\n", win->nslot);
+        return LC_ERROR;
+    }
+    lct_stat_init(win->ring, win->nslot * channels);
+    return LC_NOERR;
+}
+
+
+int lct_window_block(lc_devconf_t *dconf, lct_window_t *win, const double *data,
+        unsigned int channels, unsigned int samples){
+    unsigned int count;
+    while(samples > 0){
+        count = win->slot - win->fill;
+        count = samples < count ? samples : count;
+        if(lct_stat_block(dconf, &win->ring[win->head * win->channels], data, 
+                channels, count, win->channels))
+            return LC_ERROR;
+        win->fill += count;
+        samples -= count;
+        data += (size_t) count * channels;
+        // Retire the oldest slot
+        if(win->fill >= win->slot){
+            win->head = (win->head + 1) % win->nslot;
+            win->fill = 0;
+            lct_stat_init(&win->ring[win->head * win->channels], win->channels);
+        }
+    }
+    return LC_NOERR;
+}
+
+
+void lct_window_stat(const lct_window_t *win, lct_stat_t values[]){
+    unsigned int k, ch;
+    lct_stat_init(values, win->channels);
+    for(k=0; k<win->nslot; k++)
+        for(ch=0; ch<win->channels; ch++)
+            lct_stat_merge(&values[ch], &win->ring[k * win->channels + ch]);
+}
+
+
+void lct_window_free(lct_window_t *win){
+    free(win->ring);
+    win->ring = NULL;
+}
+
+
 
 int lct_idle_init(lct_idle_t *idle, unsigned int interval_us, unsigned int resolution_us){
     if(clock_gettime(CLOCK_REALTIME, &idle->next))
@@ -489,3 +987,387 @@ int lct_idle(lct_idle_t *idle){
     // This should never be executed!
     return -1;
 }
+
+
+
+/************************************
+ *                                  *
+ *      Event loop                  *
+ *                                  *
+ ************************************/
+
+// Current CLOCK_MONOTONIC time in nanoseconds
+static int64_t lct_loop_now_ns(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((int64_t) now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// Time in nanoseconds for SAMPLES scans to arrive on a device
+// Returns a 1ms guess if the sample rate is not configured.
+static int64_t lct_loop_scans_ns(lc_devconf_t *dconf, unsigned int samples){
+    if(dconf->samplehz <= 0.)
+        return 1000000;
+    return (int64_t) (1e9 * samples / dconf->samplehz);
+}
+
+
+// The signals that LCT_LOOP_SIGNAL reports
+void loop_sigset(sigset_t *mask){
+    sigemptyset(mask);
+    sigaddset(mask, SIGINT);
+    sigaddset(mask, SIGTERM);
+    sigaddset(mask, SIGHUP);
+}
+
+
+int lct_loop_block_signals(void){
+    sigset_t mask;
+    int err;
+    loop_sigset(&mask);
+    if((err = pthread_sigmask(SIG_BLOCK, &mask, NULL))){
+        fprintf(stderr, "LCT_LOOP_BLOCK_SIGNALS: Failed to block the signals: %s\n", strerror(err));
+        return LC_ERROR;
+    }
+    return LC_NOERR;
+}
+
+
+int lct_loop_init(lct_loop_t *loop, lc_devconf_t dconf[], unsigned int ndev, int options){
+    struct epoll_event ev;
+    sigset_t mask, blocked;
+    unsigned int devnum;
+    int64_t now;
+
+    loop->epfd = -1;
+    loop->tfd = -1;
+    loop->sfd = -1;
+    loop->signo = 0;
+    loop->options = options;
+    loop->dconf = dconf;
+    loop->ndev = ndev;
+
+    if(ndev > LC_MAX_NDEV){
+        fprintf(stderr, "LCT_LOOP_INIT: %d devices requested, but only %d are allowed.\n", ndev, LC_MAX_NDEV);
+        return LC_ERROR;
+    }
+
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    loop->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(loop->epfd < 0 || loop->tfd < 0){
+        fprintf(stderr, "LCT_LOOP_INIT: Failed to create the epoll/timer file descriptors.\n");
+        lct_loop_close(loop);
+        return LC_ERROR;
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = loop->tfd;
+    epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->tfd, &ev);
+
+    // Watch stdin for keystrokes.  If stdin is a regular file (or 
+    // /dev/null), epoll refuses it with EPERM; there's nothing to wait for.
+    if(options & LCT_LOOP_STDIN){
+        ev.events = EPOLLIN;
+        ev.data.fd = LDISP_STDIN_FD;
+        if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, LDISP_STDIN_FD, &ev) && errno != EPERM){
+            fprintf(stderr, "LCT_LOOP_INIT: Failed to watch stdin.\n");
+            lct_loop_close(loop);
+            return LC_ERROR;
+        }
+    }
+
+    // Route the termination signals through a signalfd.  They must already
+    // be blocked in every thread, LJM's included (see 
+    // LCT_LOOP_BLOCK_SIGNALS()), or one could still end the process.
+    if(options & LCT_LOOP_SIGNAL){
+        loop_sigset(&mask);
+        pthread_sigmask(SIG_BLOCK, NULL, &blocked);
+        if(!sigismember(&blocked, SIGINT) || !sigismember(&blocked, SIGTERM)
+                || !sigismember(&blocked, SIGHUP)){
+            fprintf(stderr, "LCT_LOOP_INIT: Call lct_loop_block_signals() before opening the devices.\n");
+            lct_loop_close(loop);
+            return LC_ERROR;
+        }
+        loop->sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if(loop->sfd < 0){
+            fprintf(stderr, "LCT_LOOP_INIT: Failed to create the signal file descriptor.\n");
+            lct_loop_close(loop);
+            return LC_ERROR;
+        }
+        ev.events = EPOLLIN;
+        ev.data.fd = loop->sfd;
+        epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->sfd, &ev);
+    }
+
+    // The first block from each device is expected one block period after
+    // the stream was started.  Devices in callback mode wake the loop 
+    // through their eventfd instead, so they are never due on the timer.
+    now = lct_loop_now_ns();
+    for(devnum=0; devnum<ndev; devnum++){
+        if(lc_stream_fd(&dconf[devnum]) >= 0){
+            loop->due_ns[devnum] = INT64_MAX;
+            ev.events = EPOLLIN;
+            ev.data.fd = lc_stream_fd(&dconf[devnum]);
+            epoll_ctl(loop->epfd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+        }else
+            loop->due_ns[devnum] = now + lct_loop_scans_ns(&dconf[devnum], 
+                    dconf[devnum].RB.samples_per_read);
+    }
+    return LC_NOERR;
+}
+
+
+int lct_loop_wait(lct_loop_t *loop, int timeout_ms){
+    struct epoll_event evlist[4];
+    struct itimerspec its;
+    struct signalfd_siginfo sinfo;
+    uint64_t expirations;
+    int64_t now, next;
+    unsigned int devnum;
+    int ii, nev, events = 0;
+
+    // Find the earliest device due time
+    next = INT64_MAX;
+    for(devnum=0; devnum<loop->ndev; devnum++)
+        next = LDISP_MIN(next, loop->due_ns[devnum]);
+
+    now = lct_loop_now_ns();
+    if(next <= now){
+        // A device is already due; only check for input
+        events |= LCT_EV_DEVICE;
+        timeout_ms = 0;
+    }else if(next < INT64_MAX){
+        its.it_interval.tv_sec = 0;
+        its.it_interval.tv_nsec = 0;
+        its.it_value.tv_sec = next / 1000000000;
+        its.it_value.tv_nsec = next % 1000000000;
+        timerfd_settime(loop->tfd, TFD_TIMER_ABSTIME, &its, NULL);
+    }
+
+    nev = epoll_wait(loop->epfd, evlist, 4, timeout_ms);
+    if(nev < 0){
+        if(errno == EINTR)
+            return events;
+        fprintf(stderr, "LCT_LOOP_WAIT: epoll_wait() failed.\n");
+        return LC_ERROR;
+    }else if(nev == 0 && !events)
+        events |= LCT_EV_TIMEOUT;
+
+    for(ii=0; ii<nev; ii++){
+        if(evlist[ii].data.fd == loop->tfd){
+            // Clear the expiration count
+            read(loop->tfd, &expirations, sizeof(expirations));
+            events |= LCT_EV_DEVICE;
+        }else if(evlist[ii].data.fd == LDISP_STDIN_FD){
+            if(evlist[ii].events & EPOLLIN)
+                events |= LCT_EV_KEY;
+            // If stdin was closed, stop watching it, or we'll spin
+            else
+                epoll_ctl(loop->epfd, EPOLL_CTL_DEL, LDISP_STDIN_FD, NULL);
+        }else if(evlist[ii].data.fd == loop->sfd){
+            while(read(loop->sfd, &sinfo, sizeof(sinfo)) == sizeof(sinfo))
+                loop->signo = sinfo.ssi_signo;
+            events |= LCT_EV_SIGNAL;
+        }else{
+            // A stream callback delivered a block; clear its eventfd and
+            // mark the device due.
+            for(devnum=0; devnum<loop->ndev; devnum++){
+                if(evlist[ii].data.fd == lc_stream_fd(&loop->dconf[devnum])){
+                    read(evlist[ii].data.fd, &expirations, sizeof(expirations));
+                    loop->due_ns[devnum] = 0;
+                    events |= LCT_EV_DEVICE;
+                }
+            }
+        }
+    }
+    // The timer may have raced the epoll timeout
+    if(!(events & LCT_EV_DEVICE) && next <= lct_loop_now_ns())
+        events = (events & ~LCT_EV_TIMEOUT) | LCT_EV_DEVICE;
+    return events;
+}
+
+
+int lct_loop_service(lct_loop_t *loop, unsigned int devnum){
+    lc_devconf_t *dconf;
+    uint64_t blocks;
+    int64_t now, retry;
+    int err;
+
+    if(devnum >= loop->ndev)
+        return LC_ERROR;
+    dconf = &loop->dconf[devnum];
+    now = lct_loop_now_ns();
+    // Not due yet?  Nothing to do.
+    if(loop->due_ns[devnum] > now)
+        return LC_NOERR;
+
+    // In callback mode, the data are already in the buffer.  Just check 
+    // for errors and wait for the next wake-up.
+    if(lc_stream_fd(dconf) >= 0){
+        loop->due_ns[devnum] = INT64_MAX;
+        return lc_stream_service(dconf);
+    }
+
+    blocks = dconf->RB.blocks_streamed;
+    err = lc_stream_service(dconf);
+
+    if(dconf->RB.blocks_streamed != blocks){
+        // A block arrived.  If LJM is already holding the next one, come
+        // straight back.  Otherwise, wait for the remaining scans.
+        if(dconf->RB.backlog >= dconf->RB.samples_per_read)
+            loop->due_ns[devnum] = now;
+        else
+            loop->due_ns[devnum] = now + lct_loop_scans_ns(dconf, 
+                    dconf->RB.samples_per_read - dconf->RB.backlog);
+    }else{
+        // We were early; check back after a fraction of the block period.
+        retry = lct_loop_scans_ns(dconf, dconf->RB.samples_per_read) / LCT_LOOP_RETRY_DIV;
+        retry = LDISP_MAX(retry, LCT_LOOP_RETRY_MIN_US * 1000);
+        loop->due_ns[devnum] = now + retry;
+    }
+    return err;
+}
+
+
+void lct_loop_close(lct_loop_t *loop){
+    if(loop->sfd >= 0)
+        close(loop->sfd);
+    if(loop->tfd >= 0)
+        close(loop->tfd);
+    if(loop->epfd >= 0)
+        close(loop->epfd);
+    loop->sfd = -1;
+    loop->tfd = -1;
+    loop->epfd = -1;
+}
+
+
+
+/*..............................
+.   Clock drift correction
+..............................*/
+
+int lct_drift_init(lct_drift_t *drift, lc_devconf_t *dconf){
+    drift->out = NULL;
+    drift->size = 0;
+    drift->nominal = dconf->samplehz;
+    drift->ratio = dconf->downsample + 1;
+    drift->fed = 0;
+    drift->made = 0;
+    drift->first = -1.;
+    drift->last = -1.;
+    drift->sw = drift->st = drift->sr = drift->stt = drift->str = 0.;
+    drift->rate = dconf->samplehz;
+    drift->offset = 0.;
+    drift->valid = 0;
+    rs_init(&drift->rs);
+    if(dconf->RB.channels == 0 || rs_construct(&drift->rs, dconf->RB.channels)){
+        fprintf(stderr, "LCT_DRIFT_INIT: The stream must be started first.\n");
+        return LC_ERROR;
+    }
+    // Start with room for a block; LCT_DRIFT_APPLY() grows it if needed
+    drift->size = (dconf->RB.samples_per_read + RS_HISTORY) / (1. - LCT_DRIFT_MAX) + 2;
+    drift->out = malloc(drift->size * dconf->RB.channels * sizeof(double));
+    if(drift->out == NULL){
+        fprintf(stderr, "LCT_DRIFT_INIT: Failed to allocate the output buffer.\n");
+        rs_destruct(&drift->rs);
+        return LC_ERROR;
+    }
+    return LC_NOERR;
+}
+
+
+// Add the latest transfer to the clock fit.  The fit is done on the 
+// difference between the scans acquired and those expected at SAMPLEHZ, 
+// so the sums stay small even in very long tests.
+void lct_drift_fit(lct_drift_t *drift, lc_devconf_t *dconf){
+    double t, r, w, mt, mr, var;
+
+    if(lc_stream_clock(dconf, &t, &r) || t == drift->last)
+        return;
+    r -= drift->nominal * t;
+    if(drift->first < 0)
+        drift->first = t;
+    else{
+        w = exp((drift->last - t) / LCT_DRIFT_TAU);
+        drift->sw *= w;
+        drift->st *= w;
+        drift->sr *= w;
+        drift->stt *= w;
+        drift->str *= w;
+    }
+    drift->last = t;
+    drift->sw += 1.;
+    drift->st += t;
+    drift->sr += r;
+    drift->stt += t*t;
+    drift->str += t*r;
+    if(drift->last - drift->first < LCT_DRIFT_MIN_S)
+        return;
+    mt = drift->st / drift->sw;
+    mr = drift->sr / drift->sw;
+    var = drift->stt / drift->sw - mt*mt;
+    if(var <= 0.)
+        return;
+    r = (drift->str / drift->sw - mt*mr) / var;
+    drift->rate = drift->nominal + r;
+    drift->offset = mr - r*mt;
+    drift->valid = 1;
+}
+
+
+int lct_drift_apply(lct_drift_t *drift, lc_devconf_t *dconf, const double *data,
+        unsigned int channels, unsigned int samples, double **out, unsigned int *nout){
+    double target, step, fout;
+    unsigned int need;
+    int count;
+    double *ptr;
+
+    *out = drift->out;
+    *nout = 0;
+    if(channels != drift->rs.channels){
+        fprintf(stderr, "LCT_DRIFT_APPLY: Expected %d channels, but got %d.\n",
+                drift->rs.channels, channels);
+        return LC_ERROR;
+    }
+    lct_drift_fit(drift, dconf);
+    // Steer the resampler toward the position the fit predicts for the
+    // next output scan.
+    step = 1.;
+    if(drift->valid){
+        fout = drift->nominal / drift->ratio;
+        target = (drift->offset + drift->rate * drift->made / fout) / drift->ratio;
+        step = drift->rate / drift->nominal + \
+                (target - ((double) drift->fed - RS_HISTORY + drift->rs.t)) / (fout * LCT_DRIFT_LOCK_S);
+        step = step > 1. + LCT_DRIFT_MAX ? 1. + LCT_DRIFT_MAX : step;
+        step = step < 1. - LCT_DRIFT_MAX ? 1. - LCT_DRIFT_MAX : step;
+    }
+    drift->rs.step = step;
+    // Make sure there is room for the most outputs RS_EVAL() can produce
+    need = (samples + RS_HISTORY) / (1. - LCT_DRIFT_MAX) + 2;
+    if(need > drift->size){
+        ptr = realloc(drift->out, need * channels * sizeof(double));
+        if(ptr == NULL){
+            fprintf(stderr, "LCT_DRIFT_APPLY: Failed to allocate the output buffer.\n");
+            return LC_ERROR;
+        }
+        drift->out = ptr;
+        drift->size = need;
+    }
+    count = rs_eval(&drift->rs, data, samples, drift->out, drift->size);
+    if(count < 0)
+        return LC_ERROR;
+    drift->fed += samples;
+    drift->made += count;
+    *out = drift->out;
+    *nout = count;
+    return LC_NOERR;
+}
+
+
+void lct_drift_close(lct_drift_t *drift){
+    if(drift->out){
+        free(drift->out);
+        rs_destruct(&drift->rs);
+    }
+    drift->out = NULL;
+}
@@ -25,6 +25,23 @@ sequences for the Linux console environment.
 
 CHANGELOG
 
+v1.4    10/2026
+- Added the LCT_LOOP_T event loop for servicing parallel device streams
+- LCT_LOOP_T wakes on the stream eventfd of devices in callback mode
+- Added LCT_LOOP_BLOCK_SIGNALS() to block the loop signals in every thread
+- LCT_STREAM_STAT() processes all contiguous blocks in one call
+- Added LCT_STAT_BLOCK() for statistics on data that may not be modified
+- Added LCT_DRIFT_T to resample streams onto the host clock
+- Added LCT_BLOCK_T to transpose blocks into per-channel runs and back
+- Added LCT_PIPELINE() to calibrate, filter, downsample, and aggregate 
+  statistics in one pass
+- Statistics are aggregated with Welford/Chan updates on short chunks of 
+  per-channel runs (with AVX when available), so long runs on signals with
+  a large offset keep their precision.  LCT_STAT_T.N is 64-bit.
+- Added LCT_STAT_MERGE() to combine statistics from threads or devices
+- Added LCT_HIST_T fixed-bin histograms for streaming percentiles
+- Added LCT_WINDOW_T for statistics over a sliding window
+
 v1.3    3/2021
 - Added idle
 
@@ -50,6 +67,8 @@ v1.0	9/2019		ORIGINAL RELEASE
 #include <string.h>
 #include <termios.h>
 #include <sys/select.h>
+#include <signal.h>     // for the event loop signal mask
+#include <stdint.h>
 
 
 /****************************
@@ -58,7 +77,33 @@ v1.0	9/2019		ORIGINAL RELEASE
  *                          *
  ****************************/
 
-#define LCT_VERSION 1.3
+#define LCT_VERSION 1.4
+
+// Event flags returned by LCT_LOOP_WAIT()
+#define LCT_EV_DEVICE   0x01    // at least one device is due for service
+#define LCT_EV_KEY      0x02    // there is new input waiting on stdin
+#define LCT_EV_SIGNAL   0x04    // SIGINT, SIGTERM, or SIGHUP was received
+#define LCT_EV_TIMEOUT  0x08    // the application's timeout expired
+
+// Options accepted by LCT_LOOP_INIT()
+#define LCT_LOOP_STDIN  0x01    // wake on input from stdin
+#define LCT_LOOP_SIGNAL 0x02    // catch SIGINT, SIGTERM, and SIGHUP
+
+// When a device is serviced before its data are ready, it is retried
+// after 1/LCT_LOOP_RETRY_DIV of a block period, but never sooner than
+// LCT_LOOP_RETRY_MIN_US microseconds.
+#define LCT_LOOP_RETRY_DIV      8
+#define LCT_LOOP_RETRY_MIN_US   100
+
+// Options accepted by LCT_PIPELINE()
+#define LCT_PIPE_CAL    0x01    // write calibrated values instead of raw voltages
+
+// Clock drift correction (LCT_DRIFT_T)
+#define LCT_DRIFT_TAU       30.     // Memory of the clock fit in seconds
+#define LCT_DRIFT_MIN_S     2.      // Seconds of transfers needed before the fit is used
+#define LCT_DRIFT_LOCK_S    1.      // Time constant for removing a timing error
+#define LCT_DRIFT_MAX       0.01    // Largest relative rate correction allowed
+
 
 
 
@@ -294,6 +339,71 @@ double * lct_data(lc_devconf_t *dconf,
                 double data[], unsigned int data_size,
                 unsigned int channel, unsigned int sample);
 
+/* LCT_BLOCK_T
+.  LCT_BLOCK_SPLIT
+.  LCT_BLOCK_CHANNEL
+.  LCT_BLOCK_JOIN
+.  LCT_BLOCK_FREE
+.   Streamed data are interleaved; each scan holds one value from every 
+.   channel.  Loops that work on one channel at a time (calibrations, 
+.   filters, statistics) stride through the whole block once per channel,
+.   which wastes most of every cache line when there are many channels.
+.   LCT_BLOCK_SPLIT() transposes a block into a scratch buffer with each 
+.   channel's samples in one contiguous run, so those loops see unit-stride
+.   data that the compiler can vectorize.  LCT_BLOCK_JOIN() is the inverse.
+.
+.   The transpose is done in 4x4 tiles with AVX when the processor has it 
+.   and in cache-sized tiles otherwise.  The scratch buffer is kept between
+.   blocks and only grows, so the same LCT_BLOCK_T should be reused for 
+.   every block.  Runs are 64-byte aligned, and each is STRIDE doubles from
+.   the last.
+.
+lct_block_t block = {0};
+lc_stream_read(&dconf, &data, &channels, &samples);
+lct_block_split(&block, data, channels, samples);
+for(ch=0; ch<channels; ch++){
+    run = lct_block_channel(&block, ch);
+    for(ii=0; ii<samples; ii++)
+        // ... do something with run[ii] ...
+}
+lct_block_join(&block, data);   // only if the runs were changed
+...
+lct_block_free(&block);
+*/
+typedef struct __lct_block_t__ {
+    double *data;               // Scratch buffer (channel runs)
+    unsigned int channels;      // Channels in the current block
+    unsigned int samples;       // Samples in each run
+    size_t stride;              // Doubles from one run to the next
+    size_t size;                // Capacity of DATA in doubles
+} lct_block_t;
+
+/* LCT_BLOCK_SPLIT
+.   Copy SAMPLES scans of CHANNELS interleaved channels from DATA into 
+.   per-channel runs in BLOCK.  DATA is not modified.  Returns LC_NOERR, or
+.   LC_ERROR if the scratch buffer could not be allocated.
+*/
+int lct_block_split(lct_block_t *block, const double *data, 
+        unsigned int channels, unsigned int samples);
+
+/* LCT_BLOCK_CHANNEL
+.   Returns a pointer to the run of samples for CHANNEL, or NULL if CHANNEL
+.   is out of range.  The pointer is good until the next LCT_BLOCK_SPLIT().
+*/
+double * lct_block_channel(lct_block_t *block, unsigned int channel);
+
+/* LCT_BLOCK_JOIN
+.   Interleave the runs in BLOCK back into DATA, which must have room for
+.   BLOCK->CHANNELS * BLOCK->SAMPLES values.
+*/
+void lct_block_join(const lct_block_t *block, double *data);
+
+/* LCT_BLOCK_FREE
+.   Release the scratch buffer.  BLOCK may be reused afterwards.
+*/
+void lct_block_free(lct_block_t *block);
+
+
 /* LCT_CAL_INPLACE
 .   Apply the channel calibrations in-place on the target array.  The contents
 .   of the data array are presumed to be raw voltages as returned by the 
@@ -323,10 +433,19 @@ char * lct_cal_units(lc_devconf_t *dconf, unsigned int ainum);
 .       mean : the mean value
 .       max : the highest value
 .       min : the lowest value
-.       std : the standard deviation of the data
+.       var : the (population) variance of the data
+.
+.   Blocks are split into chunks of LCT_STAT_CHUNK samples per channel.  The
+.   mean and the sum of squared deviations from it are found for each chunk
+.   in two passes while it is still in cache, and the chunk is merged into
+.   the totals with Chan's parallel update.  Nothing is ever computed as a 
+.   difference of large sums, so a small noise on a large offset keeps its
+.   precision no matter how long the statistics run.
 */
+#define LCT_STAT_CHUNK  256     // Samples per channel in each statistics chunk
+
 typedef struct __lct_stat_t__ {
-    unsigned int n;
+    uint64_t n;
     double mean;
     double max;
     double min;
@@ -341,13 +460,21 @@ typedef struct __lct_stat_t__ {
 */
 void lct_stat_init(lct_stat_t stat[], unsigned int channels);
 
+/* LCT_STAT_MERGE
+.   Combine the statistics in OTHER with those in STAT, as if STAT had 
+.   aggregated all of the samples in both.  This is exact (to rounding), so
+.   statistics accumulated in separate threads, on separate devices, or in
+.   separate intervals can be merged in any order.
+*/
+void lct_stat_merge(lct_stat_t *stat, const lct_stat_t *other);
+
 /* LCT_STREAM_STAT
-.   Read in a single block of data from the buffer and aggregate statistics
-.   on the data.  LCT_STREAM_STAT() should be called in place of the 
-.   LC_STREAM_READ() function.  LCT_STREAM_STAT calls LC_STREAM_READ()
-.   to access data in the buffer directly.  If data are ready, they are
-.   calibrated in place using the LCT_CAL_INPLACE() function before
-.   statistics are aggregated.
+.   Read in all contiguous blocks of data waiting in the buffer and 
+.   aggregate statistics on the data.  LCT_STREAM_STAT() should be called in
+.   place of the LC_STREAM_READ() function.  LCT_STREAM_STAT calls 
+.   LC_STREAM_READ_BULK() to access data in the buffer directly, and 
+.   releases them when it is done.  If data are ready, they are
+.   passed to LCT_STAT_BLOCK().
 .
 .   The LCT_STAT_T VALUES struct contains the aggregated mean, maximum,
 .   minimum, and standard deviation.  Each element of the VALUES array
@@ -368,6 +495,171 @@ void lct_stat_init(lct_stat_t stat[], unsigned int channels);
 */
 int lct_stream_stat(lc_devconf_t *dconf, lct_stat_t values[], unsigned int maxchannels);
 
+/* LCT_STAT_BLOCK
+.   Aggregate statistics on SAMPLES scans of CHANNELS channels in DATA.  The
+.   analog input channels are calibrated as they are read, so DATA is not 
+.   modified.  This is the back-end for LCT_STREAM_STAT(), but it may be
+.   used on data from any source (like a shared memory segment, lcshm.h) 
+.   that share the stream's channel order.  VALUES and MAXCHANNELS are the
+.   same as for LCT_STREAM_STAT().
+*/
+int lct_stat_block(lc_devconf_t *dconf, lct_stat_t values[], const double *data,
+        unsigned int channels, unsigned int samples, unsigned int maxchannels);
+
+/* LCT_PIPELINE
+.   Process a block of SAMPLES scans of CHANNELS channels in DATA in a 
+.   single pass.  Each scan is read once: the anti-aliasing filters are
+.   applied, and the scans that LC_STREAM_DOWNSAMPLE() would keep are 
+.   calibrated, added to the statistics, and written back to the front of
+.   DATA.  A block costs one read and one write of memory instead of the
+.   separate passes of LC_STREAM_DOWNSAMPLE(), LCT_CAL_INPLACE(), and 
+.   LCT_STAT_BLOCK().
+.
+.   The kept scans are the same ones LC_STREAM_DOWNSAMPLE() keeps, so the
+.   two may be used interchangeably.  When DOWNSAMPLE is zero, every scan
+.   is kept and nothing is filtered.  On return, SAMPLES is the number of 
+.   scans kept.
+.
+.   With the LCT_PIPE_CAL option, the calibrated values are written to 
+.   DATA.  Otherwise, the raw voltages are kept, as data files expect.  If 
+.   VALUES is not NULL, the statistics on the calibrated values of the kept
+.   scans are aggregated in VALUES as in LCT_STAT_BLOCK(), and MAXCHANNELS
+.   has the same meaning.
+.
+.   Returns LC_NOERR on success and LC_ERROR if CHANNELS is too large.
+*/
+int lct_pipeline(lc_devconf_t *dconf, double *data, unsigned int channels,
+        unsigned int *samples, int options, lct_stat_t values[], 
+        unsigned int maxchannels);
+
+
+/* LCT_HIST_T
+.   A histogram of the raw samples on one analog input channel.  The bins
+.   evenly divide the channel's input range (-RANGE to +RANGE), which is all
+.   the device can measure, so memory is fixed no matter how many samples
+.   are counted.  Samples outside the range are counted in the end bins,
+.   and NaN samples are not counted.
+.   With LCT_HIST_BINS bins, the widest range (+/-10V) is resolved to about
+.   1.2mV and the narrowest to about 1.2uV.
+.
+.       n : the number of samples counted
+.       lo, hi : the raw voltage range spanned by the bins
+.       scale : bins per volt
+.       slope, zero : the channel's calibration
+.       bin : the count in each bin
+.
+.   Binning costs a multiply, a conversion, and an increment per sample, so
+.   it keeps up with every channel at the full stream rate.
+*/
+#define LCT_HIST_BINS   16384   // Bins in each LCT_HIST_T
+
+typedef struct __lct_hist_t__ {
+    uint64_t n;
+    double lo, hi;
+    double scale;
+    double slope, zero;
+    uint64_t bin[LCT_HIST_BINS];
+} lct_hist_t;
+
+/* LCT_HIST_INIT
+.   Initialize an array of CHANNELS histograms for the first analog input
+.   channels of DCONF.  Each is emptied and takes its range and calibration
+.   from its channel.  The array is laid out like the LCT_STAT_T array 
+.   passed to LCT_STAT_BLOCK().
+*/
+void lct_hist_init(lct_hist_t hist[], lc_devconf_t *dconf, unsigned int channels);
+
+/* LCT_HIST_BLOCK
+.   Count SAMPLES scans of CHANNELS channels in DATA in the histograms. 
+.   Only the analog input channels are counted, and no more than 
+.   MAXCHANNELS of them if MAXCHANNELS is not zero.  DATA are not modified.
+.
+.   Returns LC_NOERR.
+*/
+int lct_hist_block(lc_devconf_t *dconf, lct_hist_t hist[], const double *data,
+        unsigned int channels, unsigned int samples, unsigned int maxchannels);
+
+/* LCT_HIST_QUANTILE
+.   Estimate the calibrated value below which a fraction P (0 to 1) of the
+.   counted samples fall.  The value is interpolated within its bin.  For
+.   example, P=0.5 gives the median and P=0.99 gives the 99th percentile.
+.   Returns NAN if the histogram is empty.
+*/
+double lct_hist_quantile(const lct_hist_t *hist, double p);
+
+/* LCT_HIST_MERGE
+.   Add the counts in OTHER to HIST.  Both must have been initialized for 
+.   the same range.  Returns LC_NOERR on success and LC_ERROR if the ranges
+.   differ.
+*/
+int lct_hist_merge(lct_hist_t *hist, const lct_hist_t *other);
+
+
+/* LCT_WINDOW_T
+.   Statistics over the most recent samples of a stream instead of every 
+.   sample since it began.  The window is divided into slots, and a ring 
+.   keeps an LCT_STAT_T for each channel in each slot.  New samples are 
+.   aggregated into the newest slot, and when it is full, the oldest slot
+.   is cleared and takes its place.  The statistics on the whole window are
+.   found by merging the slots with LCT_STAT_MERGE(), so they cost one 
+.   merge per slot no matter how long the window is, and the samples 
+.   themselves are never kept.
+.
+.       ring : NSLOT x CHANNELS statistics, one row per slot
+.       channels : the number of channels in each row
+.       nslot : the number of slots in the ring
+.       slot : the number of samples per channel in each slot
+.       head : the slot being filled
+.       fill : the number of samples in the head slot
+.
+.   The window spans between (NSLOT-1)*SLOT and NSLOT*SLOT samples once the
+.   ring has filled.
+*/
+#define LCT_WINDOW_MAXSLOT  1024    // Most slots in an LCT_WINDOW_T ring
+
+typedef struct __lct_window_t__ {
+    lct_stat_t *ring;
+    unsigned int channels;
+    unsigned int nslot;
+    unsigned int slot;
+    unsigned int head;
+    unsigned int fill;
+} lct_window_t;
+
+/* LCT_WINDOW_INIT
+.   Allocate and clear a window of at least WINDOW samples per channel on
+.   CHANNELS channels.  SLOT is the preferred number of samples in each 
+.   slot; it is usually the stream's SAMPLES_PER_READ, so each block fills
+.   about one slot.  Slots are made longer if the window would otherwise 
+.   need more than LCT_WINDOW_MAXSLOT of them.
+.
+.   Returns LC_NOERR on success and LC_ERROR on failure.
+*/
+int lct_window_init(lct_window_t *win, unsigned int channels, 
+        uint64_t window, unsigned int slot);
+
+/* LCT_WINDOW_BLOCK
+.   Aggregate statistics on SAMPLES scans of CHANNELS channels in DATA into
+.   the window.  This is LCT_STAT_BLOCK() for windows, and the block may be
+.   any length; it is split across slots as needed.
+.
+.   Returns LC_NOERR on success and LC_ERROR on failure.
+*/
+int lct_window_block(lc_devconf_t *dconf, lct_window_t *win, const double *data,
+        unsigned int channels, unsigned int samples);
+
+/* LCT_WINDOW_STAT
+.   Write the statistics on every sample in the window to the first 
+.   WIN->CHANNELS elements of VALUES.
+*/
+void lct_window_stat(const lct_window_t *win, lct_stat_t values[]);
+
+/* LCT_WINDOW_FREE
+.   Release the window's ring.  It is safe to call this on a window whose
+.   RING is NULL.
+*/
+void lct_window_free(lct_window_t *win);
+
 
 
 
@@ -404,4 +696,157 @@ while(1){
 int lct_idle_init(lct_idle_t *idle, unsigned int interval_us, unsigned int resolution_us);
 int lct_idle(lct_idle_t *idle);
 
+
+
+/* LCT_LOOP_T
+.  LCT_LOOP_BLOCK_SIGNALS
+.  LCT_LOOP_INIT
+.  LCT_LOOP_WAIT
+.  LCT_LOOP_SERVICE
+.  LCT_LOOP_CLOSE
+.   The LCT_LOOP_T struct and its supporting functions replace a polling 
+.   loop built on LCT_IDLE() and LCT_IS_KEYPRESS() for applications that 
+.   stream from one or more devices in parallel.  Rather than calling 
+.   LC_STREAM_SERVICE() on every device on a fixed tick, the loop predicts 
+.   when each device's next block will be complete from its SAMPLEHZ and 
+.   SAMPLES_PER_READ (and from the LJM backlog reported by the last 
+.   service), and the process sleeps in a single epoll_wait() until the
+.   earliest of those times, a keystroke on stdin, or a signal.  Devices 
+.   with SERVICE set to CALLBACK are not scheduled at all; the loop wakes 
+.   on their LC_STREAM_FD() descriptor when LJM delivers a block.
+.
+.   LCT_LOOP_INIT() should be called after LC_STREAM_START() has been 
+.   called on all NDEV devices in the DCONF array.  OPTIONS is a bitwise OR
+.   of LCT_LOOP_STDIN and LCT_LOOP_SIGNAL.  When LCT_LOOP_SIGNAL is set, 
+.   SIGINT, SIGTERM, and SIGHUP are reported by LCT_LOOP_WAIT() so the 
+.   application can halt gracefully.  Returns LC_NOERR or LC_ERROR.
+.
+.   A signal is delivered to any thread that does not block it, and 
+.   LC_OPEN() and LC_STREAM_START() start threads inside LJM.  So, with 
+.   LCT_LOOP_SIGNAL, the application must call LCT_LOOP_BLOCK_SIGNALS() in
+.   main() before any device is opened; new threads inherit the mask.  
+.   Otherwise, a signal could land in an LJM thread and end the process 
+.   without a chance to close its files.  LCT_LOOP_INIT() fails if the 
+.   signals are not blocked.  They stay blocked after LCT_LOOP_CLOSE().
+.
+.   LCT_LOOP_WAIT() blocks until at least one device is due for service, 
+.   stdin is readable, a signal arrives, or TIMEOUT_MS milliseconds pass.
+.   A negative TIMEOUT_MS waits indefinitely.  It returns a bitwise OR of
+.   the LCT_EV_XXX flags or LC_ERROR if the wait failed.  The number of the
+.   last signal received is kept in the SIGNO member.
+.
+.   LCT_LOOP_SERVICE() calls LC_STREAM_SERVICE() on device DEVNUM if (and 
+.   only if) it is due, and then schedules its next service.  It is safe 
+.   to call on every device after every wake-up.  It returns the error 
+.   returned by LC_STREAM_SERVICE().
+.
+.   LCT_LOOP_CLOSE() releases the loop's file descriptors.
+
+lct_loop_t loop;
+lct_loop_block_signals();
+... open and start the devices ...
+lct_loop_init(&loop, dconf, ndev, LCT_LOOP_STDIN | LCT_LOOP_SIGNAL);
+while(go){
+    events = lct_loop_wait(&loop, -1);
+    for(devnum=0; devnum<ndev; devnum++){
+        lct_loop_service(&loop, devnum);
+        while(!lc_stream_isempty(&dconf[devnum])){
+            ... read the data ...
+        }
+    }
+    if(events & LCT_EV_KEY && getchar() == 'Q')
+        go = 0;
+}
+lct_loop_close(&loop);
+*/
+typedef struct __lct_loop_t__ {
+    int epfd;                       // epoll instance
+    int tfd;                        // timerfd armed for the next due device
+    int sfd;                        // signalfd (or -1)
+    int signo;                      // the last signal received
+    int options;                    // LCT_LOOP_XXX options
+    lc_devconf_t *dconf;            // device configuration array
+    unsigned int ndev;              // number of devices
+    int64_t due_ns[LC_MAX_NDEV];    // next service time (CLOCK_MONOTONIC)
+} lct_loop_t;
+
+int lct_loop_block_signals(void);
+int lct_loop_init(lct_loop_t *loop, lc_devconf_t dconf[], unsigned int ndev, int options);
+int lct_loop_wait(lct_loop_t *loop, int timeout_ms);
+int lct_loop_service(lct_loop_t *loop, unsigned int devnum);
+void lct_loop_close(lct_loop_t *loop);
+
+
+
+/* LCT_DRIFT_T
+.  LCT_DRIFT_INIT
+.  LCT_DRIFT_APPLY
+.  LCT_DRIFT_CLOSE
+.   Independent devices run on separate oscillators, so two devices set to 
+.   the same SAMPLEHZ slowly drift apart by many samples over a long test.
+.   The LCT_DRIFT_T struct and its supporting functions resample a device's
+.   stream so that its scans land on the nominal rate as measured by the 
+.   host clock.  Streams from several devices that are corrected this way 
+.   can be compared sample-by-sample.
+.
+.   The device's true rate is measured by a least-squares line through the
+.   times and scan counts reported by LC_STREAM_CLOCK() after every 
+.   transfer.  Older transfers are forgotten with a time constant of 
+.   LCT_DRIFT_TAU seconds, so slow changes in the oscillator (with 
+.   temperature, for example) are followed.  Until LCT_DRIFT_MIN_S seconds
+.   of transfers have been seen, the data are passed through unchanged.
+.   After that, output scan N is interpolated (see RS_EVAL() in lcfilter.h)
+.   at the input position the fit predicts for N/F seconds after the stream
+.   started, where F is LC_DOWNSAMPLEHZ().  Any error in the position is
+.   removed with a time constant of LCT_DRIFT_LOCK_S seconds, and the 
+.   correction never exceeds LCT_DRIFT_MAX.  Because the scans are timed by
+.   their arrival at the host, the outputs trail the measurements by the
+.   transfer latency, which is about the same for similar devices.
+.
+.   LCT_DRIFT_INIT() should be called after LC_STREAM_START().  It returns
+.   LC_NOERR or LC_ERROR.
+.
+.   LCT_DRIFT_APPLY() accepts SAMPLES scans of CHANNELS channels in DATA, 
+.   after they have been downsampled by LC_STREAM_DOWNSAMPLE(), and points
+.   *OUT to the corrected scans and sets *NOUT to their number.  The output
+.   belongs to DRIFT and is overwritten by the next call.  It returns 
+.   LC_NOERR or LC_ERROR.
+.
+.   LCT_DRIFT_CLOSE() releases the memory.  It is safe to call on a struct
+.   whose OUT member was set to NULL, even if LCT_DRIFT_INIT() was never
+.   called.
+
+lct_drift_t drift;
+lc_stream_start(&dconf, -1);
+lct_drift_init(&drift, &dconf);
+while(go){
+    ...
+    lc_stream_downsample(&dconf, data, channels, &samples);
+    lct_drift_apply(&drift, &dconf, data, channels, samples, &out, &nout);
+    lc_datafile_write(&dconf, dfile, out, channels, nout);
+    ...
+}
+lct_drift_close(&drift);
+*/
+typedef struct __lct_drift_t__ {
+    rs_t rs;                // the fractional resampler
+    double *out;            // corrected scans
+    unsigned int size;      // scans allocated in OUT
+    double nominal;         // SAMPLEHZ
+    double ratio;           // raw scans per input scan (DOWNSAMPLE + 1)
+    uint64_t fed;           // input scans given to the resampler
+    uint64_t made;          // output scans produced
+    double first;           // time of the first transfer in the fit
+    double last;            // time of the latest transfer in the fit
+    double sw, st, sr, stt, str;    // weighted sums for the fit
+    double rate;            // measured scan rate in Hz (host clock)
+    double offset;          // scans acquired at the start of the stream
+    int valid;              // 1 once RATE and OFFSET are in use
+} lct_drift_t;
+
+int lct_drift_init(lct_drift_t *drift, lc_devconf_t *dconf);
+int lct_drift_apply(lct_drift_t *drift, lc_devconf_t *dconf, const double *data,
+        unsigned int channels, unsigned int samples, double **out, unsigned int *nout);
+void lct_drift_close(lct_drift_t *drift);
+
 #endif
@@ -0,0 +1,274 @@
+/*
+  This file is part of the LCONFIG laboratory configuration system.
+
+    LCONFIG is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    LCONFIG is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with LCONFIG.  If not, see <https://www.gnu.org/licenses/>.
+
+    Authored by C.Martin crm28@psu.edu
+*/
+
+#define _GNU_SOURCE         // for memmem
+#include "lconfig.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAXSTR      128
+
+
+/*....................
+. Help text
+.....................*/
+const char help_text[] = \
+"lcverify [-h] [-r OUTFILE] DATAFILE\n"\
+"  Checks every frame in a framed data file (dataformat framed or\n"\
+"  columnar) and reports what it finds.  Each frame's length and CRC32C\n"\
+"  are checked, and the frame numbers are checked for gaps.  When a frame\n"\
+"  is damaged, the search resumes at the next frame that is intact, so\n"\
+"  one bad block only costs that block.  A file from a test that was\n"\
+"  killed or lost power usually just ends in a partial frame and has no\n"\
+"  final index.\n"\
+"\n"\
+"  The exit status is 0 if the file is intact, 1 if it is damaged, and\n"\
+"  -1 if it could not be read.\n"\
+"\n"\
+"-r OUTFILE\n"\
+"  Write the header and every intact data frame to OUTFILE with a fresh\n"\
+"  set of index checkpoints.  The frames keep their original numbers and\n"\
+"  scan indices, so gaps in the recovered file show what was lost.\n"\
+"\n"\
+"GPLv3\n"\
+"(c)2026 C.Martin\n";
+
+
+// Frames copied to a recovered file and the index it needs
+typedef struct __recover_t__ {
+    FILE *ff;
+    uint64_t offset;                // Offset of the next frame
+    uint64_t last_index;            // Offset of the last checkpoint
+    uint64_t seq, scan;             // First frame since the last checkpoint
+    unsigned int nindex;
+    uint64_t index[LC_FRAME_NINDEX + 1];
+} recover_t;
+
+
+// Returns the length of the intact frame at OFFSET or 0 if it is not intact
+uint64_t check_frame(const char *map, uint64_t size, uint64_t offset){
+    lc_frame_t frame;
+    lc_frame_end_t end;
+    uint32_t crc;
+
+    if(offset + sizeof(frame) + sizeof(end) > size)
+        return 0;
+    memcpy(&frame, map + offset, sizeof(frame));
+    if(frame.magic != LC_FRAME_MAGIC
+            || (frame.type != LC_FRAME_DATA && frame.type != LC_FRAME_COLUMNS
+                && frame.type != LC_FRAME_INDEX)
+            || frame.bytes > size - offset - sizeof(frame) - sizeof(end))
+        return 0;
+    memcpy(&end, map + offset + sizeof(frame) + frame.bytes, sizeof(end));
+    if(end.length != sizeof(frame) + frame.bytes)
+        return 0;
+    crc = lc_crc32c(0, map + offset, sizeof(frame) + frame.bytes);
+    if(crc != end.crc)
+        return 0;
+    return sizeof(frame) + frame.bytes + sizeof(end);
+}
+
+
+// Write an index checkpoint to the recovered file
+void recover_checkpoint(recover_t *rec){
+    lc_frame_t frame;
+    lc_frame_end_t end;
+
+    if(rec->nindex == 0)
+        return;
+    memset(&frame, 0, sizeof(frame));
+    frame.magic = LC_FRAME_MAGIC;
+    frame.type = LC_FRAME_INDEX;
+    frame.seq = rec->seq;
+    frame.scan = rec->scan;
+    frame.samples = rec->nindex;
+    frame.bytes = (rec->nindex + 1) * sizeof(uint64_t);
+    rec->index[rec->nindex] = rec->last_index;
+    end.crc = lc_crc32c(lc_crc32c(0, &frame, sizeof(frame)), rec->index, frame.bytes);
+    end.length = sizeof(frame) + frame.bytes;
+    fwrite(&frame, sizeof(frame), 1, rec->ff);
+    fwrite(rec->index, frame.bytes, 1, rec->ff);
+    fwrite(&end, sizeof(end), 1, rec->ff);
+    rec->last_index = rec->offset;
+    rec->offset += end.length + sizeof(end);
+    rec->nindex = 0;
+}
+
+
+// Copy an intact data frame to the recovered file
+void recover_frame(recover_t *rec, const char *map, uint64_t offset, uint64_t length){
+    const lc_frame_t *frame = (const lc_frame_t*) (map + offset);
+
+    if(rec->nindex == 0){
+        rec->seq = frame->seq;
+        rec->scan = frame->scan;
+    }
+    fwrite(map + offset, length, 1, rec->ff);
+    rec->index[rec->nindex++] = rec->offset;
+    rec->offset += length;
+    if(rec->nindex >= LC_FRAME_NINDEX)
+        recover_checkpoint(rec);
+}
+
+
+/*....................
+. Main
+.....................*/
+int main(int argc, char *argv[]){
+    char    out_file[MAXSTR] = "",
+            go;
+    int     fd;
+    struct stat st;
+    char    *map, *line;
+    uint64_t size, start, offset, length, skip;
+    uint64_t nframes = 0, nscans = 0, nindex = 0, nbad = 0, badbytes = 0,
+            ngaps = 0, next_seq = 0, last_end;
+    int     final_index = 0;
+    lc_frame_t frame;
+    recover_t rec;
+
+    while((go = getopt(argc, argv, "hr:"))!=-1){
+        switch(go){
+        case 'r':
+            if(snprintf(out_file, MAXSTR, "%s", optarg) >= MAXSTR){
+                fprintf(stderr, "LCVERIFY: The output file name is too long: %s\n", optarg);
+                return -1;
+            }
+        break;
+        case 'h':
+            printf(help_text);
+            return 0;
+        default:
+            fprintf(stderr, "LCVERIFY: Got unsupported command line option: %c\n", go);
+            return -1;
+        }
+    }
+    if(optind != argc-1){
+        fprintf(stderr, "LCVERIFY: Expected one data file.\n");
+        return -1;
+    }
+
+    fd = open(argv[optind], O_RDONLY);
+    if(fd < 0 || fstat(fd, &st)){
+        fprintf(stderr, "LCVERIFY: Failed to open data file: %s\n", argv[optind]);
+        return -1;
+    }
+    size = st.st_size;
+    map = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if(map == MAP_FAILED){
+        fprintf(stderr, "LCVERIFY: Failed to read data file: %s\n", argv[optind]);
+        return -1;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    // The frames start after the "#:" timestamp line that ends the header
+    start = 0;
+    line = memmem(map, size, "\n#:", 3);
+    if(line)
+        line = memchr(line + 1, '\n', map + size - line - 1);
+    if(line)
+        start = line + 1 - map;
+    if(start == 0 || !check_frame(map, size, start)){
+        // Even a damaged file should have a frame somewhere
+        for(offset=start; offset + sizeof(frame) < size; offset++)
+            if(check_frame(map, size, offset))
+                break;
+        if(start == 0 || offset + sizeof(frame) >= size){
+            fprintf(stderr, "LCVERIFY: %s is not a framed data file.\n", argv[optind]);
+            munmap(map, size);
+            return -1;
+        }
+    }
+
+    if(out_file[0]){
+        memset(&rec, 0, sizeof(rec));
+        rec.ff = fopen(out_file, "wb");
+        if(rec.ff == NULL){
+            fprintf(stderr, "LCVERIFY: Failed to open output file: %s\n", out_file);
+            munmap(map, size);
+            return -1;
+        }
+        fwrite(map, start, 1, rec.ff);
+        rec.offset = start;
+    }
+
+    offset = start;
+    last_end = start;
+    while(offset < size){
+        length = check_frame(map, size, offset);
+        if(length == 0){
+            // Look for the next intact frame
+            for(skip=offset+1; skip + sizeof(frame) < size; skip++)
+                if(check_frame(map, size, skip))
+                    break;
+            if(skip + sizeof(frame) >= size)
+                skip = size;
+            nbad ++;
+            badbytes += skip - offset;
+            printf("Damaged: bytes %llu to %llu\n",
+                    (unsigned long long) offset, (unsigned long long) skip);
+            offset = skip;
+            continue;
+        }
+        memcpy(&frame, map + offset, sizeof(frame));
+        if(frame.type != LC_FRAME_INDEX){
+            if(frame.seq != next_seq){
+                ngaps ++;
+                printf("Missing: frames %llu to %llu\n",
+                        (unsigned long long) next_seq, (unsigned long long) frame.seq - 1);
+            }
+            next_seq = frame.seq + 1;
+            nframes ++;
+            nscans += frame.samples;
+            if(out_file[0])
+                recover_frame(&rec, map, offset, length);
+        }else
+            nindex ++;
+        final_index = frame.type == LC_FRAME_INDEX;
+        offset += length;
+        last_end = offset;
+    }
+
+    printf("%s\n", argv[optind]);
+    printf("  %llu data frames (%llu scans)\n",
+            (unsigned long long) nframes, (unsigned long long) nscans);
+    printf("  %llu index checkpoints\n", (unsigned long long) nindex);
+    printf("  %llu damaged regions (%llu bytes)\n",
+            (unsigned long long) nbad, (unsigned long long) badbytes);
+    printf("  %llu gaps in the frame numbers\n", (unsigned long long) ngaps);
+    if(!final_index)
+        printf("  The file does not end with an index; it was not closed cleanly.\n");
+    if(last_end < size)
+        printf("  The last intact frame ends %llu bytes before the end of the file.\n",
+                (unsigned long long) (size - last_end));
+
+    if(out_file[0]){
+        recover_checkpoint(&rec);
+        fclose(rec.ff);
+        printf("Wrote %llu frames to %s\n", (unsigned long long) nframes, out_file);
+    }
+    munmap(map, size);
+    return (nbad || ngaps || !final_index) ? 1 : 0;
+}
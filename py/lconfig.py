@@ -20,21 +20,219 @@ By default
 
 """
 
-import os, sys
+import os, sys, io
 import numpy as np
 import json
 import matplotlib.pyplot as plt
 import struct
 import time
 
-__version__ = '4.07'
+__version__ = '4.09'
 
 
 
 
 
 
+# Framed data files (see LC_FRAME_T in lconfig.h)
+_FRAME = struct.Struct('=IIQQIIQ')
+_FRAME_END = struct.Struct('=II')
+_FRAME_MAGIC = 0x4c434642
+_FRAME_DATA = 1
+_FRAME_INDEX = 2
+_FRAME_COLUMNS = 3
+_CRC32C_TABLE = []
+
+
 # Helper funcitons
+def _crc32c(data, crc=0):
+    """Continue the CRC32C checksum CRC over the bytes in DATA
+crc = _crc32c(data, crc=0)
+"""
+    if not _CRC32C_TABLE:
+        for ii in range(256):
+            c = ii
+            for jj in range(8):
+                c = (c >> 1) ^ (0x82f63b78 if c & 1 else 0)
+            _CRC32C_TABLE.append(c)
+    crc ^= 0xffffffff
+    for b in data:
+        crc = _CRC32C_TABLE[(crc ^ b) & 0xff] ^ (crc >> 8)
+    return crc ^ 0xffffffff
+
+
+def _frame_offsets(ff, start):
+    """Find the offsets of the data frames in a framed file
+offsets = _frame_offsets(ff, start)
+
+START is the offset of the first frame.  When the file was closed 
+properly, it ends in an index checkpoint, and the offsets are found by
+following the checkpoints back to the start.  Otherwise, the frames are
+walked from the start until the file ends or a damaged frame is found.
+"""
+    ff.seek(0, 2)
+    end = ff.tell()
+    # Try the index first.  Each checkpoint must end exactly where the next
+    # one (or the file) begins to be trusted, and any mismatch falls back 
+    # to the walk; a file cut off mid-frame can end in anything.
+    offsets = []
+    if end - start >= _FRAME.size + _FRAME_END.size:
+        ff.seek(end - _FRAME_END.size)
+        crc, length = _FRAME_END.unpack(ff.read(_FRAME_END.size))
+        offset = end - _FRAME_END.size - length
+        limit = end
+        while start <= offset < limit:
+            ff.seek(offset)
+            header = ff.read(_FRAME.size)
+            if len(header) < _FRAME.size:
+                break
+            magic, ftype, seq, scan, channels, samples, nbytes = \
+                    _FRAME.unpack(header)
+            trailer = offset + _FRAME.size + nbytes
+            if magic != _FRAME_MAGIC or ftype != _FRAME_INDEX \
+                    or nbytes != 8*(samples+1) \
+                    or trailer + _FRAME_END.size > limit \
+                    or (limit == end and trailer + _FRAME_END.size != end):
+                break
+            payload = ff.read(nbytes)
+            tail = ff.read(_FRAME_END.size)
+            if len(payload) < nbytes or len(tail) < _FRAME_END.size:
+                break
+            crc, length = _FRAME_END.unpack(tail)
+            if length != trailer - offset or \
+                    _crc32c(payload, _crc32c(header)) != crc:
+                break
+            index = struct.unpack('=%dQ'%(samples+1), payload)
+            if not all(start <= ii < offset for ii in index[:-1]):
+                break
+            offsets = list(index[:-1]) + offsets
+            # The first checkpoint points back to zero
+            if index[-1] == 0:
+                return offsets
+            limit = offset
+            offset = index[-1]
+    
+    # Walk the frames
+    offsets = []
+    offset = start
+    while offset < end:
+        ff.seek(offset)
+        header = ff.read(_FRAME.size)
+        if len(header) < _FRAME.size:
+            print('LOAD: WARNING: the file ends in a partial frame.')
+            break
+        magic, ftype, seq, scan, channels, samples, nbytes = _FRAME.unpack(header)
+        if magic != _FRAME_MAGIC:
+            print('LOAD: WARNING: damaged frame at byte %d; the rest of the file was ignored.'%offset)
+            print('    Use lcverify -r to recover the frames that follow it.')
+            break
+        if offset + _FRAME.size + nbytes + _FRAME_END.size > end:
+            print('LOAD: WARNING: the file ends in a partial frame.')
+            break
+        if ftype != _FRAME_INDEX:
+            offsets.append(offset)
+        offset += _FRAME.size + nbytes + _FRAME_END.size
+    return offsets
+    
+
+def _next_frame(ff):
+    """Read the frame at the current position
+header, raw, payload, crc = _next_frame(ff)
+
+HEADER is the unpacked LC_FRAME_T, RAW is its bytes, and CRC is from the
+end record.  Returns None at the end of the data.
+"""
+    raw = ff.read(_FRAME.size)
+    if not raw:
+        return None
+    if len(raw) < _FRAME.size:
+        print('LOAD: WARNING: the file ends in a partial frame.')
+        return None
+    header = _FRAME.unpack(raw)
+    if header[0] != _FRAME_MAGIC:
+        print('LOAD: WARNING: found a damaged frame; the rest of the data were ignored.')
+        print('    Use lcverify -r to recover the frames that follow it.')
+        return None
+    payload = ff.read(header[6])
+    end = ff.read(_FRAME_END.size)
+    if len(payload) < header[6] or len(end) < _FRAME_END.size:
+        print('LOAD: WARNING: the file ends in a partial frame.')
+        return None
+    crc, length = _FRAME_END.unpack(end)
+    return header, raw, payload, crc
+
+
+def _frames_at(ff, offsets):
+    """Yield the frames at OFFSETS in a file"""
+    for offset in offsets:
+        ff.seek(offset)
+        frame = _next_frame(ff)
+        if frame:
+            yield frame
+
+
+def _read_frames(ff, nch, verify=False, frames=None, columns=None):
+    """Read the data from a framed file
+data, scan0 = _read_frames(ff, nch, verify=False, frames=None, columns=None)
+
+The frames start at the current position in FF.  DATA is a list of rows,
+and SCAN0 is the index of the first scan read.  FRAMES is a slice that 
+selects the data frames to read.  COLUMNS lists the columns to read from
+columnar frames; only those parts of each frame are read, and the other
+columns are NaN.  Interleaved frames are always read whole.
+"""
+    offsets = _frame_offsets(ff, ff.tell())
+    if frames is not None:
+        offsets = offsets[frames]
+    data = []
+    scan0 = None
+    next_seq = None
+    nan = float('nan')
+    for offset in offsets:
+        ff.seek(offset)
+        raw = ff.read(_FRAME.size)
+        if len(raw) < _FRAME.size:
+            print('LOAD: WARNING: the file ends in a partial frame.')
+            break
+        magic, ftype, seq, scan, channels, samples, nbytes = _FRAME.unpack(raw)
+        if channels != nch:
+            raise Exception('LOAD: Frame %d has %d channels, but the header has %d.'%(seq, channels, nch))
+        if next_seq is not None and seq != next_seq:
+            print('LOAD: WARNING: frames %d to %d are missing.'%(next_seq, seq-1))
+        # Columnar frames hold one run of SAMPLES values per channel
+        if ftype == _FRAME_COLUMNS and columns is not None and not verify:
+            runs = [[nan]*samples for ch in range(nch)]
+            for ch in columns:
+                ff.seek(offset + _FRAME.size + 4*samples*ch)
+                run = ff.read(4*samples)
+                if len(run) < 4*samples:
+                    print('LOAD: WARNING: the file ends in a partial frame.')
+                    return data, scan0
+                runs[ch] = struct.unpack('=%df'%samples, run)
+        else:
+            ff.seek(offset)
+            frame = _next_frame(ff)
+            if frame is None:
+                break
+            header, raw, payload, crc = frame
+            if verify and _crc32c(payload, _crc32c(raw)) != crc:
+                print('LOAD: WARNING: frame %d failed its CRC check and was skipped.'%seq)
+                continue
+            values = struct.unpack('=%df'%(channels*samples), payload)
+            if ftype == _FRAME_COLUMNS:
+                runs = [values[ch*samples:(ch+1)*samples] for ch in range(nch)]
+            else:
+                runs = None
+                for ii in range(0, len(values), nch):
+                    data.append(list(values[ii:ii+nch]))
+        if runs is not None:
+            data += [list(row) for row in zip(*runs)]
+        next_seq = seq + 1
+        if scan0 is None:
+            scan0 = scan
+    return data, scan0
+    
+
 def _read_param(ff):
     """Read in a single word
 word = read_pair(ff)
@@ -248,7 +446,11 @@ They are:
     subnet          str     Subnet mask
     samplehz        float   Sample rate in hz
     settleus        float   Settling time in microseconds
+    latencyms       float   Target block latency in milliseconds
     nsample         int     Number of samples per measurement burst
+    downsample      int     Samples to discard per sample kept
+    service         LEnum   Stream service mode: poll, callback
+    ringbuffer      LEnum   Ring buffer memory: block, mirror
     distream        int     Digital input stream mask
     domask          int     Digital output mask
     dovalue         int     Digital output value
@@ -283,14 +485,18 @@ produce a detailed printout of the parameters.
             'connection':LEnum(['any', 'usb', 'eth', 'ethernet'], values=[0,1,3,3]),
             'serial':'',
             'device':LEnum(['any', 't4', 't7', 'tx', 'digit'], values=[0, 4, 7, 84, 200]),
-            'dataformat':LEnum(['ascii','text','bin','binary'], values=[0,0,1,1]),
+            'dataformat':LEnum(['ascii','text','bin','binary','framed','columnar'], values=[0,0,1,1,2,3]),
             'name':'',
             'ip':'',
             'gateway':'',
             'subnet':'',
             'samplehz':-1.,
             'settleus':1.,
+            'latencyms':-1.,
             'nsample':64,
+            'downsample':0,
+            'service':LEnum(['poll', 'callback'], values=[0,1]),
+            'ringbuffer':LEnum(['block', 'mirror'], values=[0,1]),
             'distream':0,
             'domask':0,
             'dovalue':0,
@@ -361,8 +567,8 @@ produce a detailed printout of the parameters.
         out += fmt.format('connection', self.connection.get())
         out += fmt.format('device', self.device.get())
         for attr in ['name', 'serial', 'ip', 'subnet', 'gateway', 
-                'dataformat', 'samplehz', 'settleus', 'nsample', 'distream',
-                'domask', 'dovalue']:
+                'dataformat', 'samplehz', 'settleus', 'nsample', 'downsample',
+                'service', 'ringbuffer', 'distream', 'domask', 'dovalue']:
             
             value = getattr(self, attr)
             if isinstance(value, LEnum):
@@ -607,6 +813,15 @@ appear in the same order in which they were ligsted in the configuration.
 Once populated, the timestamp is a `time.time_struct` instance converted
 from the timestamp embedded in the data file.
 
+.segment        Segment number or None
+.scan0          Index of the first sample in the test
+When a long test is split across several files (lcrun -g), each file is
+a segment.  SEGMENT counts the files from zero, and SCAN0 is the index of
+the file's first sample counted from the start of the test (in samples
+at `rate()`, after any downsampling), so the times
+returned by time() continue from one segment to the next.  For files 
+that hold a complete test, SEGMENT is None and SCAN0 is 0.
+
 .cal            T/F has the calibration been applied?
 When `cal` is `True`, it indicates that the channel calibrations have 
 been applied to the data.
@@ -666,6 +881,8 @@ the second identifies the channel.  This also supports slicing.
     def __init__(self, config, data, cal=True):
         self.data = None
         self.timestamp = None
+        self.segment = None
+        self.scan0 = 0
         self.filename = ''
         self.cal = False
         self.config = None
@@ -732,6 +949,15 @@ the second identifies the channel.  This also supports slicing.
         """Returns the number of channels in the data set"""
         return self.data.shape[1]
         
+    def rate(self):
+        """Returns the rate (in Hz) of the samples in the data set
+        
+The device streams at `config.samplehz`, but when `config.downsample` 
+is set (including preview and envelope files), only one of every 
+`downsample+1` scans is kept.  SCAN0 counts the kept samples, too.
+"""
+        return self.config.samplehz / (self.config.downsample + 1)
+        
     def apply_cal(self):
         """apply_cal()  Applies calibrations to the data
     If the `cal` member is `False`, the `apply_cal()` method applies 
@@ -889,14 +1115,15 @@ See the get_index() for a detailed description of the arguments
     t = time()
     
 Constructs a 1-D time array with values in seconds for each of the rows
-of the data array.  Repeated calls to `time()` return the same array, so
+of the data array.  In a segment of a longer test, the times are measured
+from the start of the test.  Repeated calls to `time()` return the same array, so
 users should make a copy of the array before editing its values unless
 they want the effects to be permanent.
 """
         if self._time is None:
-            T = 1./self.config.samplehz
+            T = 1./self.rate()
             N = self.data.shape[0]
-            self._time = np.arange(0.,N*T,T)
+            self._time = np.arange(0.,N*T,T) + self.scan0*T
         return self._time
 
     def ds(self, tstart, tstop=None, downsample=0):
@@ -916,9 +1143,9 @@ no filter has been applied to prevent aliasing.  It is solid practice to
 apply a digital filter to the data before artificially reducing the 
 sample rate.
 """
-        start = round(tstart * self.config.samplehz)
+        start = round(tstart * self.rate())
         if tstop is not None:
-            stop = round(tstop * self.config.samplehz)
+            stop = round(tstop * self.rate())
         else:
             stop = -1
         step = int(downsample) + 1
@@ -1157,9 +1384,9 @@ the level is interpreted in appropriate units, e.g. V / (sec ** diff)
         i0 = 0
         i1 = -1
         if tstart:
-            i0 = int(round(tstart * self.config.samplehz))
+            i0 = int(round(tstart * self.rate()))
         if tstop:
-            i1 = int(round(tstop * self.config.samplehz))
+            i1 = int(round(tstop * self.rate()))
             
         indices = []
         
@@ -1167,7 +1394,7 @@ the level is interpreted in appropriate units, e.g. V / (sec ** diff)
         y = self[i0:i1,aich]
         if diff:
             y = np.diff(y, diff)
-            y *= self.config.samplehz**diff
+            y *= self.rate()**diff
         
         # Transpose to a boolean array
         y = (y > level)
@@ -1222,9 +1449,9 @@ filter; all transitions will be reported.
         i0 = 0
         i1 = -1
         if tstart:
-            i0 = int(round(tstart * self.config.samplehz))
+            i0 = int(round(tstart * self.rate()))
         if tstop:
-            i1 = int(round(tstop * self.config.samplehz))
+            i1 = int(round(tstop * self.rate()))
             
         indices = []
         
@@ -1241,8 +1468,10 @@ filter; all transitions will be reported.
         return indices
         
 
-def load(filename, data=True, cal=True):
-    """load(filename, data=True, cal=True)
+def load(filename, data=True, cal=True, verify=False, frames=None, 
+        channels=None):
+    """load(filename, data=True, cal=True, verify=False, frames=None,
+        channels=None)
     
 Opens the indicated file and (1) parses the configuration header, and 
 (2) if data=True, also loads the data contained therein.  The same tool
@@ -1264,15 +1493,65 @@ returned list will appear
 
 >>> [c, d] = load(filename)
 
+Merged data files (written by lcmerge) list several devices in the header,
+and their channels appear side by side in each row.  The columns are split
+among the devices, and an LData instance is appended for each of them.
+
+>>> [c0, c1, d0, d1] = load(filename)
+
+Framed data files (dataformat framed) accept two more keywords.  When
+verify is True, the CRC of every frame is checked, and damaged frames are
+skipped.  The check is done in pure Python, so it is slow; lcverify is a
+faster way to check a large file.  The frames keyword is a slice that 
+selects the blocks to load by their number in the file.  The index in the
+file is used to go straight to them, so
+
+>>> [c, d] = load(filename, frames=slice(-10, None))
+
+reads only the last ten blocks of a long test.  SCAN0 of the result is
+the index of the first scan that was loaded.
+
+Columnar data files (dataformat columnar) are framed files that store 
+each chunk of scans one channel after another.  The channels keyword is
+a list of channel indices or labels to load, and only those channels are
+read from the file, so
+
+>>> [c, d] = load(filename, channels=['Battery Voltage'])
+>>> v = d.get_channel('Battery Voltage')
+
+reads about 1/N of a file with N channels.  The channels that were not 
+read are NaN.  Other data formats ignore the channels keyword and load
+every channel.
+
+The filename may also be an open binary file or '-' for stdin, so data
+can be read straight from a pipe.
+
+    $ lcrun -d - | python3 myanalysis.py
+
+where myanalysis.py calls
+
+>>> [c, d] = load('-')
+
+A pipe is read until the writer closes it, and then it is parsed like
+a file.
+
 For more information on how to work with these DevConf and LData 
 instances, use the in-line help on them or their methods.
 """
     out = []
     dconf = None
     ldata = None
-    filename = os.path.abspath(filename)
-
-    with open(filename,'rb') as ff:
+    # Data may also come from a pipe (lcrun -d -).  The parser needs to 
+    # seek, so streams are collected in memory first.
+    if filename == '-':
+        filename = sys.stdin.buffer
+    if hasattr(filename, 'read'):
+        source = io.BytesIO(filename.read())
+    else:
+        filename = os.path.abspath(filename)
+        source = open(filename,'rb')
+
+    with source as ff:
         
         # start the parse
         # Read in the new
@@ -1308,10 +1587,18 @@ instances, use the in-line help on them or their methods.
             # Initialize the result
             timestamp = None
             # Detect the number of channels
-            nch = len(dconf.aich) + (dconf.distream != 0)
+            # Merged files have every device's channels in each row
+            nchs = [len(c.aich) + (c.distream != 0) for c in out]
+            nch = sum(nchs)
             # Scan for the timestamp
+            # Files that are one segment of a longer test (lcrun -g) say
+            # which segment they are and where their first scan falls.
+            segment = None
+            scan0 = 0
             thisline = ff.readline().decode('utf-8').strip()
             while not thisline.startswith('#:'):
+                if thisline.startswith('#segment'):
+                    segment, scan0 = [int(s) for s in thisline.split()[1:3]]
                 thisline = ff.readline().decode('utf-8').strip()
             try:
                 timestamp = time.strptime(thisline, '#: %a %b %d %H:%M:%S %Y')
@@ -1329,6 +1616,30 @@ instances, use the in-line help on them or their methods.
                         raise Exception('LOAD: Line does not have the correct number of samples:\n' + thisline)
                     data_temp.append(samples)
                     thisline = ff.readline().decode('utf-8')
+            # If framed binary format
+            elif dconf.dataformat.getvalue() in (2, 3):
+                columns = None
+                if channels is not None:
+                    labels = []
+                    for c in out:
+                        labels += [a.ailabel for a in c.aich]
+                        if c.distream:
+                            labels.append('distream')
+                    columns = []
+                    for ch in channels:
+                        if isinstance(ch, str):
+                            if ch not in labels:
+                                raise Exception('LOAD: Unrecognized channel label: ' + ch)
+                            ch = labels.index(ch)
+                        elif ch < 0:
+                            ch += nch
+                        if ch < 0 or ch >= nch:
+                            raise Exception('LOAD: Channel %d is out of range with %d channels.'%(ch, nch))
+                        columns.append(ch)
+                data_temp, first = _read_frames(ff, nch, verify=verify, 
+                        frames=frames, columns=columns)
+                if first is not None:
+                    scan0 = first
             # If binary format
             else:
                 data_temp = []
@@ -1342,8 +1653,15 @@ instances, use the in-line help on them or their methods.
                     s = ff.read(4)
                 if samples:
                     print('LOAD: WARNING: last data line was not complete.')
-            DATA = LData(dconf, data_temp, cal=cal)
-            DATA.timestamp = timestamp
-            out.append(DATA)
+            # Split the columns among the devices
+            start = 0
+            for c,n in zip(list(out), nchs):
+                DATA = LData(c, [row[start:start+n] for row in data_temp] \
+                        if len(nchs) > 1 else data_temp, cal=cal)
+                DATA.timestamp = timestamp
+                DATA.segment = segment
+                DATA.scan0 = scan0
+                out.append(DATA)
+                start += n
     return out
         